@@ -0,0 +1,65 @@
+#ifndef HOST_Arduino_h
+#define HOST_Arduino_h
+
+/*
+ * The Arduino core on the Linux host: the types, the time functions, the PROGMEM macros, the String and Print classes.
+ * millis() and micros() are the real monotonic time, the receiver modules get the simulated time from the host HAL.
+ * The heap is the operator new/delete counter, ESP.getFreeHeap() reports the free memory of the esp8266 heap size.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+typedef uint8_t  byte;
+typedef bool     boolean;
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+template <typename T> inline T abs(T x) { return (x > 0)?x:-x; }   // As the Arduino macro, for the unsigned types too
+using std::min;
+using std::max;
+
+#define PROGMEM
+typedef const char* PGM_P;
+#define PSTR(s)            (s)
+#define pgm_read_byte(p)   (*(const uint8_t *)(p))
+#define pgm_read_word(p)   (*(const uint16_t *)(p))
+#define strlen_P           strlen
+#define strcpy_P           strcpy
+#define memcpy_P           memcpy
+class __FlashStringHelper;
+#define FPSTR(p)           (reinterpret_cast<const __FlashStringHelper *>(p))
+#define F(s)               FPSTR(s)
+
+uint32_t  millis(void);
+uint32_t  micros(void);
+void      delay(uint32_t ms);
+void      yield(void);
+long      random(long howbig);
+long      random(long howsmall, long howbig);
+void      randomSeed(unsigned long seed);
+
+//------------------------------------------ heap usage counter ------------------------------------------------
+const uint32_t host_heap_size = 81920;          // The esp8266 heap size
+uint32_t  hostHeapUsed(void);                   // The bytes allocated by operator new now
+uint32_t  hostHeapPeak(void);                   // The maximum bytes allocated since the last reset
+void      hostHeapPeakReset(void);
+
+class EspClass {
+  public:
+    uint32_t  getFreeHeap(void)                 { return host_heap_size - hostHeapUsed(); }
+};
+extern EspClass ESP;
+
+#include "WString.h"
+#include "Print.h"
+
+#endif
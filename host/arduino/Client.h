@@ -0,0 +1,21 @@
+#ifndef HOST_Client_h
+#define HOST_Client_h
+
+#include <Arduino.h>
+
+//------------------------------------------ Arduino TCP client ------------------------------------------------
+class Client : public Stream {
+  public:
+    virtual   int connect(const char* host, uint16_t port) = 0;
+    virtual   size_t write(uint8_t c) = 0;
+    virtual   size_t write(const uint8_t* buff, size_t size) = 0;
+    virtual   int available(void) = 0;
+    virtual   int read(void) = 0;
+    virtual   int peek(void) = 0;
+    virtual   void flush(void) = 0;
+    virtual   void stop(void) = 0;
+    virtual   uint8_t connected(void) = 0;
+    using     Print::write;
+};
+
+#endif
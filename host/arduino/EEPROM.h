@@ -0,0 +1,29 @@
+#ifndef HOST_EEPROM_h
+#define HOST_EEPROM_h
+
+/*
+ * The EEPROM of the AVR core in RAM for the transmitter simulations. The new EEPROM is erased (0xFF), its size
+ * can be changed. The writes of every cell and all the reads are counted, so the wear and the cost of the data
+ * recovery can be measured.
+ */
+
+#include <vector>
+#include <Arduino.h>
+
+//------------------------------------------ AVR EEPROM in RAM -------------------------------------------------
+class EEPROMClass {
+  public:
+    EEPROMClass()                               { resize(1024); }
+    uint8_t   read(int idx)                     { ++reads; return cell[idx]; }
+    void      write(int idx, uint8_t val)       { cell[idx] = val; ++writes[idx]; }
+    void      update(int idx, uint8_t val)      { if (cell[idx] != val) write(idx, val); }
+    uint16_t  length(void)                      { return cell.size(); }
+    void      resize(uint16_t size)             { cell.assign(size, 0xFF); writes.assign(size, 0); reads = 0; }
+    std::vector<uint8_t>  cell;                 // The EEPROM content
+    std::vector<uint32_t> writes;               // The number of the writes of each cell
+    uint32_t  reads;                            // The number of the bytes read
+};
+
+inline EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef HOST_ESP8266WebServer_h
+#define HOST_ESP8266WebServer_h
+
+// The web server answer sink: counts the chunks and the bytes sent, keeps the page if asked, times the first chunk
+#include <Arduino.h>
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+
+class ESP8266WebServer {
+  public:
+    ESP8266WebServer(int port = 80)             { keep = false; chunks = bytes = first_us = 0; }
+    void      setContentLength(size_t len)      { }
+    void      send(int code, const char* type, const String& content) { sendContent(content); }
+    void      sendContent(const String& s)      { sendContent(s.c_str(), s.length()); }
+    void      sendContent(const char* s, size_t n) { if (n == 0) return; if (chunks++ == 0) first_us = micros(); bytes += n; if (keep) page.concat(s, n); }
+    bool      keep;                             // Keep the page sent
+    String    page;
+    uint32_t  chunks;
+    uint32_t  bytes;
+    uint32_t  first_us;                         // micros() when the first chunk was sent
+};
+
+#endif
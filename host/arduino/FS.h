@@ -0,0 +1,100 @@
+#ifndef HOST_FS_h
+#define HOST_FS_h
+
+/*
+ * The esp8266 file system API over the files kept in memory. The operations and the bytes written are counted,
+ * so the flash wear of the receiver modules can be compared on the host.
+ */
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+typedef std::vector<uint8_t> fileData;
+
+struct fileImpl {
+  std::shared_ptr<fileData> data;
+  std::string name;
+  uint32_t  pos;
+  bool      can_read;
+  bool      can_write;
+  bool      append;
+};
+
+struct fsStats {
+  uint32_t  opens;                              // Number of the files opened
+  uint32_t  writes;                             // Number of the write calls
+  uint32_t  bytes_written;
+  uint32_t  bytes_read;
+};
+
+//------------------------------------------ file in memory ----------------------------------------------------
+class File : public Stream {
+  public:
+    File()                                      { }
+    File(std::shared_ptr<fileImpl> f, fsStats* s) : impl(f), stats(s) { }
+    using     Print::write;
+    virtual   size_t write(uint8_t c)           { return write(&c, 1); }
+    virtual   size_t write(const uint8_t* buff, size_t size);
+    virtual   int available(void)               { return (impl)?int(impl->data->size() - impl->pos):0; }
+    virtual   int read(void);
+    virtual   int peek(void);
+    size_t    read(uint8_t* buff, size_t size);
+    bool      seek(uint32_t pos, SeekMode mode = SeekSet);
+    uint32_t  position(void) const              { return (impl)?impl->pos:0; }
+    uint32_t  size(void) const                  { return (impl)?impl->data->size():0; }
+    void      close(void)                       { impl.reset(); }
+    const char* name(void) const                { return (impl)?impl->name.c_str():""; }
+    operator  bool() const                      { return bool(impl); }
+  private:
+    std::shared_ptr<fileImpl> impl;
+    fsStats*  stats = 0;
+};
+
+//------------------------------------------ directory listing -------------------------------------------------
+class Dir {
+  public:
+    Dir()                                       { pos = -1; }
+    Dir(const std::vector<std::pair<std::string, uint32_t> >& l) : list(l) { pos = -1; }
+    bool      next(void)                        { return ++pos < int(list.size()); }
+    String    fileName(void)                    { return String(list[pos].first.c_str()); }
+    size_t    fileSize(void)                    { return list[pos].second; }
+  private:
+    std::vector<std::pair<std::string, uint32_t> > list;
+    int       pos;
+};
+
+struct FSInfo {
+  size_t    totalBytes;
+  size_t    usedBytes;
+};
+
+//------------------------------------------ file system in memory ---------------------------------------------
+class FS {
+  public:
+    FS()                                        { clearStats(); }
+    bool      begin(void)                       { return true; }
+    bool      format(void)                      { files.clear(); return true; }
+    File      open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+    File      open(const char* path, const char* mode);
+    bool      exists(const String& path)        { return files.count(path.c_str()) > 0; }
+    bool      remove(const String& path)        { return files.erase(path.c_str()) > 0; }
+    bool      rename(const String& from, const String& to);
+    Dir       openDir(const String& path);
+    bool      info(FSInfo& info);
+    void      clearStats(void)                  { memset(&stats, 0, sizeof(stats)); }
+    const     fsStats& statistics(void)         { return stats; }
+  private:
+    std::map<std::string, std::shared_ptr<fileData> > files;
+    fsStats   stats;
+};
+
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef HOST_Print_h
+#define HOST_Print_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+class String;
+
+//------------------------------------------ Arduino Print and Stream ------------------------------------------
+class Print {
+  public:
+    virtual   ~Print()                          { }
+    virtual   size_t write(uint8_t c) = 0;
+    virtual   size_t write(const uint8_t* buff, size_t size);
+    size_t    write(const char* s);
+    size_t    print(const char* s)              { return write(s); }
+    size_t    print(const String& s);
+    size_t    print(char c)                     { return write(uint8_t(c)); }
+    size_t    print(unsigned char v, int base = 10) { return print((unsigned long long)v, base); }
+    size_t    print(int v, int base = 10)       { return print((long long)v, base); }
+    size_t    print(unsigned int v, int base = 10) { return print((unsigned long long)v, base); }
+    size_t    print(long v, int base = 10)      { return print((long long)v, base); }
+    size_t    print(unsigned long v, int base = 10) { return print((unsigned long long)v, base); }
+    size_t    print(long long v, int base = 10);
+    size_t    print(unsigned long long v, int base = 10);
+    size_t    print(double v, int digits = 2);
+    size_t    println(void)                     { return write("\r\n"); }
+    template <typename T> size_t println(const T& v)          { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(const T& v, int b)   { size_t n = print(v, b); return n + println(); }
+};
+
+class Stream : public Print {
+  public:
+    virtual   int available(void) = 0;
+    virtual   int read(void) = 0;
+    virtual   int peek(void) = 0;
+    virtual   void flush(void)                  { }
+};
+
+#endif
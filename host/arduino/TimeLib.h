@@ -0,0 +1,34 @@
+#ifndef HOST_TimeLib_h
+#define HOST_TimeLib_h
+
+// The Time library: the clock is set by setTime() only, it does not run by itself
+#include <Arduino.h>
+#include <time.h>
+#include <stdint.h>
+
+typedef struct {
+  uint8_t   Second;
+  uint8_t   Minute;
+  uint8_t   Hour;
+  uint8_t   Wday;                               // Day of week, sunday is day 1
+  uint8_t   Day;
+  uint8_t   Month;
+  uint8_t   Year;                               // Offset from 1970
+} tmElements_t;
+
+typedef enum { timeNotSet, timeNeedsSync, timeSet } timeStatus_t;
+
+time_t    now(void);
+void      setTime(time_t t);
+timeStatus_t timeStatus(void);
+void      breakTime(time_t t, tmElements_t& tm);
+time_t    makeTime(const tmElements_t& tm);
+int       year(time_t t);
+int       month(time_t t);
+int       day(time_t t);
+int       hour(time_t t);
+int       minute(time_t t);
+int       second(time_t t);
+int       weekday(time_t t);
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef HOST_WString_h
+#define HOST_WString_h
+
+/*
+ * The Arduino String. As in the esp8266 core, the strings up to sso_size characters are kept inside the object,
+ * the longer strings are allocated on the heap, so the heap usage of the receiver modules is close to the real one.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+class __FlashStringHelper;
+
+//------------------------------------------ Arduino String ----------------------------------------------------
+class String {
+  public:
+    String(const char* s = "");
+    String(const String& s);
+    String(const __FlashStringHelper* s)        : String(reinterpret_cast<const char*>(s)) { }
+    explicit String(char c);
+    explicit String(unsigned char v, unsigned char base = 10);
+    explicit String(int v, unsigned char base = 10);
+    explicit String(unsigned int v, unsigned char base = 10);
+    explicit String(long v, unsigned char base = 10);
+    explicit String(unsigned long v, unsigned char base = 10);
+    explicit String(long long v, unsigned char base = 10);
+    explicit String(unsigned long long v, unsigned char base = 10);
+    explicit String(double v, unsigned char decimals = 2);
+    ~String()                                   { release(); }
+    String&   operator=(const String& s)        { if (this != &s) assign(s.c_str(), s.len); return *this; }
+    String&   operator=(const char* s)          { assign(s, strlen_(s)); return *this; }
+    bool      reserve(unsigned int size);
+    unsigned int length(void) const             { return len; }
+    bool      isEmpty(void) const               { return len == 0; }
+    const char* c_str(void) const               { return (cap > sso_size)?heap:sso; }
+    bool      concat(const String& s)           { return append(s.c_str(), s.len); }
+    bool      concat(const char* s)             { return append(s, strlen_(s)); }
+    bool      concat(const char* s, unsigned int n) { return append(s, n); }
+    bool      concat(char c)                    { return append(&c, 1); }
+    bool      concat(unsigned char v)           { return concat(String(v)); }
+    bool      concat(int v)                     { return concat(String(v)); }
+    bool      concat(unsigned int v)            { return concat(String(v)); }
+    bool      concat(long v)                    { return concat(String(v)); }
+    bool      concat(unsigned long v)           { return concat(String(v)); }
+    bool      concat(double v)                  { return concat(String(v)); }
+    template <typename T> String& operator+=(const T& v) { concat(v); return *this; }
+    String&   operator+=(const char* s)         { concat(s); return *this; }
+    bool      equals(const String& s) const;
+    bool      equals(const char* s) const;
+    bool      equalsIgnoreCase(const String& s) const;
+    bool      operator==(const String& s) const { return equals(s); }
+    bool      operator==(const char* s) const   { return equals(s); }
+    bool      operator!=(const String& s) const { return !equals(s); }
+    bool      operator!=(const char* s) const   { return !equals(s); }
+    bool      operator<(const String& s) const  { return compareTo(s) < 0; }
+    int       compareTo(const String& s) const;
+    bool      startsWith(const String& s) const;
+    bool      endsWith(const String& s) const;
+    char      charAt(unsigned int i) const      { return (i < len)?c_str()[i]:0; }
+    void      setCharAt(unsigned int i, char c) { if (i < len) buff()[i] = c; }
+    char      operator[](unsigned int i) const  { return charAt(i); }
+    char&     operator[](unsigned int i);
+    int       indexOf(char c, unsigned int from = 0) const;
+    int       indexOf(const String& s, unsigned int from = 0) const;
+    int       lastIndexOf(char c) const;
+    int       lastIndexOf(const String& s) const;
+    String    substring(unsigned int from) const { return substring(from, len); }
+    String    substring(unsigned int from, unsigned int to) const;
+    void      replace(const String& find, const String& with);
+    void      remove(unsigned int index, unsigned int count = (unsigned int)-1);
+    void      toLowerCase(void);
+    void      toUpperCase(void);
+    void      trim(void);
+    long      toInt(void) const;
+    float     toFloat(void) const;
+  private:
+    static    const unsigned int sso_size = 11;
+    static    unsigned int strlen_(const char* s);
+    char*     buff(void)                        { return (cap > sso_size)?heap:sso; }
+    void      assign(const char* s, unsigned int n);
+    bool      append(const char* s, unsigned int n);
+    void      release(void);
+    unsigned int len;
+    unsigned int cap;                           // The capacity, sso_size while the string is inside the object
+    char*     heap;
+    char      sso[sso_size + 1];
+};
+
+String operator+(const String& a, const String& b);
+String operator+(const String& a, const char* b);
+String operator+(const char* a, const String& b);
+String operator+(const String& a, char c);
+String operator+(const String& a, int v);
+String operator+(const String& a, unsigned int v);
+String operator+(const String& a, long v);
+String operator+(const String& a, unsigned long v);
+inline bool operator==(const char* a, const String& b) { return b.equals(a); }
+
+#endif
@@ -0,0 +1,331 @@
+#include <Arduino.h>
+#include <ctype.h>
+#include <chrono>
+#include <new>
+#include <thread>
+
+EspClass ESP;
+
+//------------------------------------------ time --------------------------------------------------------------
+static std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+uint32_t millis(void) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+uint32_t micros(void) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield(void) { }
+
+static uint32_t rnd_state = 1;
+
+void randomSeed(unsigned long seed) {
+  rnd_state = (seed)?seed:1;
+}
+
+long random(long howbig) {
+  if (howbig <= 0) return 0;
+  rnd_state ^= rnd_state << 13;                 // xorshift32, the sequence is the same on every run
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state % howbig;
+}
+
+long random(long howsmall, long howbig) {
+  if (howsmall >= howbig) return howsmall;
+  return random(howbig - howsmall) + howsmall;
+}
+
+//------------------------------------------ heap usage counter ------------------------------------------------
+static uint32_t heap_used = 0;
+static uint32_t heap_peak = 0;
+
+uint32_t hostHeapUsed(void)      { return heap_used; }
+uint32_t hostHeapPeak(void)      { return heap_peak; }
+void     hostHeapPeakReset(void) { heap_peak = heap_used; }
+
+// The block size is kept before the block
+static void* heapAlloc(size_t size) {
+  size_t* p = (size_t *)malloc(size + sizeof(size_t));
+  if (!p) throw std::bad_alloc();
+  *p = size;
+  heap_used += size;
+  if (heap_used > heap_peak) heap_peak = heap_used;
+  return p + 1;
+}
+
+static void heapFree(void* ptr) {
+  if (!ptr) return;
+  size_t* p = (size_t *)ptr - 1;
+  heap_used -= *p;
+  free(p);
+}
+
+void* operator new(size_t size)                 { return heapAlloc(size); }
+void* operator new[](size_t size)               { return heapAlloc(size); }
+void  operator delete(void* p) noexcept         { heapFree(p); }
+void  operator delete[](void* p) noexcept       { heapFree(p); }
+void  operator delete(void* p, size_t) noexcept { heapFree(p); }
+void  operator delete[](void* p, size_t) noexcept { heapFree(p); }
+
+//------------------------------------------ Arduino String ----------------------------------------------------
+unsigned int String::strlen_(const char* s) {
+  return (s)?strlen(s):0;
+}
+
+String::String(const char* s) {
+  len = 0; cap = sso_size; heap = 0; sso[0] = '\0';
+  assign(s, strlen_(s));
+}
+
+String::String(const String& s) {
+  len = 0; cap = sso_size; heap = 0; sso[0] = '\0';
+  assign(s.c_str(), s.len);
+}
+
+String::String(char c) {
+  len = 0; cap = sso_size; heap = 0; sso[0] = '\0';
+  assign(&c, 1);
+}
+
+static void numberString(char* buff, unsigned long long v, bool negative, unsigned char base) {
+  char tmp[72];
+  int  i = 0;
+  if (base < 2) base = 10;
+  do {
+    byte d = v % base;
+    tmp[i++] = (d < 10)?'0' + d:'a' + d - 10;
+    v /= base;
+  } while (v);
+  if (negative) tmp[i++] = '-';
+  int j = 0;
+  while (i) buff[j++] = tmp[--i];
+  buff[j] = '\0';
+}
+
+// The negative numbers are written with the sign in decimal only, as two's complement of the type in other bases
+#define NUMBER_STRING(T, U)                                                               \
+String::String(T v, unsigned char base) {                                                 \
+  len = 0; cap = sso_size; heap = 0; sso[0] = '\0';                                       \
+  char buff[72];                                                                          \
+  bool n = (base == 10 && v < (T)0);                                                       \
+  numberString(buff, (n)?(U)0 - (U)v:(U)v, n, base);                                       \
+  assign(buff, strlen(buff));                                                             \
+}
+NUMBER_STRING(unsigned char, unsigned char)
+NUMBER_STRING(int, unsigned int)
+NUMBER_STRING(unsigned int, unsigned int)
+NUMBER_STRING(long, unsigned long)
+NUMBER_STRING(unsigned long, unsigned long)
+NUMBER_STRING(long long, unsigned long long)
+NUMBER_STRING(unsigned long long, unsigned long long)
+
+String::String(double v, unsigned char decimals) {
+  len = 0; cap = sso_size; heap = 0; sso[0] = '\0';
+  char buff[64];
+  snprintf(buff, sizeof(buff), "%.*f", decimals, v);
+  assign(buff, strlen(buff));
+}
+
+void String::release(void) {
+  if (cap > sso_size) delete[] heap;
+  heap = 0;
+  cap  = sso_size;
+}
+
+bool String::reserve(unsigned int size) {
+  if (size <= cap) return true;
+  char* n = new char[size + 1];
+  memcpy(n, c_str(), len + 1);
+  if (cap > sso_size) delete[] heap;
+  heap = n;
+  cap  = size;
+  return true;
+}
+
+void String::assign(const char* s, unsigned int n) {
+  if (n > cap) {
+    release();
+    reserve(n);
+  }
+  char* b = buff();
+  memmove(b, s, n);
+  b[n] = '\0';
+  len  = n;
+}
+
+bool String::append(const char* s, unsigned int n) {
+  if (n == 0) return true;
+  if (len + n > cap) {                          // The source can be inside this string
+    String tmp(*this);
+    unsigned int c = cap;
+    while (c < len + n) c = (c < 16)?16:c * 3 / 2;
+    tmp.reserve(c);
+    memcpy(tmp.buff() + len, s, n);
+    tmp.buff()[len + n] = '\0';
+    tmp.len = len + n;
+    release();
+    heap = tmp.heap; cap = tmp.cap; len = tmp.len;
+    tmp.heap = 0; tmp.cap = sso_size;
+    return true;
+  }
+  memmove(buff() + len, s, n);
+  len += n;
+  buff()[len] = '\0';
+  return true;
+}
+
+bool String::equals(const String& s) const {
+  return len == s.len && memcmp(c_str(), s.c_str(), len) == 0;
+}
+
+bool String::equals(const char* s) const {
+  return strcmp(c_str(), (s)?s:"") == 0;
+}
+
+bool String::equalsIgnoreCase(const String& s) const {
+  return len == s.len && strncasecmp(c_str(), s.c_str(), len) == 0;
+}
+
+int String::compareTo(const String& s) const {
+  return strcmp(c_str(), s.c_str());
+}
+
+bool String::startsWith(const String& s) const {
+  return s.len <= len && memcmp(c_str(), s.c_str(), s.len) == 0;
+}
+
+bool String::endsWith(const String& s) const {
+  return s.len <= len && memcmp(c_str() + len - s.len, s.c_str(), s.len) == 0;
+}
+
+char& String::operator[](unsigned int i) {
+  static char dummy;
+  if (i >= len) return dummy = 0;
+  return buff()[i];
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  if (from >= len) return -1;
+  const char* p = strchr(c_str() + from, c);
+  return (p)?p - c_str():-1;
+}
+
+int String::indexOf(const String& s, unsigned int from) const {
+  if (from > len) return -1;
+  const char* p = strstr(c_str() + from, s.c_str());
+  return (p)?p - c_str():-1;
+}
+
+int String::lastIndexOf(char c) const {
+  const char* p = strrchr(c_str(), c);
+  return (p)?p - c_str():-1;
+}
+
+int String::lastIndexOf(const String& s) const {
+  if (s.len > len) return -1;
+  for (int i = len - s.len; i >= 0; --i) {
+    if (memcmp(c_str() + i, s.c_str(), s.len) == 0) return i;
+  }
+  return -1;
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+  if (from > to) std::swap(from, to);
+  if (from >= len) return String();
+  if (to > len) to = len;
+  String s;
+  s.assign(c_str() + from, to - from);
+  return s;
+}
+
+void String::replace(const String& find, const String& with) {
+  if (find.len == 0) return;
+  String r;
+  unsigned int i = 0;
+  while (i < len) {
+    if (i + find.len <= len && memcmp(c_str() + i, find.c_str(), find.len) == 0) {
+      r.concat(with);
+      i += find.len;
+    } else {
+      r.concat(c_str()[i++]);
+    }
+  }
+  *this = r;
+}
+
+void String::remove(unsigned int index, unsigned int count) {
+  if (index >= len) return;
+  if (count > len - index) count = len - index;
+  char* b = buff();
+  memmove(b + index, b + index + count, len - index - count + 1);
+  len -= count;
+}
+
+void String::toLowerCase(void) {
+  for (unsigned int i = 0; i < len; ++i) buff()[i] = tolower(buff()[i]);
+}
+
+void String::toUpperCase(void) {
+  for (unsigned int i = 0; i < len; ++i) buff()[i] = toupper(buff()[i]);
+}
+
+void String::trim(void) {
+  unsigned int b = 0, e = len;
+  while (b < e && isspace(c_str()[b])) ++b;
+  while (e > b && isspace(c_str()[e-1])) --e;
+  *this = substring(b, e);
+}
+
+long String::toInt(void) const {
+  return atol(c_str());
+}
+
+float String::toFloat(void) const {
+  return atof(c_str());
+}
+
+String operator+(const String& a, const String& b)  { String r(a); r.concat(b); return r; }
+String operator+(const String& a, const char* b)    { String r(a); r.concat(b); return r; }
+String operator+(const char* a, const String& b)    { String r(a); r.concat(b); return r; }
+String operator+(const String& a, char c)           { String r(a); r.concat(c); return r; }
+String operator+(const String& a, int v)            { String r(a); r.concat(v); return r; }
+String operator+(const String& a, unsigned int v)   { String r(a); r.concat(v); return r; }
+String operator+(const String& a, long v)           { String r(a); r.concat(v); return r; }
+String operator+(const String& a, unsigned long v)  { String r(a); r.concat(v); return r; }
+
+//------------------------------------------ Arduino Print -----------------------------------------------------
+size_t Print::write(const uint8_t* buff, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    if (write(*buff++) == 0) break;
+    ++n;
+  }
+  return n;
+}
+
+size_t Print::write(const char* s) {
+  return write((const uint8_t *)s, strlen(s));
+}
+
+size_t Print::print(const String& s) {
+  return write((const uint8_t *)s.c_str(), s.length());
+}
+
+size_t Print::print(long long v, int base) {
+  return print(String(v, base));
+}
+
+size_t Print::print(unsigned long long v, int base) {
+  return print(String(v, base));
+}
+
+size_t Print::print(double v, int digits) {
+  return print(String(v, digits));
+}
@@ -0,0 +1,100 @@
+#include <FS.h>
+
+namespace fs {
+
+//------------------------------------------ file in memory ----------------------------------------------------
+size_t File::write(const uint8_t* buff, size_t size) {
+  if (!impl || !impl->can_write) return 0;
+  fileData& d = *impl->data;
+  if (impl->append) impl->pos = d.size();
+  if (impl->pos + size > d.size()) d.resize(impl->pos + size);
+  memcpy(&d[impl->pos], buff, size);
+  impl->pos += size;
+  if (stats) {
+    ++stats->writes;
+    stats->bytes_written += size;
+  }
+  return size;
+}
+
+int File::read(void) {
+  uint8_t c;
+  return (read(&c, 1) == 1)?c:-1;
+}
+
+int File::peek(void) {
+  if (!impl || impl->pos >= impl->data->size()) return -1;
+  return (*impl->data)[impl->pos];
+}
+
+size_t File::read(uint8_t* buff, size_t size) {
+  if (!impl || !impl->can_read) return 0;
+  fileData& d = *impl->data;
+  if (impl->pos >= d.size()) return 0;
+  if (size > d.size() - impl->pos) size = d.size() - impl->pos;
+  memcpy(buff, &d[impl->pos], size);
+  impl->pos += size;
+  if (stats) stats->bytes_read += size;
+  return size;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+  if (!impl) return false;
+  int64_t p = pos;
+  if (mode == SeekCur) p += impl->pos;
+  if (mode == SeekEnd) p += impl->data->size();
+  if (p < 0 || p > int64_t(impl->data->size())) return false;
+  impl->pos = p;
+  return true;
+}
+
+//------------------------------------------ file system in memory ---------------------------------------------
+File FS::open(const char* path, const char* mode) {
+  bool plus = strchr(mode, '+') != 0;
+  std::shared_ptr<fileImpl> f = std::make_shared<fileImpl>();
+  f->name      = path;
+  f->pos       = 0;
+  f->append    = false;
+  auto it = files.find(path);
+  if (mode[0] == 'r') {
+    if (it == files.end()) return File();
+    f->data      = it->second;
+    f->can_read  = true;
+    f->can_write = plus;
+  } else {
+    if (mode[0] == 'w' || it == files.end())    // "w" truncates the file, "a" creates it if missing
+      it = files.insert_or_assign(path, std::make_shared<fileData>()).first;
+    f->data      = it->second;
+    f->can_read  = plus;
+    f->can_write = true;
+    f->append    = (mode[0] == 'a');
+  }
+  ++stats.opens;
+  return File(f, &stats);
+}
+
+bool FS::rename(const String& from, const String& to) {
+  auto it = files.find(from.c_str());
+  if (it == files.end()) return false;
+  files[to.c_str()] = it->second;
+  files.erase(it);
+  return true;
+}
+
+Dir FS::openDir(const String& path) {
+  std::vector<std::pair<std::string, uint32_t> > list;
+  for (auto& f : files) {
+    if (f.first.compare(0, path.length(), path.c_str()) == 0)
+      list.push_back(std::make_pair(f.first, uint32_t(f.second->size())));
+  }
+  return Dir(list);
+}
+
+bool FS::info(FSInfo& info) {
+  info.totalBytes = 3 * 1024 * 1024;
+  info.usedBytes  = 0;
+  for (auto& f : files) info.usedBytes += f.second->size();
+  return true;
+}
+
+}
@@ -0,0 +1,47 @@
+#include <string.h>
+#include <TimeLib.h>
+
+static time_t clock_now = 0;
+static bool   clock_set = false;
+
+time_t now(void)              { return clock_now; }
+void   setTime(time_t t)      { clock_now = t; clock_set = true; }
+timeStatus_t timeStatus(void) { return (clock_set)?timeSet:timeNotSet; }
+
+void breakTime(time_t t, tmElements_t& tm) {
+  struct tm g;
+  gmtime_r(&t, &g);
+  tm.Second = g.tm_sec;
+  tm.Minute = g.tm_min;
+  tm.Hour   = g.tm_hour;
+  tm.Wday   = g.tm_wday + 1;
+  tm.Day    = g.tm_mday;
+  tm.Month  = g.tm_mon + 1;
+  tm.Year   = g.tm_year - 70;
+}
+
+time_t makeTime(const tmElements_t& tm) {
+  struct tm g;
+  memset(&g, 0, sizeof(g));
+  g.tm_sec  = tm.Second;
+  g.tm_min  = tm.Minute;
+  g.tm_hour = tm.Hour;
+  g.tm_mday = tm.Day;
+  g.tm_mon  = tm.Month - 1;
+  g.tm_year = tm.Year + 70;
+  return timegm(&g);
+}
+
+static struct tm brokenTime(time_t t) {
+  struct tm g;
+  gmtime_r(&t, &g);
+  return g;
+}
+
+int year(time_t t)    { return brokenTime(t).tm_year + 1900; }
+int month(time_t t)   { return brokenTime(t).tm_mon + 1; }
+int day(time_t t)     { return brokenTime(t).tm_mday; }
+int hour(time_t t)    { return brokenTime(t).tm_hour; }
+int minute(time_t t)  { return brokenTime(t).tm_min; }
+int second(time_t t)  { return brokenTime(t).tm_sec; }
+int weekday(time_t t) { return brokenTime(t).tm_wday + 1; }
@@ -0,0 +1,10 @@
+#ifndef HOST_umm_malloc_cfg_h
+#define HOST_umm_malloc_cfg_h
+
+// The free heap low water mark of the umm_malloc statistics (UMM_STATS_FULL) by the host heap counter
+#include <Arduino.h>
+
+inline size_t umm_free_heap_size_lw_min(void)     { return host_heap_size - hostHeapPeak(); }
+inline size_t umm_free_heap_size_min_reset(void)  { hostHeapPeakReset(); return host_heap_size - hostHeapUsed(); }
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ * The benchmark of the receiver modules on the Linux host. The configuration, the log and the notifier files
+ * are made by the receiver code itself in the file system in memory, then the operations are timed by micros().
+ * The times are the host times, they show the relative cost of the operations, not the esp8266 times.
+ */
+
+#include "host_hal.h"
+#include "config.h"
+#include "wm.h"
+#include "log.h"
+#include "mail.h"
+#include "json.h"
+#include "render.h"
+
+extern hostHAL    host_hal;                     // Global variable, declared in receiver.cpp
+extern WMconfig   cfg;                          // Global variable, declared in receiver.cpp
+extern WMpool     pool;                         // Global variable, declared in receiver.cpp
+extern wmlog      data_log;                     // Global variable, declared in receiver.cpp
+
+notifier          e_notify;
+
+const time_t   start_ts  = 1700000000;          // 14 Nov 2023
+const byte     bench_wm  = 24;                  // The number of the controllers, more than the log index size
+
+// The SMTP server is not reachable
+class offlineClient : public Client {
+  public:
+    virtual   int connect(const char* host, uint16_t port) { return 0; }
+    virtual   size_t write(uint8_t c)           { return 0; }
+    virtual   size_t write(const uint8_t* buff, size_t size) { return 0; }
+    virtual   int available(void)               { return 0; }
+    virtual   int read(void)                    { return -1; }
+    virtual   int peek(void)                    { return -1; }
+    virtual   void flush(void)                  { }
+    virtual   void stop(void)                   { }
+    virtual   uint8_t connected(void)           { return 0; }
+};
+
+// Run the operation runs times, returns the average time, us
+template <typename F> double timeUs(uint32_t runs, F op) {
+  uint32_t started = micros();
+  for (uint32_t i = 0; i < runs; ++i)
+    op();
+  return double(micros() - started) / runs;
+}
+
+// Run the operation once, returns the heap it used at the peak, bytes
+template <typename F> uint32_t heapPeak(F op) {
+  uint32_t base = hostHeapUsed();
+  hostHeapPeakReset();
+  op();
+  return hostHeapPeak() - base;
+}
+
+void report(const char* name, double us) {
+  printf("  %-44s %10.2f us\n", name, us);
+}
+
+void report(const char* name, double us, uint32_t heap) {
+  printf("  %-44s %10.2f us %8u bytes of heap at the peak\n", name, us, heap);
+}
+
+// The json handler that takes nothing, to time the parser alone
+class nullHandler : public jsonHandler {
+  public:
+    virtual   void jsonValue(uint32_t parent, uint32_t key, const char* value) { }
+};
+
+// The content of the file
+std::vector<char> readFile(const char* fn) {
+  fs::File f = hal.fileSystem().open(fn, "r");
+  std::vector<char> content(f.size());
+  f.read((uint8_t *)content.data(), content.size());
+  f.close();
+  return content;
+}
+
+// Parse the json text in memory
+void parseText(const std::vector<char>& text) {
+  nullHandler h;
+  jsonParser parser(&h);
+  for (char c : text)
+    parser.parse(c);
+}
+
+/*
+ * The registry of n controllers with the scattered IDs: adding all of them, the lookup of every controller
+ * and the heap it takes, against the linear scan of the ID array used before the registry
+ */
+void benchRegistry(byte n, volatile uint32_t& sink) {
+  byte ids[255];
+  for (uint16_t i = 0; i < n; ++i)
+    ids[i] = i * 97 % 255 + 1;
+  char name[64];
+  sprintf(name, "registry of %d: add all", n);
+  report(name, timeUs(200, [&]() {
+    wmRegistry<WM> r(n);
+    for (uint16_t i = 0; i < n; ++i) sink += (r.add(ids[i]) != 0);
+  }));
+  wmRegistry<WM> *reg = 0;
+  uint32_t heap = heapPeak([&]() {
+    reg = new wmRegistry<WM>(n);
+    for (uint16_t i = 0; i < n; ++i) reg->add(ids[i]);
+  });
+  sprintf(name, "registry of %d: find every controller", n);
+  report(name, timeUs(20000, [&]() {
+    for (uint16_t i = 0; i < n; ++i) sink += (reg->find(ids[i]) != 0);
+  }), heap);
+  delete reg;
+  sprintf(name, "linear scan of %d IDs: find every controller", n);
+  report(name, timeUs(20000, [&]() {
+    for (uint16_t i = 0; i < n; ++i) {
+      uint16_t j = 0;
+      while (j < n && ids[j] != ids[(i * 7) % n]) ++j;
+      sink += j;
+    }
+  }));
+}
+
+//------------------------------------------ the main page table -----------------------------------------------
+const char root_row[] PROGMEM = R"=====(<tr>
+<td rowspan='2' colspan='1'><a href="/wm_info?id={0}">{1}</a></td>
+<td>cold water</td><td>{2}</td>
+<td align='right'>{3}</td>
+<td rowspan='2' colspan='1'>{4}</td></tr>
+<tr>
+<td>hot water</td><td>{5}</td>
+<td align="right">{6}</td>
+</tr>
+)=====";
+
+// The table of the controllers on the main page built in one String and sent at once, as the pages were before
+void stringPage(ESP8266WebServer& server, const byte ids[]) {
+  String body = "<table cellspacing='1' cellpadding='10' border='1' align='center'>\n<tbody>\n";
+  for (byte i = 0; i < bench_wm; ++i) {
+    byte ID = ids[i];
+    body += "<tr>\n<td rowspan='2' colspan='1'><a href=\"/wm_info?id=";
+    body += String(ID);
+    body += "\">";
+    body += cfg.location(ID);
+    body += "</a></td>\n<td>cold water</td><td>";
+    body += cfg.serial(ID, false);
+    body += "</td>\n<td align='right'>";
+    body += pool.valueS(ID, false);
+    body += "</td>\n<td rowspan='2' colspan='1'>";
+    body += String(uint32_t(pool.ts(ID)));
+    body += "</td></tr>\n<tr>\n<td>hot water</td><td>";
+    body += cfg.serial(ID, true);
+    body += "</td>\n<td align=\"right\">";
+    body += pool.valueS(ID, true);
+    body += "</td>\n</tr>\n";
+  }
+  body += "</tbody>\n</table>\n";
+  server.send(200, "text/html", body);
+}
+
+// The same table written through htmlStream by the template
+void streamPage(ESP8266WebServer& server, const byte ids[]) {
+  htmlStream page(server);
+  page.begin();
+  page += "<table cellspacing='1' cellpadding='10' border='1' align='center'>\n<tbody>\n";
+  for (byte i = 0; i < bench_wm; ++i) {
+    byte ID = ids[i];
+    page.fill_P(root_row, {String(ID), cfg.location(ID), cfg.serial(ID, false), pool.valueS(ID, false),
+                           String(uint32_t(pool.ts(ID))), cfg.serial(ID, true), pool.valueS(ID, true)});
+  }
+  page += "</tbody>\n</table>\n";
+  page.end();
+}
+
+/*
+ * The main page table of bench_wm controllers by the String and by htmlStream: the time to the first chunk sent,
+ * the whole page time and the heap at the peak. The heap used that htmlStream reports itself is shown as well
+ */
+void benchPage(const byte ids[]) {
+  for (byte mode = 0; mode < 2; ++mode) {
+    auto render = [&](ESP8266WebServer& server) { (mode == 0)?stringPage(server, ids):streamPage(server, ids); };
+    uint32_t first = 0;
+    double us = timeUs(200, [&]() {
+      ESP8266WebServer server;
+      uint32_t started = micros();
+      render(server);
+      first += server.first_us - started;
+    });
+    ESP8266WebServer server;
+    uint32_t heap = heapPeak([&]() { render(server); });
+    char name[64];
+    sprintf(name, "main page, %u bytes: %s", server.bytes, (mode == 0)?"String":"htmlStream");
+    report(name, us, heap);
+    printf("  %-44s %10.2f us to the first byte", "", first / 200.0);
+    if (mode == 1) printf(", the page reports %u bytes of heap", htmlStream::heapUsed());
+    printf("\n");
+  }
+}
+
+// The json log of the old format: a month of the records of bench_wm controllers
+void makeJsonLog(const char* fn) {
+  fs::File f = hal.fileSystem().open(fn, "w");
+  for (uint32_t t = 0; t < 30 * 4; ++t) {
+    for (byte id = 1; id <= bench_wm; ++id) {
+      char line[128];
+      sprintf(line, "{ \"ID\": \"%d\", \"ts\": \"%lu\", \"cold\": \"%lu\", \"hot\": \"%lu\" }\n", id,
+              (unsigned long)(start_ts - 60 * 86400 + t * 21600), (unsigned long)(1000 * id + t * 3), (unsigned long)(2000 * id + t * 2));
+      f.print(line);
+    }
+  }
+  f.close();
+}
+
+void writeFile(const char* fn, const char* content) {
+  fs::File f = hal.fileSystem().open(fn, "w");
+  f.print(content);
+  f.close();
+}
+
+// The configuration of bench_wm controllers saved by the receiver code: the json file and the binary snapshot
+void makeConfig(void) {
+  cfg.init();
+  String ssid = "home", pass = "secret", host = "smtp.example.com", user = "user", from = "wm@example.com";
+  cfg.setWifi(ssid, pass);
+  cfg.setNTP("pool.ntp.org", 180);
+  cfg.setSmtpRelayHost(host, 465, true);
+  cfg.setSmtpAuthUser(user, pass);
+  cfg.setSmtpRelayFrom(from);
+  cfg.setSmtpEmailTo(from);
+  for (byte id = 1; id <= bench_wm; ++id) {
+    cfg.updateWM(id, 1000 + id, 2000 + id);
+    cfg.setLocation(id, "Apartment " + String(id));
+    cfg.updateWMserial(id, false, "C-" + String(id * 1117), start_ts + id * 86400L * 30);
+    cfg.updateWMserial(id, true,  "H-" + String(id * 2221), start_ts + id * 86400L * 31);
+  }
+  cfg.save();
+}
+
+// A month of the log: every controller reports every 10 minutes, the counters grow
+void makeLog(void) {
+  byte ids[bench_wm];
+  for (byte i = 0; i < bench_wm; ++i) ids[i] = i + 1;
+  data_log.loadLog(ids, bench_wm);
+  host_hal.setClock(start_ts);
+  for (uint32_t t = 0; t < 30 * 144; ++t) {
+    host_hal.advance(600000);
+    for (byte i = 0; i < bench_wm; ++i)
+      data_log.log(ids[i], 1000 * ids[i] + t * 3, 2000 * ids[i] + t * 2);
+  }
+  data_log.flush();
+}
+
+int main(void) {
+  host_hal.setClock(start_ts);
+  makeConfig();
+  makeLog();
+  printf("The receiver modules, %d controllers\n", bench_wm);
+
+  report("config parse: binary snapshot", timeUs(200, []() { cfg.init(); }), heapPeak([]() { cfg.init(); }));
+  if (!cfg.fromSnapshot()) printf("  The snapshot has not been loaded, the json time is measured twice\n");
+  String snapshot = "/config.bin";
+  fs::File sf = hal.fileSystem().open(snapshot, "r");
+  std::vector<uint8_t> snap(sf.size());
+  sf.read(snap.data(), snap.size());
+  sf.close();
+  hal.fileSystem().remove(snapshot);
+  report("config parse: json", timeUs(200, []() { cfg.init(); }), heapPeak([]() { cfg.init(); }));
+  std::vector<char> config_json = readFile("/config.json");
+  report("json parser alone: config.json", timeUs(200, [&]() { parseText(config_json); }),
+         heapPeak([&]() { parseText(config_json); }));
+  sf = hal.fileSystem().open(snapshot, "w");    // Restore the snapshot
+  sf.write(snap.data(), snap.size());
+  sf.close();
+  cfg.init();
+
+  byte ids[bench_wm];
+  for (byte i = 0; i < bench_wm; ++i) ids[i] = i + 1;
+  report("log load: index and tail scan", timeUs(200, [&]() { data_log.loadLog(ids, bench_wm); }));
+  report("log load: index only", timeUs(200, [&]() { data_log.loadLog(ids, LOG_INDEX_SIZE); }));
+  time_t week = hal.clock() - hal.clock() % 86400 - 7 * 86400;
+  auto query = [](time_t from) {
+    logQuery q(data_log.rollups(), 1, from, from + 7 * 86400, 86400);
+    struct log_bucket b;
+    while (q.next(b)) ;
+  };
+  report("log query: week by day from the log", timeUs(200, [&]() { query(week + 1); }));
+  report("log query: week by day from the rollups", timeUs(200, [&]() { query(week); }));
+
+  pool.init();
+  for (byte i = 0; i < bench_wm; ++i) {
+    struct data wmd;
+    memset(&wmd, 0, sizeof(wmd));
+    wmd.ID = ids[i]; wmd.batt_mv = 2950; wmd.channels = 2;
+    wmd.wm_data[0] = 123456 + i; wmd.wm_data[1] = 65432 + i;
+    pool.update(wmd);
+  }
+  volatile uint32_t sink = 0;
+  report("valueS() of all the controllers", timeUs(2000, [&]() {
+    for (byte i = 0; i < bench_wm; ++i) sink += pool.valueS(ids[i], i & 1).length();
+  }));
+
+  benchPage(ids);
+
+  const byte reg_size[] = {4, 64, 255};
+  for (byte n : reg_size)
+    benchRegistry(n, sink);
+
+  base64 b64;
+  String plain = "The user name and the password of the SMTP relay@example.com";
+  String coded = b64.encode(plain);
+  report("base64 encode, 61 bytes", timeUs(20000, [&]() { sink += b64.encode(plain).length(); }));
+  report("base64 decode, 84 bytes", timeUs(20000, [&]() { sink += b64.decode(coded).length(); }));
+
+  writeFile("/notify.json", "{\n  \"warn\": \"1700000000\",\n  \"urgent\": \"0\",\n  \"data\": \"1700086400\"\n}\n");
+  host_hal.client_factory = [](bool ssl) -> Client* { return new offlineClient(); };
+  report("notifier init: parse and schedule", timeUs(2000, []() { e_notify.init(); }), heapPeak([]() { e_notify.init(); }));
+  std::vector<char> notify_json = readFile("/notify.json");
+  report("json parser alone: notify.json", timeUs(2000, [&]() { parseText(notify_json); }),
+         heapPeak([&]() { parseText(notify_json); }));
+
+  const char* json_log = "/wmlog_2023-9.log";
+  makeJsonLog(json_log);
+  std::vector<char> log_json = readFile(json_log);
+  char name[64];
+  sprintf(name, "json parser alone: json log, %u KB", unsigned(log_json.size() / 1024));
+  report(name, timeUs(20, [&]() { parseText(log_json); }), heapPeak([&]() { parseText(log_json); }));
+  data_log.convertLogs();
+  fs::File bl = hal.fileSystem().open("/wmlog_2023-9.bin", "r");
+  sprintf(name, "json log conversion, %u records", unsigned((bl.size() - sizeof(struct log_header)) / sizeof(struct log_record)));
+  bl.close();
+  report(name, timeUs(20, [&]() {
+    hal.fileSystem().remove("/wmlog_2023-9.bin");
+    fs::File f = hal.fileSystem().open(json_log, "w");
+    f.write((const uint8_t *)log_json.data(), log_json.size());
+    f.close();
+    data_log.convertLogs();
+  }));
+  for (byte i = 0; i < 8; ++i)                  // The letters due are sent (the connection fails), nothing is due then
+    e_notify.send();
+  report("notifier send: nothing due", timeUs(20000, []() { e_notify.send(); }));
+  return (sink)?0:1;
+}
@@ -0,0 +1,195 @@
+/*
+ * The simulation of the transmitter counters ring in the EEPROM (see wm_atmega328p/ee_ring.h) against the EEPROM
+ * in RAM that counts the writes of every cell and the bytes read. The counters are saved many times by the batches
+ * of pulses as the transmitter does, the transmitter is restarted now and then and should load the last value saved.
+ * The wear of the cells should be even, the most worn cell should get not more writes than the wear reported.
+ * Then random checkpoints and delta records are damaged before the restart, the value loaded should be the one
+ * the full scan of the EEPROM finds: the newest valid checkpoint and its delta records before the damaged one.
+ */
+
+#include <stdio.h>
+#include <random>
+#define WM_CHANNELS 2
+#include "ee_ring.h"
+
+//------------------------------------------ the counters ring with the access to the counters -----------------
+class ring : public CONFIG {
+  public:
+    void      clear(void)                       { memset(&Config, 0, sizeof(struct cfg)); }
+    void      add(byte i, uint32_t n)           { Config.wm_data[i] += n; }
+    bool      same(const ring& r) const         { return memcmp(&Config, &r.Config, sizeof(struct cfg)) == 0; }
+    uint32_t  data(byte i) const                { return Config.wm_data[i]; }
+};
+
+const byte cp_len     = sizeof(struct cfg) + 5;  // The checkpoint record without CRC
+const byte cp_size    = 16;                     // The record sizes rounded up to the power of 2
+const byte delta_size = 4;
+
+std::mt19937 rnd(20260318);
+
+uint32_t uniform(uint32_t lo, uint32_t hi)      { return std::uniform_int_distribution<uint32_t>(lo, hi)(rnd); }
+
+/*
+ * Save the counters saves times, the batch is up to 16 pulses (see commit_pulses of the transmitter),
+ * big_ppm of the batches are bigger than a delta record takes (the counters were not saved for long).
+ * Restart the transmitter every restart_every saves, count the restarts those loaded the wrong value
+ */
+int wearRun(const char* title, uint32_t saves, uint32_t big_ppm, uint32_t restart_every) {
+  EEPROM.resize(1024);
+  ring r;
+  r.init();
+  r.clear();
+  uint32_t restarts = 0, wrong = 0, reads = 0, max_reads = 0;
+  for (uint32_t s = 1; s <= saves; ++s) {
+    if (uniform(0, 999999) < big_ppm) {
+      r.add(uniform(0, WM_CHANNELS - 1), uniform(256, 5000));
+    } else {
+      for (uint32_t p = uniform(1, 16); p > 0; --p)
+        r.add(uniform(0, WM_CHANNELS - 1), 1);
+    }
+    r.save();
+    if (s % restart_every == 0 || s == saves) {
+      uint32_t before = EEPROM.reads;
+      ring b;
+      b.init();
+      if (!b.load() || !b.same(r)) ++wrong;
+      uint32_t n = EEPROM.reads - before;
+      reads += n;
+      if (n > max_reads) max_reads = n;
+      ++restarts;
+    }
+  }
+
+  uint32_t max_writes = 0, min_writes = 0xFFFFFFFF;
+  uint64_t all_writes = 0;
+  for (uint32_t w : EEPROM.writes) {
+    if (w > max_writes) max_writes = w;
+    if (w < min_writes) min_writes = w;
+    all_writes += w;
+  }
+  uint32_t blocks   = EEPROM.length() / block_size;
+  uint32_t reported = r.wear() / (1000000 / ee_endurance);  // The writes of the most worn cell reported in the packet
+  uint32_t legacy   = (saves + 63) / 64;        // The old ring of 64 records of 16 bytes, one record per save
+  bool ok = (wrong == 0) && (max_writes <= reported);
+
+  printf("%s: %u saves into 1 KB EEPROM\n", title, saves);
+  printf("  checkpoints %u, %.1f saves per checkpoint, %.1f saves per pass over the ring\n", r.checkpoints(),
+         double(saves) / r.checkpoints(), double(saves) * blocks / r.checkpoints());
+  printf("  cell writes: max %u, min %u, mean %.1f; the wear reported %u writes (%u ppm)\n", max_writes, min_writes,
+         double(all_writes) / EEPROM.length(), reported, r.wear());
+  printf("  the old ring of 64 records: %u writes of every cell, %.1f times more\n", legacy, double(legacy) / max_writes);
+  printf("  the endurance of %u writes is reached after %.1f million saves instead of %.1f million\n", ee_endurance,
+         double(ee_endurance) * saves / max_writes / 1e6, double(ee_endurance) * 64 / 1e6);
+  printf("  restarts %u, wrong value loaded %u, EEPROM bytes read at the start: mean %.1f, max %u, %s\n",
+         restarts, wrong, double(reads) / restarts, max_reads, (ok)?"OK":"FAILED");
+  return (ok)?0:1;
+}
+
+// CRC-8, polynomial 0x07, as the ring uses
+byte crc8(byte crc, byte data) {
+  crc ^= data;
+  for (byte i = 0; i < 8; ++i)
+    crc = (crc & 0x80)?(crc << 1) ^ 0x07:(crc << 1);
+  return crc;
+}
+
+/*
+ * The reference recovery: read all the checkpoints, take the valid one with the greatest ID
+ * and add its delta records till the first one that does not match. Returns false if there is no valid checkpoint
+ */
+bool fullScan(uint32_t value[]) {
+  const std::vector<uint8_t>& ee = EEPROM.cell;
+  bool     found = false;
+  uint32_t best_id = 0;
+  uint16_t best = 0;
+  for (uint16_t addr = 0; addr + block_size <= EEPROM.length(); addr += block_size) {
+    if (ee[addr] != cp_tag) continue;
+    byte crc = 0;
+    for (byte i = 0; i < cp_len; ++i) crc = crc8(crc, ee[addr + i]);
+    if (crc != ee[addr + cp_len]) continue;
+    uint32_t id;
+    memcpy(&id, &ee[addr + 1], sizeof(uint32_t));
+    if (!found || id > best_id) {
+      found   = true;
+      best_id = id;
+      best    = addr;
+    }
+  }
+  if (!found) return false;
+  memcpy(value, &ee[best + 5], sizeof(struct cfg));
+  for (byte index = 1; cp_size + index * delta_size <= block_size; ++index) {
+    const uint8_t *rec = &ee[best + cp_size + (index - 1) * delta_size];
+    byte crc = 0;
+    for (byte i = 0; i < sizeof(uint32_t); ++i) crc = crc8(crc, byte(best_id >> (8 * i)));
+    crc = crc8(crc, index);
+    for (byte i = 0; i <= WM_CHANNELS; ++i) crc = crc8(crc, rec[i]);
+    if (rec[0] != byte(best_id) || rec[WM_CHANNELS + 1] != byte(crc ^ 0x55)) break;
+    for (byte i = 0; i < WM_CHANNELS; ++i) value[i] += rec[i + 1];
+  }
+  return true;
+}
+
+// Change the random byte of the record at addr
+void damage(uint16_t addr, byte len) {
+  EEPROM.cell[addr + uniform(0, len - 1)] ^= uniform(1, 255);
+}
+
+/*
+ * Fill the ring of ee_size bytes by the random number of saves, damage up to two random checkpoints and,
+ * in half of the trials, one random delta record, then restart the transmitter. Count the bytes read by the start:
+ * the search of the newest checkpoint and the replay of its delta records
+ */
+int damageRun(uint16_t ee_size, uint32_t trials) {
+  uint16_t blocks = ee_size / block_size;
+  uint16_t deltas = (block_size - cp_size) / delta_size;
+  uint32_t wrong = 0, damaged = 0, search = 0, max_search = 0, replay = 0;
+  for (uint32_t t = 0; t < trials; ++t) {
+    EEPROM.resize(ee_size);
+    ring r;
+    r.init();
+    r.clear();
+    for (uint32_t s = uniform(1, 3 * blocks * (deltas + 1)); s > 0; --s) {
+      if (uniform(0, 99) == 0)
+        r.add(uniform(0, WM_CHANNELS - 1), uniform(256, 5000));
+      else
+        r.add(uniform(0, WM_CHANNELS - 1), uniform(1, 16));
+      r.save();
+    }
+    for (byte n = uniform(0, 2); n > 0; --n) {
+      damage(uint16_t(uniform(0, blocks - 1)) * block_size, cp_len + 1);
+      ++damaged;
+    }
+    if (uniform(0, 1))
+      damage(uint16_t(uniform(0, blocks - 1)) * block_size + cp_size + uniform(0, deltas - 1) * delta_size, delta_size);
+
+    uint32_t expected[WM_CHANNELS];
+    bool     valid = fullScan(expected);
+    ring b;
+    EEPROM.reads = 0;
+    b.init();
+    uint32_t n = EEPROM.reads;
+    bool loaded = b.load();
+    search += n;
+    if (n > max_search) max_search = n;
+    replay += EEPROM.reads - n;
+    bool ok = (loaded == valid);
+    for (byte i = 0; ok && valid && i < WM_CHANNELS; ++i)
+      if (b.data(i) != expected[i]) ok = false;
+    if (!ok) ++wrong;
+  }
+  printf("  %4u bytes  %6u  %8u  %6u  %11.1f  %3u  %11u  %11.1f  %s\n", ee_size, trials, damaged, wrong,
+         double(search) / trials, max_search, uint32_t(blocks) * cp_size, double(replay) / trials, (wrong == 0)?"OK":"FAILED");
+  return (wrong == 0)?0:1;
+}
+
+int main(void) {
+  int failed = 0;
+  failed += wearRun("The batches of 1 to 16 pulses", 200000, 0, 97);
+  failed += wearRun("1% of the batches do not fit the delta record", 200000, 10000, 97);
+
+  printf("The restart with up to two damaged checkpoints and a damaged delta record in half of the trials\n");
+  printf("  EEPROM      trials  damaged  wrong  search mean  max  full scan  replay mean\n");
+  failed += damageRun(1024, 3000);
+  failed += damageRun(4096, 3000);
+  return failed;
+}
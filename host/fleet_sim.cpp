@@ -0,0 +1,453 @@
+/*
+ * The discrete event simulation of the transmitter fleet and the receiver. N transmitters run the transmit schedule
+ * of wm_atmega328p by its own code in slots.h: the random period or the slot in the receiver frame, the beacons,
+ * the measurement of the WDT period and the acknowledged delivery with the retries. The WDT period of every transmitter is up to 10% off,
+ * its RC oscillator that times the delays is up to 1% off. The receiver is the real link layer and packet processing
+ * of wm_receiver_esp8266 (wmLink, WMpool, wmlog) on the host HAL, it answers by the beacon or ACK.
+ * The radio is GFSK_Rb2Fd5: 2 kbps, 4 ms per byte and 13 bytes of the preamble, the headers and CRC per packet.
+ * All the stations hear each other, the packets those overlap in time are both lost, there is no capture effect.
+ * Every configuration runs in its own process, so the receiver starts from scratch.
+ * The staleness is the time from the meter pulse to the acceptance of the first packet that counts it,
+ * the receiver CPU is the host time spent in the packet processing and the log. The transmitter is awake
+ * from the start of sendWaterMeterData() till the history packet is sent, the time is counted per packet delivered,
+ * so the cost of the acknowledgement is the difference between the modes with ACK and without it.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <random>
+#include <vector>
+#include "host_hal.h"
+#include "config.h"
+#include "wm.h"
+#include "log.h"
+#include "link.h"
+#include "packet.h"
+#include "crc.h"
+#include "slots.h"
+
+extern hostHAL    host_hal;                     // Global variable, declared in receiver.cpp
+extern wmLink     wm_link;                      // Global variable, declared in receiver.cpp
+extern wmlog      data_log;                     // Global variable, declared in receiver.cpp
+
+const time_t   start_ts    = 1700000000;        // 14 Nov 2023
+const uint32_t sim_ms      = 6 * 3600000UL;     // The simulated time
+const uint32_t boot_ms     = 600000;            // The transmitters are powered on in the first 10 minutes
+const uint32_t steady_ms   = 3600000;           // The fleet is settled after the first hour
+const uint32_t pulse_ms    = 300000;            // The average interval between the meter pulses
+const byte     tx_channels = 2;
+const uint16_t turnaround_ms = 3;               // The receiver answers this time after the packet
+
+// The transmitter constants of wm_atmega328p.ino those are neither in wm_data.h nor in slots.h
+const byte     hist_every      = 4;
+const byte     hist_records    = 3;             // The snapshots in the history packet
+const byte     data_len        = pkt_data_size + tx_channels * sizeof(uint32_t);
+const uint16_t retry_ms        = retryMs(data_len);
+const bool     slot_retry      = slotRetry(data_len);
+static_assert(period_spread == tx_period_spread, "The receiver should know the random period of the transmitter");
+
+std::mt19937 rnd(20260318);
+
+uint32_t uniform(uint32_t lo, uint32_t hi)      { return std::uniform_int_distribution<uint32_t>(lo, hi)(rnd); }
+uint32_t airtime(byte len)                      { return uint32_t(len + rf_overhead) * rf_byte_ms; }
+
+//------------------------------------------ the radio channel -------------------------------------------------
+struct air {                                    // The packet on the air
+  uint32_t  start;
+  uint32_t  end;
+  int       src;                                // The transmitter index, -1 for the receiver
+  byte      len;
+  byte      buff[rx_max_len];
+  bool      data;                               // The data packet of the transmitter
+};
+
+std::deque<struct air> on_air;                  // The packets sent in the last seconds, by the start time
+uint32_t collided = 0;                          // The packets lost in the collisions
+
+void sendAir(uint32_t now, int src, const byte* buff, byte len, bool data);
+
+// The packet has been received by everybody if no other packet overlaps it
+bool clean(const struct air& a) {
+  for (const struct air& b : on_air)
+    if (&b != &a && b.start < a.end && b.end > a.start) return false;
+  return true;
+}
+
+//------------------------------------------ the transmitter ---------------------------------------------------
+struct transmitter {
+  byte      ID;
+  uint32_t  wdt_ms_x1000;                       // The real WDT period, us
+  double    clk;                                // The real time of 1 ms of millis()
+  uint32_t  wdt_gen;                            // Incremented by the WDT restart, the old WDT events are ignored
+  bool      busy;                               // The MCU is sending, the WDT interrupts are pending
+  byte      pending;                            // f_wdt
+  uint32_t  uptime;
+  int       transmit_count;
+  byte      tx_skipped;
+  byte      history_count;
+  byte      tx_flags;
+  uint16_t  tx_seq;
+  uint32_t  counter[tx_channels];
+  uint32_t  sent_data[tx_channels];
+  uint32_t  next_pulse;
+  std::deque<uint32_t> pulses;                  // The time of the meter pulses not delivered yet
+  size_t    pulses_sent;                        // The pulses counted in the packet being sent
+  struct    tx_schedule s;                      // The schedule of slots.h
+  uint32_t  tick_start;                         // The real time of the last WDT interrupt handled
+  byte      slot;                               // The slot assigned by the last beacon
+  // The data packet being sent
+  byte      flags;
+  byte      retry;
+  bool      listening;
+  uint32_t  listen_until;
+  int       ticks;                              // The result of syncSlot()
+  byte      pkt[rx_max_len];
+  byte      pkt_len;
+  bool      delivered;                          // The packet has been accepted by the receiver
+  bool      steady;                             // The packet has been sent after steady_ms
+  uint32_t  send_start;                         // The start of sendWaterMeterData(), slot_guard after the slot start
+};
+
+std::vector<struct transmitter> fleet;
+bool     use_slots = true;                      // The transmitters listen for the beacons and use the slots
+bool     use_ack   = false;                     // The data packets are acknowledged and retried, off in the sketch
+uint32_t sent = 0, delivered = 0, first_try = 0, off_slot = 0;
+uint32_t steady_sent = 0, steady_delivered = 0;
+uint64_t awake_ms = 0;                          // The time the transmitters were awake to send the packets
+std::vector<uint32_t> staleness;                // The delivery time of every pulse, ms
+
+enum { EV_WDT, EV_SEND, EV_AIR_END, EV_LISTEN_END };
+struct event {
+  uint32_t  ms;
+  uint64_t  order;
+  byte      type;
+  int       who;                                // The transmitter index or the air record sequence number
+  uint32_t  tag;
+  bool operator<(const struct event& e) const   { return (ms != e.ms)?ms > e.ms:order > e.order; }
+};
+std::priority_queue<struct event> events;
+uint64_t ev_order = 0;
+uint64_t air_seq  = 0;                          // The sequence number of the next air record
+uint64_t air_base = 0;                          // The sequence number of on_air.front()
+
+void schedule(uint32_t ms, byte type, int who, uint32_t tag = 0) {
+  events.push({ms, ev_order++, type, who, tag});
+}
+
+uint32_t delayMs(const struct transmitter& t, uint32_t ms) { return uint32_t(ms * t.clk + 0.5); }
+
+// syncSlot() of the transmitter, the beacon has been received at now
+int syncSlot(struct transmitter& t, uint32_t now, byte slot, uint32_t frame_ms) {
+  uint32_t since = uint32_t((now - t.tick_start) / t.clk);
+  ++t.wdt_gen;                                  // wdt_reset()
+  schedule(now + t.wdt_ms_x1000 / 1000, EV_WDT, &t - &fleet[0], t.wdt_gen);
+  t.tick_start  = now;
+  t.slot        = slot;
+  return syncFrame(t.s, slot, frame_ms, t.uptime, since, t.pending);
+}
+
+void buildData(struct transmitter& t) {
+  struct pkt_data pd;
+  pd.hdr.magic   = pkt_magic;
+  pd.hdr.version = pkt_version;
+  pd.hdr.type    = PKT_DATA;
+  pd.hdr.flags   = t.tx_flags | t.flags;
+  pd.hdr.ID      = t.ID;
+  pd.hdr.seq     = t.tx_seq++;
+  t.tx_flags     = 0;
+  pd.batt_mv     = 3000;
+  pd.ee_wear     = 0;
+  pd.channels    = tx_channels;
+  for (byte i = 0; i < tx_channels; ++i) {
+    pd.wm_data[i]  = t.counter[i];
+    t.sent_data[i] = t.counter[i];
+  }
+  t.pkt_len = pkt_data_size + tx_channels * sizeof(uint32_t);
+  memcpy(t.pkt, &pd, t.pkt_len - sizeof(uint16_t));
+  uint16_t crc = crc16(t.pkt, t.pkt_len - sizeof(uint16_t));
+  memcpy(&t.pkt[t.pkt_len - sizeof(uint16_t)], &crc, sizeof(uint16_t));
+}
+
+void sendHistory(struct transmitter& t, uint32_t now) {
+  byte buff[rx_max_len];
+  struct pkt_history_hdr ph;
+  ph.hdr.magic   = pkt_magic;
+  ph.hdr.version = pkt_version;
+  ph.hdr.type    = PKT_HISTORY;
+  ph.hdr.flags   = 0;
+  ph.hdr.ID      = t.ID;
+  ph.hdr.seq     = t.tx_seq++;
+  ph.channels    = tx_channels;
+  ph.records     = hist_records;
+  memcpy(buff, &ph, sizeof(struct pkt_history_hdr));
+  byte len = sizeof(struct pkt_history_hdr);
+  for (byte r = 0; r < hist_records; ++r) {
+    uint16_t age = 0;
+    memcpy(&buff[len], &age, sizeof(uint16_t));
+    len += sizeof(uint16_t);
+    for (byte i = 0; i < tx_channels; ++i) {
+      memcpy(&buff[len], &t.sent_data[i], sizeof(uint32_t));
+      len += sizeof(uint32_t);
+    }
+  }
+  uint16_t crc = crc16(buff, len);
+  memcpy(&buff[len], &crc, sizeof(uint16_t));
+  sendAir(now, &t - &fleet[0], buff, len + sizeof(uint16_t), false);
+}
+
+void handleTick(struct transmitter& t, uint32_t now);
+
+// sendWaterMeterData() is over, the loop continues
+void finishSend(struct transmitter& t, uint32_t now) {
+  t.listening = false;
+  bool listen = t.flags & PKT_F_LISTEN;
+  t.transmit_count = nextTransmit(t.s, t.ticks, listen, tx_period_base + t.ID);
+  uint32_t done = now + delayMs(t, 10);
+  if (++t.history_count >= hist_every) {
+    t.history_count = 0;
+    sendHistory(t, done);
+    done += airtime(sizeof(struct pkt_history_hdr) + hist_records * (2 + 4 * tx_channels) + 2) + delayMs(t, 10);
+  }
+  awake_ms += done - t.send_start;
+  t.busy = false;
+  while (t.pending > 0) {                       // The WDT interrupts came while sending
+    --t.pending;
+    handleTick(t, done);
+  }
+}
+
+// The WDT interrupt handled by loop()
+void handleTick(struct transmitter& t, uint32_t now) {
+  ++t.uptime;
+  t.tick_start = now;
+  while (t.next_pulse <= now) {
+    ++t.counter[uniform(0, tx_channels - 1)];
+    t.pulses.push_back(t.next_pulse);
+    t.next_pulse += uniform(1, 2 * pulse_ms);
+  }
+  if (--t.transmit_count > 0) return;
+  bool changed = false;
+  for (byte i = 0; i < tx_channels; ++i)
+    if (t.counter[i] != t.sent_data[i]) changed = true;
+  if (!(t.tx_flags || changed || ++t.tx_skipped >= heartbeat_periods || (use_slots && calibrating(t.s)))) {
+    t.transmit_count = nextTransmit(t.s, 0, false, tx_period_base + t.ID);
+    return;
+  }
+  t.tx_skipped = 0;
+  t.flags = PKT_F_ADAPTIVE;
+  uint32_t start = now;
+  if (t.s.slotted) {
+    start += delayMs(t, t.s.tx_rem_ms);
+    t.flags |= PKT_F_SLOT;
+  }
+  if (use_slots && listenDue(t.s, t.uptime))
+    t.flags |= PKT_F_LISTEN;
+  if (use_ack && (slot_retry || !(t.flags & PKT_F_SLOT))) t.flags |= PKT_F_ACK;
+  t.busy      = true;
+  t.retry     = 0;
+  t.ticks     = 0;
+  t.delivered = false;
+  t.steady    = (now >= steady_ms);
+  t.pulses_sent = t.pulses.size();
+  t.send_start  = start;
+  buildData(t);
+  ++sent;
+  if (t.steady) ++steady_sent;
+  schedule(start + delayMs(t, prepare_ms), EV_SEND, &t - &fleet[0]);
+}
+
+//------------------------------------------ the receiver ------------------------------------------------------
+std::vector<byte> answer;                       // The packet sent by the receiver while processing the packet
+uint64_t rx_us = 0;                             // The host time spent in processing the packets
+
+void receive(const struct air& a) {
+  host_hal.advance(a.end - host_hal.ms());
+  host_hal.receive(a.buff, a.len);
+  struct rx_packet pkt;
+  hal.radioRecv(pkt);
+  answer.clear();
+  uint32_t accepted = wm_link.accepted();
+  uint32_t started  = micros();
+  processPacket(pkt);
+  data_log.run();
+  rx_us += micros() - started;
+  if (a.data && wm_link.accepted() != accepted) {
+    struct transmitter& t = fleet[a.src];
+    if (!t.delivered) {
+      t.delivered = true;
+      ++delivered;
+      if (t.retry == 0) ++first_try;
+      if (t.steady) ++steady_delivered;
+      for (; t.pulses_sent > 0; --t.pulses_sent) {
+        staleness.push_back(a.end - t.pulses.front());
+        t.pulses.pop_front();
+      }
+    }
+    if (t.s.slotted && (t.flags & PKT_F_SLOT)) {  // The packet should start in the slot after the guard time
+      uint32_t pos = a.start % frame_len;
+      uint32_t slot_start = uint32_t(t.slot) * slot_ms;
+      if (pos < slot_start || pos >= slot_start + slot_ms) ++off_slot;
+    }
+  }
+  if (!answer.empty())
+    sendAir(a.end + turnaround_ms, -1, answer.data(), answer.size(), false);
+}
+
+//------------------------------------------ the events --------------------------------------------------------
+void sendAir(uint32_t now, int src, const byte* buff, byte len, bool data) {
+  struct air a;
+  a.start = now;
+  a.end   = now + airtime(len);
+  a.src   = src;
+  a.len   = len;
+  a.data  = data;
+  memcpy(a.buff, buff, len);
+  on_air.push_back(a);
+  schedule(a.end, EV_AIR_END, int(air_seq++));
+}
+
+// The reply heard by the listening transmitter, checked as the transmitter does
+void hear(struct transmitter& t, const struct air& a) {
+  int slot = beaconSlot(a.buff, a.len, t.ID);
+  if (slot >= 0) {
+    struct pkt_beacon_hdr bh;
+    memcpy(&bh, a.buff, sizeof(struct pkt_beacon_hdr));
+    t.ticks = syncSlot(t, a.end, slot, bh.frame_ms);
+    finishSend(t, a.end);
+    return;
+  }
+  uint16_t seq;
+  memcpy(&seq, &t.pkt[offsetof(struct pkt_header, seq)], sizeof(uint16_t));
+  if (isAck(a.buff, a.len, t.ID, seq)) finishSend(t, a.end);
+}
+
+void airEnd(uint64_t seq, uint32_t now) {
+  struct air &a = on_air[seq - air_base];
+  bool ok = clean(a);
+  if (!ok && a.src >= 0) ++collided;
+  if (a.src >= 0) {
+    if (ok) receive(a);
+    if (a.data) {
+      struct transmitter& t = fleet[a.src];
+      if (t.flags & (PKT_F_LISTEN | PKT_F_ACK)) {
+        uint16_t timeout = (t.flags & PKT_F_LISTEN)?beacon_listen_ms:ack_listen_ms;
+        t.listening    = true;
+        t.listen_until = now + delayMs(t, timeout);
+        schedule(t.listen_until, EV_LISTEN_END, a.src, t.retry);
+      } else {
+        finishSend(t, now);
+      }
+    }
+  } else if (ok) {
+    for (struct transmitter& t : fleet)
+      if (t.listening && now <= t.listen_until) hear(t, a);
+  }
+  while (!on_air.empty() && on_air.front().end + 10000 < now) {  // Keep the packets those can overlap the new ones
+    on_air.pop_front();
+    ++air_base;
+  }
+}
+
+void listenEnd(struct transmitter& t, uint32_t now, byte retry) {
+  if (!t.listening || t.retry != retry) return;  // The answer has been received
+  t.listening = false;
+  if (!(t.flags & PKT_F_ACK) || t.retry >= ack_retries) {
+    finishSend(t, now);
+    return;
+  }
+  uint16_t backoff = ack_backoff_ms << t.retry;
+  uint16_t wait    = uniform(backoff, 2 * backoff - 1);
+  if ((t.flags & PKT_F_SLOT) && uint32_t((now - t.send_start) / t.clk) + wait + retry_ms > slot_ms - slot_guard) {
+    finishSend(t, now);                         // The retry does not fit in the slot
+    return;
+  }
+  ++t.retry;
+  schedule(now + delayMs(t, wait), EV_SEND, &t - &fleet[0]);
+}
+
+//------------------------------------------ the simulation ----------------------------------------------------
+int run(const char* mode, uint16_t n) {
+  host_hal.setClock(start_ts);
+  host_hal.sender = [](const byte* buff, byte len) -> bool { answer.assign(buff, buff + len); return true; };
+  fleet.resize(n);
+  for (uint16_t i = 0; i < n; ++i) {
+    struct transmitter& t = fleet[i];
+    t = transmitter();
+    t.ID           = i + 1;
+    t.wdt_ms_x1000 = 1000000 - 100000 + uniform(0, 200000);
+    t.clk          = 1.0 + (int32_t(uniform(0, 2000)) - 1000) / 100000.0;
+    t.tx_flags     = PKT_F_BOOT;
+    scheduleInit(t.s);
+    t.transmit_count = 0;
+    t.next_pulse   = uniform(0, 2 * pulse_ms);
+    schedule(uniform(0, boot_ms) + 11000, EV_WDT, i, 0);
+  }
+  while (!events.empty() && events.top().ms < sim_ms) {
+    struct event e = events.top();
+    events.pop();
+    switch (e.type) {
+      case EV_WDT: {
+        struct transmitter& t = fleet[e.who];
+        if (e.tag != t.wdt_gen) break;          // The WDT has been restarted
+        schedule(e.ms + t.wdt_ms_x1000 / 1000, EV_WDT, e.who, t.wdt_gen);
+        if (t.busy) {
+          if (t.pending < 255) ++t.pending;
+        } else {
+          handleTick(t, e.ms);
+        }
+        break;
+      }
+      case EV_SEND:
+        sendAir(e.ms, e.who, fleet[e.who].pkt, fleet[e.who].pkt_len, true);
+        break;
+      case EV_AIR_END:
+        airEnd(uint64_t(e.who), e.ms);
+        break;
+      case EV_LISTEN_END:
+        listenEnd(fleet[e.who], e.ms, e.tag);
+        break;
+    }
+  }
+  byte slotted = 0;
+  for (struct transmitter& t : fleet)
+    if (t.s.slotted) ++slotted;
+  std::sort(staleness.begin(), staleness.end());
+  uint64_t stale_sum = 0;
+  for (uint32_t ms : staleness) stale_sum += ms;
+  uint32_t rx = wm_link.accepted();
+  uint16_t load = wm_link.channelLoad();
+  printf("  %-10s %4u  %6u  %8.1f%%  %8.1f%%  %9.1f%%  %8u  %7u  %8u  %4.1f%%  %5.0f %5u %5u  %6.1f  %7.1f  %6.0f\n",
+         mode, n, sent, delivered * 100.0 / sent, first_try * 100.0 / sent,
+         steady_delivered * 100.0 / steady_sent, collided, slotted, off_slot, load / 10.0,
+         double(stale_sum) / staleness.size() / 1000, staleness[staleness.size() * 95 / 100] / 1000,
+         staleness.back() / 1000, double(rx_us) / rx, rx_us / 1000.0 / (sim_ms / 3600000), double(awake_ms) / delivered);
+  host_hal.advance(2 * 600000);                 // The channel is idle for two windows of the load measurement
+  return (wm_link.channelLoad() == 0)?0:1;
+}
+
+int main(void) {
+  printf("The fleet simulation, %u hours, the meter pulse every %u s on average\n", sim_ms / 3600000, pulse_ms / 1000);
+  printf("                                                                                           staleness, s  receiver CPU   awake, ms\n");
+  printf("  mode          N    sent  delivered  first try  after 1 h  collided  slotted  off slot  load   mean   95%%   max   us/rx  ms/hour  per rx\n");
+  const char*    modes[]  = { "random", "random+ack", "slots", "slots+ack" };
+  const uint16_t fleets[] = { 10, 25, 50, 100, 150, 200 };
+  int failed = 0;
+  for (byte mode = 0; mode < 4; ++mode) {
+    for (uint16_t n : fleets) {
+      fflush(stdout);
+      pid_t pid = fork();
+      if (pid == 0) {
+        use_slots = (mode >= 2);
+        use_ack   = (mode & 1);
+        exit(run(modes[mode], n));
+      }
+      int status = 0;
+      waitpid(pid, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ++failed;
+    }
+  }
+  return failed;
+}
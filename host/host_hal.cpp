@@ -0,0 +1,23 @@
+#include "host_hal.h"
+
+bool hostHAL::radioRecv(struct rx_packet& pkt) {
+  if (rx_queue.empty()) return false;
+  pkt = rx_queue.front();
+  rx_queue.pop_front();
+  return true;
+}
+
+void hostHAL::advance(uint32_t m) {
+  uint32_t frac = sim_ms % 1000;
+  sim_ms += m;
+  setTime(now() + (frac + m) / 1000);
+}
+
+void hostHAL::receive(const byte* buff, byte len, int8_t rssi) {
+  struct rx_packet pkt;
+  pkt.ms   = sim_ms;
+  pkt.rssi = rssi;
+  pkt.len  = (len < rx_max_len)?len:rx_max_len;
+  memcpy(pkt.buff, buff, pkt.len);
+  rx_queue.push_back(pkt);
+}
@@ -0,0 +1,39 @@
+#ifndef HOST_hal_h
+#define HOST_hal_h
+
+/*
+ * The Linux host implementation of the receiver HAL: the file system in memory, the simulated clock
+ * and the simulated radio. The clock does not run by itself, the program sets the time and the milliseconds,
+ * the clock is not set (as before the NTP synchronization) till setClock() is called.
+ * The packets put by receive() are returned by radioRecv(), the packets sent by the receiver are passed
+ * to the sender callback. The TCP clients are created by the client factory.
+ */
+
+#include <deque>
+#include <functional>
+#include "hal.h"
+
+//------------------------------------------ Linux host implementation of the HAL ------------------------------
+class hostHAL : public HAL {
+  public:
+    hostHAL() : HAL()                           { sim_ms = 0; }
+    virtual   fs::FS&   fileSystem(void)        { return mem_fs; }
+    virtual   time_t    clock(void)             { return now(); }
+    virtual   bool      clockSet(void)          { return timeStatus() == timeSet; }
+    virtual   uint32_t  ms(void)                { return sim_ms; }
+    virtual   Client*   newClient(bool ssl)     { return (client_factory)?client_factory(ssl):0; }
+    virtual   bool      radioRecv(struct rx_packet& pkt);
+    virtual   bool      radioSend(const byte* buff, byte len) { return (sender)?sender(buff, len):true; }
+    void      setClock(time_t t)                { setTime(t); }
+    void      setMs(uint32_t m)                 { sim_ms = m; }
+    void      advance(uint32_t m);              // Move the time forward by m ms, the clock keeps the second fraction
+    void      receive(const byte* buff, byte len, int8_t rssi = -60);  // Put the packet into the radio queue
+    std::function<Client* (bool)> client_factory;
+    std::function<bool (const byte*, byte)> sender;
+  private:
+    fs::FS    mem_fs;
+    uint32_t  sim_ms;
+    std::deque<struct rx_packet> rx_queue;
+};
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * The simulation of the transmitter pulse counting: the reed switches of two meters on the port D bits 3 and 4
+ * close and open with the contact bounce, the pin change starts the 4 ms debounce timer, the timer samples the port
+ * by the debounce code of the transmitter (see wm_atmega328p/debounce.h) and stops when all the inputs are stable.
+ * The pulses counted should be the pulses made by the meters up to the rate the 4 samples debounce can follow,
+ * the short spikes on the open contact should not be counted at all.
+ * The timer running time is the time the MCU sleeps in idle mode instead of power down.
+ */
+
+#include <stdio.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "debounce.h"
+
+const uint32_t  sample_us   = 4096;             // Timer2 period: 8 MHz / 1024 / 32
+const byte      meter_bit[] = { 1 << 3, 1 << 4 };  // The port D bits of the meters: pins 3 and 4
+const byte      meters      = sizeof(meter_bit) / sizeof(meter_bit[0]);
+const uint32_t  max_rate_mhz = 20000;           // The pulse rate limit, see the minimum pulse width in wm_atmega328p.ino
+
+struct edge {
+  uint64_t  us;                                 // The time of the pin change
+  byte      bit;                                // The port bit changed
+  bool      closed;                             // The new level of the switch
+};
+
+std::mt19937 rnd(20260318);
+
+uint32_t uniform(uint32_t lo, uint32_t hi)      { return std::uniform_int_distribution<uint32_t>(lo, hi)(rnd); }
+
+// Change the switch level at time us, the contact bounces for bounce_us before it settles
+void bounce(std::vector<struct edge>& edges, uint64_t us, byte bit, bool closed, uint32_t bounce_us) {
+  bool level = closed;
+  uint64_t t = us;
+  uint64_t end = us + bounce_us;
+  while (true) {
+    edges.push_back({t, bit, level});
+    t += uniform(50, 400);
+    if (t >= end) break;
+    level = !level;
+  }
+  if (level != closed) edges.push_back({end, bit, closed});
+}
+
+/*
+ * The pulses of one meter: the switch is closed half of the period, the period varies by 10%.
+ * Returns the number of the pulses made
+ */
+uint32_t pulses(std::vector<struct edge>& edges, byte bit, uint32_t rate_mhz, uint32_t bounce_us, uint64_t duration_us) {
+  uint32_t period_us = uint64_t(1000000000) / rate_mhz;
+  uint64_t t = uniform(0, period_us);
+  uint32_t made = 0;
+  while (true) {
+    uint32_t p = period_us - period_us / 10 + uniform(0, period_us / 5);
+    if (t + p >= duration_us) break;
+    bounce(edges, t, bit, true, bounce_us);
+    bounce(edges, t + p / 2, bit, false, bounce_us);
+    ++made;
+    t += p;
+  }
+  return made;
+}
+
+// The spikes of spike_us on the open contact every period_us
+void spikes(std::vector<struct edge>& edges, byte bit, uint32_t spike_us, uint32_t period_us, uint64_t duration_us) {
+  for (uint64_t t = uniform(0, period_us); t + period_us < duration_us; t += period_us) {
+    edges.push_back({t, bit, true});
+    edges.push_back({t + uniform(spike_us / 2, spike_us), bit, false});
+  }
+}
+
+/*
+ * Run the pin change interrupt and the debounce timer over the edges, count the pulses of each meter.
+ * Returns the time the timer was running, us
+ */
+uint64_t run(std::vector<struct edge>& edges, uint32_t counted[]) {
+  std::stable_sort(edges.begin(), edges.end(), [](const struct edge& a, const struct edge& b) { return a.us < b.us; });
+  struct debounce db;
+  debounceInit(db, 0);
+  byte     port = 0;                            // The closed switches
+  bool     debouncing = false;
+  uint64_t next_sample = 0;
+  uint64_t running_us  = 0;
+  for (byte m = 0; m < meters; ++m) counted[m] = 0;
+  size_t e = 0;
+  while (e < edges.size() || debouncing) {
+    if (debouncing && (e >= edges.size() || next_sample <= edges[e].us)) {
+      byte pressed = debounceSample(db, port);  // ISR(TIMER2_COMPA_vect)
+      for (byte m = 0; m < meters; ++m)
+        if (pressed & meter_bit[m]) ++counted[m];
+      running_us += sample_us;
+      if (db.state == port)
+        debouncing = false;
+      else
+        next_sample += sample_us;
+      continue;
+    }
+    if (edges[e].closed)
+      port |= edges[e].bit;
+    else
+      port &= ~edges[e].bit;
+    if (!debouncing) {                          // ISR(PCINT2_vect)
+      debouncing  = true;
+      next_sample = edges[e].us + sample_us;
+    }
+    ++e;
+  }
+  return running_us;
+}
+
+int main(void) {
+  const uint64_t duration_us = 120000000;       // 2 minutes of the pulses
+  int failed = 0;
+
+  printf("The pulse counting of %u meters with the contact bounce, %u s per run, the timer period %u us\n",
+         meters, uint32_t(duration_us / 1000000), sample_us);
+  printf("  rate, Hz  bounce, ms      made   counted   lost  extra  timer running\n");
+  const uint32_t rates_mhz[] = { 100, 1000, 5000, 10000, 15000, 20000, 25000, 30000 };
+  const uint32_t bounces_us[] = { 0, 1000, 3000 };
+  for (uint32_t rate : rates_mhz) {
+    for (uint32_t bounce_us : bounces_us) {
+      std::vector<struct edge> edges;
+      uint32_t made[meters];
+      uint32_t counted[meters];
+      for (byte m = 0; m < meters; ++m)
+        made[m] = pulses(edges, meter_bit[m], rate, bounce_us, duration_us);
+      uint64_t running = run(edges, counted);
+      uint32_t total_made = 0, total_counted = 0, lost = 0, extra = 0;
+      for (byte m = 0; m < meters; ++m) {
+        total_made    += made[m];
+        total_counted += counted[m];
+        if (counted[m] < made[m]) lost  += made[m] - counted[m];
+        if (counted[m] > made[m]) extra += counted[m] - made[m];
+      }
+      bool over = (extra == 0) && lost && (rate > max_rate_mhz);  // The pulses are too short, the loss is expected
+      bool ok   = (extra == 0) && (lost == 0);
+      printf("  %8.1f  %9.1f  %8u  %8u  %5u  %5u  %12.1f%%  %s\n", rate / 1000.0, bounce_us / 1000.0,
+             total_made, total_counted, lost, extra, running * 100.0 / duration_us, (ok)?"OK":(over)?"over limit":"FAILED");
+      if (!ok && !over) ++failed;
+    }
+  }
+
+  printf("The spikes on the open contacts, every 50 ms\n");
+  printf("  spike, ms   counted  timer running\n");
+  const uint32_t spikes_us[] = { 500, 2000, 8000, 12000 };
+  for (uint32_t spike_us : spikes_us) {
+    std::vector<struct edge> edges;
+    uint32_t counted[meters];
+    for (byte m = 0; m < meters; ++m)
+      spikes(edges, meter_bit[m], spike_us, 50000, duration_us);
+    uint64_t running = run(edges, counted);
+    uint32_t total = 0;
+    for (byte m = 0; m < meters; ++m) total += counted[m];
+    bool ok = (total == 0);
+    printf("  %8.1f  %8u  %12.1f%%  %s\n", spike_us / 1000.0, total, running * 100.0 / duration_us, (ok)?"OK":"FAILED");
+    if (!ok) ++failed;
+  }
+  return failed;
+}
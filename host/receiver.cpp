@@ -0,0 +1,13 @@
+#include "host_hal.h"
+#include "config.h"
+#include "wm.h"
+#include "log.h"
+#include "link.h"
+
+// The global variables of the receiver modules, declared in wm_receiver_esp8266.ino on the esp8266
+hostHAL           host_hal;
+HAL&              hal = host_hal;
+WMconfig          cfg;
+WMpool            pool;
+wmlog             data_log;
+wmLink            wm_link;
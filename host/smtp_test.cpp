@@ -0,0 +1,159 @@
+/*
+ * The test of the e-mail client against the fake SMTP server. The server answers the SMTP commands and
+ * takes the message data through the window: the client write() accepts not more than window bytes of the message
+ * body per run() call, as the TCP client does when its buffer is full. The message received by the server should
+ * be the message sent whatever the window is. The server that takes nothing should fail the session by the timeout.
+ */
+
+#include "host_hal.h"
+#include "mail.h"
+
+extern hostHAL    host_hal;                     // Global variable, declared in receiver.cpp
+
+const uint32_t no_window = 0xFFFFFFFF;
+
+//------------------------------------------ fake SMTP server --------------------------------------------------
+class fakeSMTP : public Client {
+  public:
+    fakeSMTP()                                  { window = no_window; in_data = in_body = false; auth_step = 0; }
+    virtual   int connect(const char* host, uint16_t port) { answer("220 fake ESMTP"); return 1; }
+    virtual   size_t write(uint8_t c)           { return write(&c, 1); }
+    virtual   size_t write(const uint8_t* buff, size_t size);
+    virtual   int available(void)               { return out.length(); }
+    virtual   int read(void)                    { if (out.empty()) return -1; char c = out[0]; out.erase(0, 1); return c; }
+    virtual   int peek(void)                    { return (out.empty())?-1:out[0]; }
+    virtual   void flush(void)                  { }
+    virtual   void stop(void)                   { }
+    virtual   uint8_t connected(void)           { return 1; }
+    uint32_t  window;                           // The message body bytes to be taken till the next run()
+    std::string body;                           // The message body received
+  private:
+    void      answer(const char* s)             { out += s; out += "\r\n"; }
+    void      command(const std::string& cmd);
+    std::string line;                           // The command line being received
+    std::string data;                           // The message data being received
+    std::string out;                            // The server replies not read yet
+    bool      in_data;                          // The message data is being received
+    bool      in_body;                          // The message headers have been received
+    byte      auth_step;
+};
+
+size_t fakeSMTP::write(const uint8_t* buff, size_t size) {
+  size_t taken = 0;
+  for (; taken < size; ++taken) {
+    char c = buff[taken];
+    if (!in_data) {
+      line += c;
+      if (c == '\n') {
+        command(line.substr(0, line.length() - 2));
+        line.clear();
+      }
+      continue;
+    }
+    if (in_body) {
+      if (window == 0) break;
+      if (window != no_window) --window;
+    }
+    data += c;
+    if (!in_body && data.length() >= 4 && data.compare(data.length() - 4, 4, "\r\n\r\n") == 0) {
+      in_body = true;                           // The headers are over
+      data.clear();
+    }
+    if (in_body && data.length() >= 5 && data.compare(data.length() - 5, 5, "\r\n.\r\n") == 0) {
+      body = data.substr(0, data.length() - 5);
+      in_data = false;
+      answer("250 queued");
+    }
+  }
+  return taken;
+}
+
+void fakeSMTP::command(const std::string& cmd) {
+  if (auth_step == 1) {
+    auth_step = 2; answer("334 UGFzc3dvcmQ6");
+  } else
+  if (auth_step == 2) {
+    auth_step = 0; answer("235 authenticated");
+  } else
+  if (cmd.compare(0, 4, "HELO") == 0) {
+    answer("250-fake greets you");
+    answer("250 ok");
+  } else
+  if (cmd == "AUTH LOGIN") {
+    auth_step = 1; answer("334 VXNlcm5hbWU6");
+  } else
+  if (cmd.compare(0, 9, "MAIL FROM") == 0 || cmd.compare(0, 7, "RCPT TO") == 0) {
+    answer("250 ok");
+  } else
+  if (cmd == "DATA") {
+    in_data = true; in_body = false; data.clear();
+    answer("354 end data with <CR><LF>.<CR><LF>");
+  } else
+  if (cmd == "QUIT") {
+    answer("221 bye");
+  } else {
+    answer("500 unknown command");
+  }
+}
+
+fakeSMTP          *smtp = 0;                    // The server of the current session
+uint32_t          smtp_window = no_window;      // The window of the current session
+
+/*
+ * Send the message through the server taking window bytes of the body per run() call, the time advances
+ * by 10 ms per call. Returns the answer of the client, the number of run() calls is in calls.
+ */
+mail::ANSWER session(mail& m, const String& message, uint32_t window, uint32_t& calls) {
+  m.send("owner@example.com", message, "Water meters", "wm@example.com");
+  smtp_window = window;
+  mail::ANSWER ans = mail::MAIL_BUSY;
+  for (calls = 0; ans == mail::MAIL_BUSY && calls < 100000; ++calls) {
+    if (smtp) smtp->window = window;
+    ans = m.run();
+    host_hal.advance(10);
+  }
+  return ans;
+}
+
+int main(void) {
+  host_hal.client_factory = [](bool ssl) -> Client* {
+    smtp = new fakeSMTP();
+    smtp->window = smtp_window;
+    return smtp;
+  };
+  String message = "<html><body>\n";
+  for (uint16_t i = 0; i < 120; ++i)
+    message += "<p>The water meter " + String(i) + ": " + String(100000UL + i * 7919UL) + " liters</p>\n";
+  message += "</body></html>";
+  printf("The e-mail client against the fake SMTP server, the message body of %u bytes\n", message.length());
+
+  int failed = 0;
+  const uint32_t windows[] = { no_window, 1460, 256, 100, 7, 1 };
+  for (uint32_t w : windows) {
+    mail m;
+    m.server("smtp.example.com", 25, false);
+    m.auth("user", "secret");
+    uint32_t calls;
+    mail::ANSWER ans = session(m, message, w, calls);
+    bool ok = (ans == mail::MAIL_OK && smtp->body == message.c_str());
+    if (w == no_window)
+      printf("  window unlimited: ");
+    else
+      printf("  window %5u bytes: ", w);
+    printf("answer %d, %6u run() calls, %5zu bytes received, %s\n", ans, calls, smtp->body.length(), (ok)?"OK":"FAILED");
+    if (!ok) ++failed;
+    m.end();
+    smtp = 0;
+  }
+
+  mail m;                                       // The server does not take the body at all
+  m.server("smtp.example.com", 25, false);
+  uint32_t calls;
+  mail::ANSWER ans = session(m, message, 0, calls);
+  bool ok = (ans == mail::MAIL_SEND_ERROR);
+  printf("  window     0 bytes: answer %d, %6u run() calls, the body phase %u ms, %s\n", ans, calls,
+         m.phaseTime(mail::PH_BODY), (ok)?"OK":"FAILED");
+  if (!ok) ++failed;
+  m.end();
+  return failed;
+}
@@ -0,0 +1,36 @@
+#ifndef WM_debounce_h
+#define WM_debounce_h
+
+/*
+ * The debounce of up to 8 switches on one port by the vertical counter: bit i of ct1:ct0 is the 2-bit counter
+ * of the input i, so the new level is accepted when it is stable for 4 samples in a row. All the inputs are debounced
+ * at once by a few logical operations, the counters of the inputs those did not change are reset.
+ * The same code is built by the host simulation, see host/pulse_sim.cpp
+ */
+
+#include <Arduino.h>
+
+struct debounce {
+  byte     state;                               // The stable status of the inputs, the bit is set if the switch is closed
+  byte     ct0;                                 // The vertical counter, low bits
+  byte     ct1;                                 // The vertical counter, high bits
+};
+
+// Start from the current status of the inputs
+inline void debounceInit(volatile struct debounce& d, byte closed) {
+  d.state = closed;
+  d.ct0   = 0xFF;
+  d.ct1   = 0xFF;
+}
+
+// Take the sample of the inputs, the bit is set if the switch is closed. Returns the inputs those switches have closed
+inline byte debounceSample(volatile struct debounce& d, byte closed) {
+  byte changed = d.state ^ closed;
+  d.ct0    = ~(d.ct0 & changed);                // Count down the changed inputs, reset the others
+  d.ct1    = d.ct0 ^ (d.ct1 & changed);
+  changed &= d.ct0 & d.ct1;                     // The counter rolled over: the input is stable for 4 samples
+  d.state ^= changed;
+  return changed & d.state;
+}
+
+#endif
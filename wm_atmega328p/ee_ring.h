@@ -0,0 +1,290 @@
+#ifndef WM_ee_ring_h
+#define WM_ee_ring_h
+
+/*
+ * The ring of the counter records in the EEPROM of the transmitter. The sketch defines WM_CHANNELS, the number
+ * of the meters, before including this file. The same code is built by the host simulation, see host/ee_sim.cpp
+ */
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#ifndef WM_CHANNELS
+#error "WM_CHANNELS should be defined before ee_ring.h"
+#endif
+
+const uint32_t ee_endurance = 100000;                 // The number of the write cycles of the EEPROM cell
+
+//------------------------------------------ water meter data in EEPROM ----------------------------------------
+/* The counters are saved in the EEPROM as the log of records. The EEPROM is divided into the blocks of block_size bytes,
+  written round the ring. Each block starts with the checkpoint record, the full copy of the counters:
+  byte     tag                          cp_tag, the empty EEPROM (0x00 or 0xFF) is not a checkpoint
+  uint32_t ID                           the checkpoint number, each time increment by 1
+  struct cfg                            config data
+  byte     CRC                          the checksum of the previous fields
+  followed by the delta records, the increments of the counters since the previous record:
+  byte     gen                          the low byte of the checkpoint ID
+  byte     delta[n]                     the counter increments, one byte per counter
+  byte     CRC                          the checksum of the checkpoint ID, the record index and the previous fields
+  The old delta records remaining in the block from the previous pass do not match gen and CRC of the new checkpoint,
+  so the log of the block ends at the first record that does not match. The new checkpoint is written into the next block
+  when the block is full, or the increment does not fit the delta record. The block is rewritten once per checkpoint
+  written into it, so the checkpoint ID is the write counter of the most worn cells.
+  With 1 KB EEPROM and 128 bytes blocks, there are 8 checkpoints and 224 delta records in the ring instead of 64 full records.
+*/
+struct __attribute__((packed)) cfg {
+  uint32_t wm_data[WM_CHANNELS];                      // Meter data count for cold(0), hot(1) water, ...
+};
+
+const byte     cp_tag      = 0xA5;                    // The checkpoint record tag
+const uint16_t block_size  = 128;                     // The size of the EEPROM block: the checkpoint and the delta records
+
+class CONFIG {
+  public:
+    CONFIG() {
+      can_write     = false;
+      have_cp       = false;
+      cpAddr        = 0;
+      cpID          = 0;
+      deltas        = 0;
+      blocks        = 0;
+      // Select appropriate record size; The record size should be power of 2, i.e. 4, 8, 16, 32, 64, ... bytes
+      for (cp_size = 4; cp_size < sizeof(struct cfg) + 6; cp_size <<= 1);
+      for (delta_size = 4; delta_size < WM_CHANNELS + 2; delta_size <<= 1);
+      block_deltas = (block_size - cp_size) / delta_size;
+    }
+    void init();
+    bool load(void);
+    bool loadLegacy(void);                            // Load the last record of the old format, see below
+    bool save(void);                                  // Save current config copy to the EEPROM
+    void erase();
+    uint32_t checkpoints(void)                        { return (have_cp)?cpID:0; }  // Number of the checkpoints written
+    uint32_t wear(void);                              // The wear of the most used cell, ppm of the endurance
+
+  protected:
+    struct   cfg Config;
+
+  private:
+    bool     readCheckpoint(uint16_t addr);           // Read the checkpoint into Config
+    int16_t  findCheckpoint(int16_t from, int16_t to);
+    bool     readDelta(byte index);                   // Read the delta record of the current block, add it to Config
+    void     writeCheckpoint(uint16_t addr);
+    bool     writeDelta(void);                        // Write the difference between Config and Saved, false if does not fit
+    byte     deltaCRC(const byte* rec, byte index);
+    static   byte crc8(byte crc, byte data);
+    bool     can_write;                               // The flag indicates that data can be saved
+    bool     have_cp;                                 // The checkpoint has been found or written
+    uint16_t cpAddr;                                  // Address of the current block in the EEPROM
+    uint32_t cpID;                                    // ID of the current checkpoint
+    byte     deltas;                                  // Number of the delta records in the current block
+    byte     blocks;                                  // Number of the blocks in the EEPROM
+    byte     block_deltas;                            // The maximum number of the delta records in the block
+    byte     cp_size;                                 // The size of the checkpoint record in bytes
+    byte     delta_size;                              // The size of the delta record in bytes
+    struct   cfg Saved;                               // The config data saved in the EEPROM
+};
+
+/*
+ * Find the current block, the one with the newest checkpoint. The checkpoints are written into the consecutive blocks,
+ * so the checkpoint ID grows by 1 from block to block up to the newest one and drops (or the block is empty) after it.
+ * The drop is found by the binary search, the block with damaged checkpoint is replaced by the next valid one,
+ * so only a few checkpoints are read instead of the whole EEPROM.
+ */
+inline void CONFIG::init(void) {
+  blocks    = EEPROM.length() / block_size;
+  have_cp   = false;
+  deltas    = 0;
+  can_write = (blocks > 0);
+
+  int16_t anchor = findCheckpoint(0, blocks - 1);     // The first valid checkpoint
+  if (anchor < 0) return;
+  uint32_t anchorID = cpID;
+  int16_t lo = anchor;
+  int16_t hi = blocks - 1;
+  while (lo < hi) {                                   // The block lo belongs to the run of the consecutive IDs
+    int16_t mid = (lo + hi + 1) / 2;
+    int16_t b = findCheckpoint(mid, hi);
+    if (b >= 0 && cpID == anchorID + uint32_t(b - anchor))
+      lo = b;
+    else
+      hi = mid - 1;
+  }
+  cpAddr  = uint16_t(lo) * block_size;
+  have_cp = true;
+}
+
+// The first block in [from; to] with valid checkpoint, -1 if not found
+inline int16_t CONFIG::findCheckpoint(int16_t from, int16_t to) {
+  for (int16_t b = from; b <= to; ++b) {
+    if (readCheckpoint(uint16_t(b) * block_size)) return b;
+  }
+  return -1;
+}
+
+// Read the current checkpoint and apply the delta records of its block
+inline bool CONFIG::load(void) {
+  if (!have_cp || !readCheckpoint(cpAddr)) {
+    have_cp = false;
+    return false;
+  }
+  for (deltas = 0; deltas < block_deltas; ++deltas) {
+    if (!readDelta(deltas + 1)) break;
+  }
+  Saved = Config;
+  return true;
+}
+
+inline bool CONFIG::save(void) {
+  if (!can_write) return can_write;
+  if (have_cp && memcmp(&Config, &Saved, sizeof(struct cfg)) == 0) return true;
+  if (!have_cp || deltas >= block_deltas || !writeDelta()) {
+    uint16_t addr = 0;
+    if (have_cp) {
+      addr = cpAddr + block_size;
+      if (addr >= uint16_t(blocks) * block_size) addr = 0;
+    }
+    writeCheckpoint(addr);
+  }
+  Saved = Config;
+  return true;
+}
+
+/* The old format: the ring of the records of 16 bytes
+  uint32_t ID                           each time increment by 1
+  uint32_t wm_data[2]                   cold and hot water data
+  byte CRC                              the checksum in the last byte of the record
+*/
+inline bool CONFIG::loadLegacy(void) {
+  const byte record_size = 16;
+  const byte data_size   = 2 * sizeof(uint32_t);
+  byte Buff[record_size];
+  uint32_t maxRecID = 0;
+  bool found = false;
+
+  for (uint16_t addr = 0; addr + record_size <= EEPROM.length(); addr += record_size) {
+    for (byte i = 0; i < record_size; ++i)
+      Buff[i] = EEPROM.read(addr+i);
+    byte summ = 0;
+    for (byte i = 0; i < data_size + 4; ++i) {
+      summ <<= 2; summ += Buff[i];
+    }
+    summ ++;
+    if (summ != Buff[record_size-1]) continue;
+    uint32_t recID;
+    memcpy(&recID, Buff, sizeof(uint32_t));
+    if (!found || recID > maxRecID) {
+      maxRecID = recID;
+      memset(&Config, 0, sizeof(struct cfg));
+      memcpy(&Config, &Buff[4], (data_size < sizeof(struct cfg))?data_size:sizeof(struct cfg));
+      found = true;
+    }
+  }
+  return found;
+}
+
+// The checkpoints are written round the ring, every cell of the block is written at most once per checkpoint in it
+inline uint32_t CONFIG::wear(void) {
+  if (blocks == 0) return 0;
+  uint32_t cell_writes = (checkpoints() + blocks - 1) / blocks;
+  return cell_writes * (1000000 / ee_endurance);
+}
+
+inline bool CONFIG::readCheckpoint(uint16_t addr) {
+  byte Buff[cp_size];
+
+  if (EEPROM.read(addr) != cp_tag) return false;      // Empty block
+  Buff[0] = cp_tag;
+  for (byte i = 1; i < cp_size; ++i)
+    Buff[i] = EEPROM.read(addr+i);
+
+  byte crc = 0;
+  byte len = sizeof(struct cfg) + 5;
+  for (byte i = 0; i < len; ++i)
+    crc = crc8(crc, Buff[i]);
+  if (crc != Buff[len]) return false;
+
+  memcpy(&cpID, &Buff[1], sizeof(uint32_t));
+  memcpy(&Config, &Buff[5], sizeof(struct cfg));
+  return true;
+}
+
+inline bool CONFIG::readDelta(byte index) {
+  uint16_t addr = cpAddr + cp_size + uint16_t(index - 1) * delta_size;
+  byte Buff[delta_size];
+
+  for (byte i = 0; i < delta_size; ++i)
+    Buff[i] = EEPROM.read(addr+i);
+  if (Buff[0] != byte(cpID) || Buff[WM_CHANNELS + 1] != deltaCRC(Buff, index)) return false;
+  for (byte i = 0; i < WM_CHANNELS; ++i)
+    Config.wm_data[i] += Buff[i+1];
+  return true;
+}
+
+inline void CONFIG::writeCheckpoint(uint16_t addr) {
+  byte Buff[cp_size];
+  memset(Buff, 0, cp_size);
+
+  cpID    = checkpoints() + 1;
+  Buff[0] = cp_tag;
+  memcpy(&Buff[1], &cpID, sizeof(uint32_t));
+  memcpy(&Buff[5], &Config, sizeof(struct cfg));
+  byte crc = 0;
+  byte len = sizeof(struct cfg) + 5;
+  for (byte i = 0; i < len; ++i)
+    crc = crc8(crc, Buff[i]);
+  Buff[len] = crc;
+
+  for (byte i = 0; i < cp_size; ++i)
+    EEPROM.update(addr+i, Buff[i]);
+  cpAddr  = addr;
+  deltas  = 0;
+  have_cp = true;
+}
+
+inline bool CONFIG::writeDelta(void) {
+  byte Buff[delta_size];
+  memset(Buff, 0, delta_size);
+
+  Buff[0] = byte(cpID);
+  for (byte i = 0; i < WM_CHANNELS; ++i) {
+    if (Config.wm_data[i] < Saved.wm_data[i]) return false;
+    uint32_t d = Config.wm_data[i] - Saved.wm_data[i];
+    if (d > 0xFF) return false;
+    Buff[i+1] = d;
+  }
+  ++deltas;
+  Buff[WM_CHANNELS + 1] = deltaCRC(Buff, deltas);
+
+  uint16_t addr = cpAddr + cp_size + uint16_t(deltas - 1) * delta_size;
+  for (byte i = 0; i < delta_size; ++i)
+    EEPROM.update(addr+i, Buff[i]);
+  return true;
+}
+
+inline byte CONFIG::deltaCRC(const byte* rec, byte index) {
+  byte crc = 0;
+  const byte *p = (const byte *)&cpID;
+  for (byte i = 0; i < sizeof(uint32_t); ++i)
+    crc = crc8(crc, p[i]);
+  crc = crc8(crc, index);
+  for (byte i = 0; i <= WM_CHANNELS; ++i)
+    crc = crc8(crc, rec[i]);
+  return crc ^ 0x55;                                  // The empty record has no valid CRC
+}
+
+// CRC-8, polynomial 0x07
+inline byte CONFIG::crc8(byte crc, byte data) {
+  crc ^= data;
+  for (byte i = 0; i < 8; ++i)
+    crc = (crc & 0x80)?(crc << 1) ^ 0x07:(crc << 1);
+  return crc;
+}
+
+inline void CONFIG::erase(void) {
+  for (uint16_t i = 0; i < EEPROM.length(); ++i)
+    EEPROM.update(i, 0);
+  have_cp = false;
+  deltas  = 0;
+}
+
+#endif
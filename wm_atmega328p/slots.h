@@ -0,0 +1,154 @@
+#ifndef WM_slots_h
+#define WM_slots_h
+
+/*
+ * The transmit schedule of the transmitter: the random period or the slot in the receiver frame, the beacons and
+ * the measurement of the WDT period, see wm_data.h of the receiver. The includer defines the packet structures,
+ * the packet constants, the slot and ACK timing and crc16() before including this file: the sketch defines them itself,
+ * the host simulation takes them from wm_data.h of the receiver. The same code is built by the host simulation,
+ * see host/fleet_sim.cpp
+ */
+
+#include <Arduino.h>
+
+const byte     listen_every     = 8;            // Listen for the beacon when 8 frames passed since the last one
+const byte     max_missed       = 4;            // Fall back to the random period after this number of beacons lost
+const byte     max_calib_listens = 4;           // Send every period for the beacons up to this number of listens after the last one
+const uint16_t min_calib_ticks  = 32;           // Measure the WDT period over this number of the interrupts at least
+const byte     period_spread    = 8;            // The random period is longer by 0 to 7 seconds
+const uint16_t prepare_ms       = 22;           // The led, Vcc reading and the delays before the data packet is sent
+const byte     rf_overhead      = 13;           // The preamble, the radio headers and CRC of the packet, bytes
+const byte     rf_byte_ms       = 4;            // The airtime of one byte at 2 kbps, ms
+const uint32_t frame_len        = uint32_t(frame_slots) * slot_ms;
+const uint16_t max_calib_ticks  = frame_len / 2 / 100;  // The WDT 10% off gives the frame number right over this interval
+
+// The data packet of len bytes at 2 kbps and the wait for the answer
+constexpr uint16_t retryMs(byte len)            { return (len + rf_overhead) * rf_byte_ms + ack_listen_ms; }
+// The retry of the data packet of len bytes and its answer end before the slot is over
+constexpr bool     slotRetry(byte len)          { return prepare_ms + 2 * retryMs(len) + ack_backoff_ms <= slot_ms - slot_guard; }
+
+struct tx_schedule {
+  bool     slotted;                             // The slot is assigned by the receiver and the WDT period is known
+  bool     synced;                              // A beacon has been received, sync_uptime and sync_frame are valid
+  bool     tick_known;                          // The WDT period has been measured
+  byte     tx_missed;                           // The beacons lost in a row
+  uint16_t tx_rem_ms;                           // The delay after the WDT interrupt before the transmission, ms
+  uint32_t tick_us;                             // The measured WDT period, us
+  uint32_t sync_uptime;                         // uptime at the last beacon
+  uint32_t sync_frame;                          // The position in the frame at the last beacon, ms
+  byte     calib_listens;                       // The listens since the last beacon, that one included, till the WDT period is known
+};
+
+inline void scheduleInit(struct tx_schedule& s) {
+  s.slotted     = s.synced = s.tick_known = false;
+  s.tx_missed   = 0;
+  s.tx_rem_ms   = 0;
+  s.tick_us     = 1000000;
+  s.sync_uptime = s.sync_frame = 0;
+  s.calib_listens = 0;
+}
+
+// Set the delay till the transmission in wait_ms from the last WDT interrupt, return the number of the interrupts
+inline int scheduleIn(struct tx_schedule& s, uint32_t wait_ms) {
+  uint32_t ticks = wait_ms * 1000 / s.tick_us;
+  s.tx_rem_ms = wait_ms - ticks * s.tick_us / 1000;
+  return ticks;
+}
+
+/*
+ * The WDT period is measured between two beacons, so every period is sent with the listen till it is known.
+ * If the receiver does not answer (it has no slot for this transmitter or does not send the beacons), only
+ * max_calib_listens periods are forced, then the data is sent when it changes or by the heartbeat as usual
+ * and the calibration goes on by the beacons those packets get
+ */
+inline bool calibrating(const struct tx_schedule& s) {
+  return !s.tick_known && s.calib_listens < max_calib_listens;
+}
+
+// The beacon is due: the slot is not assigned yet or listen_every frames passed since the last beacon
+inline bool listenDue(const struct tx_schedule& s, uint32_t uptime) {
+  return !s.slotted || uptime - s.sync_uptime >= uint32_t(listen_every) * frame_len / 1000;
+}
+
+/*
+ * Synchronize with the receiver frame by the beacon, return the number of the WDT interrupts till the slot, 0 if
+ * the WDT period is not known yet. The WDT period is measured by the time between the beacons: the receiver gives
+ * the time modulo the frame, the number of the whole frames is resolved by the WDT estimation, that is good enough
+ * as the beacons of the random period are less than max_calib_ticks apart till the period is measured.
+ * since is the time from the last WDT interrupt handled to the beacon, ms. The caller restarts the WDT, so the next
+ * interrupt comes a full period after the beacon, pending is the number of the interrupts not handled before the restart
+ */
+inline int syncFrame(struct tx_schedule& s, byte slot, uint32_t frame_ms, uint32_t uptime, uint32_t since, byte pending) {
+  uint32_t ticks = uptime - s.sync_uptime;
+  if (s.synced && ticks >= min_calib_ticks && (s.tick_known || ticks <= max_calib_ticks)) {
+    int32_t est_ms = ticks * (s.tick_us / 1000) + since;
+    int32_t frac   = (uint32_t(frame_ms) + frame_len - s.sync_frame) % frame_len;
+    int32_t frames = (est_ms - frac + int32_t(frame_len / 2)) / int32_t(frame_len);
+    if (frames >= 0) {
+      uint32_t period = ((frames * frame_len + frac - since) * 1000) / ticks;
+      if (period > 800000 && period < 1250000) {
+        s.tick_us    = period;
+        s.tick_known = true;
+      }
+    }
+  }
+  s.sync_uptime = uptime + pending;
+  s.sync_frame  = frame_ms;
+  s.synced      = true;
+  s.calib_listens = 0;
+  if (!s.tick_known) return 0;                  // Keep the random period till the next beacon
+  s.slotted     = true;
+  uint32_t wait = (uint32_t(slot) * slot_ms + slot_guard + frame_len - frame_ms) % frame_len;
+  if (wait < 2 * slot_ms) wait += frame_len;    // The slot is too close, use it in the next frame
+  return scheduleIn(s, wait) + pending;         // loop() counts the pending interrupts down as well
+}
+
+/*
+ * The packet has been sent, return the number of the WDT interrupts till the next one. ticks is the result of syncFrame()
+ * if the beacon has been received, period is the random period of the transmitter without the spread, seconds
+ */
+inline int nextTransmit(struct tx_schedule& s, int ticks, bool listen, uint16_t period) {
+  if (listen) {
+    if (ticks > 0) {
+      s.tx_missed = 0;
+      return ticks;
+    }
+    if (!s.tick_known && s.calib_listens < max_calib_listens)
+      ++s.calib_listens;
+    if (s.slotted && ++s.tx_missed >= max_missed) {  // The receiver is gone or has been restarted
+      s.slotted   = false;
+      s.tx_missed = 0;
+    }
+  }
+  if (s.slotted) return scheduleIn(s, s.tx_rem_ms + frame_len);
+  s.tx_rem_ms = 0;
+  return period + random(0, period_spread);
+}
+
+// Check the beacon and find the slot of the transmitter ID in it, -1 if the packet is not the valid beacon
+inline int beaconSlot(const byte* buff, byte len, byte ID) {
+  const struct pkt_beacon_hdr *bh = (const struct pkt_beacon_hdr *)buff;
+  if (len < sizeof(struct pkt_beacon_hdr) + sizeof(uint16_t)) return -1;
+  if (bh->hdr.magic != pkt_magic || bh->hdr.version < pkt_version || bh->hdr.type != PKT_BEACON) return -1;
+  uint16_t size = sizeof(struct pkt_beacon_hdr) + bh->records * sizeof(struct beacon_slot);
+  if (len != size + sizeof(uint16_t)) return -1;
+  uint16_t crc;
+  memcpy(&crc, &buff[size], sizeof(uint16_t));
+  if (crc != crc16(buff, size)) return -1;
+  const struct beacon_slot *bs = (const struct beacon_slot *)&buff[sizeof(struct pkt_beacon_hdr)];
+  for (byte i = 0; i < bh->records; ++i)
+    if (bs[i].ID == ID) return bs[i].slot;
+  return -1;                                    // No slot for this transmitter, keep the random period
+}
+
+// Check the packet is the acknowledgement of the packet seq sent by the transmitter ID
+inline bool isAck(const byte* buff, byte len, byte ID, uint16_t seq) {
+  struct pkt_ack pa;
+  if (len != sizeof(struct pkt_ack)) return false;
+  memcpy(&pa, buff, sizeof(struct pkt_ack));
+  if (pa.hdr.magic != pkt_magic || pa.hdr.version < pkt_version || pa.hdr.type != PKT_ACK) return false;
+  if (pa.crc != crc16(buff, sizeof(struct pkt_ack) - sizeof(uint16_t))) return false;
+  return pa.ID == ID && pa.seq == seq;
+}
+
+#endif
@@ -1,5 +1,5 @@
 /*
- * Water Meter local controller for two water meters: for cold and hot water.
+ * Water Meter local controller for up to 8 meters: cold and hot water, gas, heat...
  * Build on altmega328p-pu microcontroller running on the interhal 8MHz oscillator,
  * powered by two AAA batteries.
  * 
@@ -16,215 +16,270 @@
  
 #include <avr/sleep.h>
 #include <avr/power.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
 #include <SPI.h>
 #include <RH_RF22.h>
-#include <EEPROM.h>
+#include "debounce.h"
 
-const byte     wm_pin[2] = {3, 4};                    // Water meter PIN number for cold and hot water meters
+#define WM_CHANNELS 2                                   // The number of the meters, up to 8
+constexpr byte wm_pin[WM_CHANNELS] = {3, 4};          // Meter PIN numbers: cold water, hot water, ... All on the port D
 const byte     led_pin   = 6;                         // The check led lits with the transmition
 const byte     reset_pin = A1;                        // The reset EEPROM pin
-const int      transmit_period = 40;                  // The period in 1.0-sec. interval to transmit the data
+const int      transmit_period = 40;                  // The period in 1.0-sec. interval to check the data for transmission
+const byte     heartbeat_periods = 10;                // Send the data every 10-th period at least, even if not changed
 const byte     my_ID = 3;                             // ID of the WaterMeter checker
+const uint16_t commit_pulses  = 16;                   // Save the counters into the EEPROM after this number of pulses
+const uint16_t commit_period  = 900;                  // or when the oldest unsaved pulse is older than this, seconds
+const uint16_t low_vcc_mv     = 2200;                 // Below this battery voltage every pulse is saved immediately
+const uint16_t hist_period    = 600;                  // The minimal interval between the counter snapshots, seconds
+const byte     hist_every     = 4;                    // Send the history after every 4-th data packet
+#define HIST_SIZE 8                                   // The number of the counter snapshots kept in RAM
 
-//------------------------------------------ water meter data in EEPROM ----------------------------------------
-/* Config record in the EEPROM has the following format:
-  uint32_t ID                           each time increment by 1
-  struct cfg                            config data
-  byte CRC                              the checksum
-*/
-struct cfg {
-  uint32_t wm_data[2];                                // Water meter data count for cold(0) and hot(1) water
-};
-
-class CONFIG {
-  public:
-    CONFIG() {
-      can_write     = false;
-      buffRecords   = 0;
-      rAddr = wAddr = 0;
-      eLength       = 0;
-      nextRecID     = 0;
-      byte rs = sizeof(struct cfg) + 5;               // The total config record size
-      // Select appropriate record size; The record size should be power of 2, i.e. 8, 16, 32, 64, ... bytes
-      for (record_size = 8; record_size < rs; record_size <<= 1);
-    }
-    void init();
-    bool load(void);
-    bool save(void);                                  // Save current config copy to the EEPROM
-    void erase();
-
-  protected:
-    struct   cfg Config;
-
-  private:
-    bool     readRecord(uint16_t addr, uint32_t &recID);
-    bool     can_write;                               // The flag indicates that data can be saved
-    byte     buffRecords;                             // Number of the records in the outpt buffer
-    uint16_t rAddr;                                   // Address of thecorrect record in EEPROM to be read
-    uint16_t wAddr;                                   // Address in the EEPROM to start write new record
-    uint16_t eLength;                                 // Length of the EEPROM, depends on arduino model
-    uint32_t nextRecID;                               // next record ID
-    byte     record_size;                             // The size of one record in bytes
-};
-
- // Read the records until the last one, point wAddr (write address) after the last record
-void CONFIG::init(void) {
-  eLength = EEPROM.length();
-  uint32_t recID;
-  uint32_t minRecID = 0xffffffff;
-  uint16_t minRecAddr = 0;
-  uint32_t maxRecID = 0;
-  uint16_t maxRecAddr = 0;
-  byte records = 0;
-
-  nextRecID = 0;
-
-  // read all the records in the EEPROM find min and max record ID
-  for (uint16_t addr = 0; addr < eLength; addr += record_size) {
-    if (readRecord(addr, recID)) {
-      ++records;
-      if (minRecID > recID) {
-        minRecID = recID;
-        minRecAddr = addr;
-      }
-      if (maxRecID < recID) {
-        maxRecID = recID;
-        maxRecAddr = addr;
-      }
-    } else {
-      break;
-    }
-  }
-
-  if (records == 0) {
-    wAddr = rAddr = 0;
-    can_write = true;
-    return;
-  }
-
-  rAddr = maxRecAddr;
-  if (records < (eLength / record_size)) {            // The EEPROM is not full
-    wAddr = rAddr + record_size;
-    if (wAddr > eLength) wAddr = 0;
-  } else {
-    wAddr = minRecAddr;
-  }
-  can_write = true;
-}
-
-bool CONFIG::save(void) {
-  if (!can_write) return can_write;
-  if (nextRecID == 0) nextRecID = 1;
-
-  uint16_t startWrite = wAddr;
-  uint32_t nxt = nextRecID;
-  byte summ = 0;
-  for (byte i = 0; i < 4; ++i) {
-    EEPROM.write(startWrite++, nxt & 0xff);
-    summ <<=2; summ += nxt;
-    nxt >>= 8;
-  }
-  byte* p = (byte *)&Config;
-  for (byte i = 0; i < sizeof(struct cfg); ++i) {
-    summ <<= 2; summ += p[i];
-    EEPROM.write(startWrite++, p[i]);
-  }
-  summ ++;                                            // To avoid empty records
-  EEPROM.write(wAddr+record_size-1, summ);
-
-  rAddr = wAddr;
-  wAddr += record_size;
-  if (wAddr > EEPROM.length()) wAddr = 0;
-  nextRecID ++;                                       // Get ready to write next record
-  return true;
-}
-
-bool CONFIG::load(void) {
-  bool is_valid = readRecord(rAddr, nextRecID);
-  nextRecID ++;
-  return is_valid;
-}
-
-bool CONFIG::readRecord(uint16_t addr, uint32_t &recID) {
-  byte Buff[record_size];
-
-  for (byte i = 0; i < record_size; ++i) 
-    Buff[i] = EEPROM.read(addr+i);
-  
-  byte summ = 0;
-  for (byte i = 0; i < sizeof(struct cfg) + 4; ++i) {
-
-    summ <<= 2; summ += Buff[i];
-  }
-  summ ++;                                            // To avoid empty fields
-  if (summ == Buff[record_size-1]) {                  // Checksumm is correct
-    uint32_t ts = 0;
-    for (char i = 3; i >= 0; --i) {
-      ts <<= 8;
-      ts |= Buff[byte(i)];
-    }
-    recID = ts;
-    memcpy(&Config, &Buff[4], sizeof(struct cfg));
-    return true;
-  }
-  return false;
-}
+// The debounce timer samples one port and only ISR(PCINT2_vect) is set: the pins 0 to 7 are the port D, PCINT16 to PCINT23
+constexpr bool onPortD(byte i = 0) { return i >= WM_CHANNELS || (wm_pin[i] <= 7 && onPortD(i + 1)); }
+static_assert(WM_CHANNELS >= 1 && WM_CHANNELS <= 8, "WM_CHANNELS should be 1 to 8");
+static_assert(onPortD(), "All the meter pins should be on the port D, pins 0 to 7");
 
-void CONFIG::erase(void) {
-  for (int i = 0; i < eLength; ++i)
-    EEPROM.write(i, 0);
-}
+#include "ee_ring.h"                                  // The counters ring in the EEPROM
 
 //------------------------------------------ class water meter data --------------------------------------------
 class WM_DATA : public CONFIG {
   public:
-    WM_DATA()                                   { }
+    WM_DATA()                                   { unsaved = 0; unsaved_age = 0; }
     void     init(void);
-    uint32_t data(byte index);                  // Water meter data for cold (0) or hot (1) water
-    void     increment(byte index);             // Increment water meter data for cold (0) or hot (1) water by 1
+    uint32_t data(byte index);                  // Meter data for cold (0), hot (1) water, ...
+    void     increment(byte index);             // Increment meter data for cold (0), hot (1) water, ... by 1
+    void     tick(void)                         { if (unsaved) ++unsaved_age; }  // Called every second
+    bool     needCommit(void)                   { return unsaved >= commit_pulses || (unsaved && unsaved_age >= commit_period); }
+    bool     commit(void);                      // Save the counters into the EEPROM if they have been changed
     void     reset(void);
   private:
     void     setDefaults(void);                 // Set default parameter values if failed to load data from EEPROM
+    uint16_t unsaved;                           // Number of the pulses counted since the last save
+    uint16_t unsaved_age;                       // Seconds since the first unsaved pulse
 };
 
 void WM_DATA::init(void) {
   CONFIG::init();
-  if (!CONFIG::load()) setDefaults();           // If failed to load the data from EEPROM, initialize the config data with default values
+  if (CONFIG::load()) return;
+  if (CONFIG::loadLegacy()) {                   // Convert the data of the old format
+    CONFIG::erase();
+    CONFIG::save();
+    return;
+  }
+  setDefaults();                                // If failed to load the data from EEPROM, initialize the config data with default values
 }
 
 uint32_t WM_DATA::data(byte index) {
-  if (index <= 1) return Config.wm_data[index];
+  if (index < WM_CHANNELS) return Config.wm_data[index];
   return 0;
 }
 
 void WM_DATA::increment(byte index) {
-  if (index <= 1) {
+  if (index < WM_CHANNELS) {
     ++Config.wm_data[index];
+    if (unsaved < 0xFFFF) ++unsaved;
   }
 }
 
+bool WM_DATA::commit(void) {
+  if (unsaved == 0) return true;
+  if (!CONFIG::save()) return false;
+  unsaved = unsaved_age = 0;
+  return true;
+}
+
 void WM_DATA::setDefaults(void) {
-  Config.wm_data[0] = 0;
-  Config.wm_data[1] = 0;
+  memset(&Config, 0, sizeof(struct cfg));
 }
 
 void WM_DATA::reset(void) {
   CONFIG::erase();
+  unsaved = unsaved_age = 0;
   init();
 }
 //==============================================================================================================
 
 RH_RF22       radio;
 WM_DATA       wm_data;                          // The water meter counters are saved in the EEPROM
-volatile int  f_wdt = 1;                        // The flag of WDT interrupt
-bool          wm_status[2];                     // The water meter status (LOW, HIGH)
+volatile byte f_wdt = 1;                        // The number of WDT interrupts not handled yet
 
-struct data {                                   // The data to be transmitted to the WaterMeter Node
-  uint32_t wm_data[2]; 
+/*
+ * The meter pulses are counted by the pin change interrupt. The interrupt starts the Timer2 that samples
+ * the whole port every 4 ms. All the inputs are debounced at once by the vertical counter (see debounce.h),
+ * so the new level is accepted when it is stable for 4 samples (about 16 ms).
+ * So the minimum pulse width is about 2 x 4 samples x 4 ms = 32 ms: the switch should stay closed and then open
+ * for 4 samples each, longer by the contact bounce and the sample phase. The meters are counted without loss
+ * up to 20 Hz with the 3 ms bounce and the 10% period spread, the faster pulses are lost (see host/pulse_sim.cpp).
+ * The counter is incremented when the reed switch closes (the pin goes LOW). When all the pins are stable,
+ * the timer is stopped and the MCU sleeps in power down mode till the next edge or the WDT interrupt.
+ * While the timer is running the MCU sleeps in idle mode, because the timer is stopped in power down mode.
+ */
+volatile byte *wm_port;                         // The input register of the meter pins port
+byte          wm_mask[WM_CHANNELS];             // The port bit of each meter
+byte          wm_port_mask = 0;                 // The port bits of all the meters
+volatile struct debounce wm_db;                 // The stable status of the inputs and their debounce counters
+volatile byte wm_pulses[WM_CHANNELS];           // The pulses counted but not saved into the EEPROM yet
+volatile bool debouncing = false;               // The Timer2 is running
+
+/*
+ * The counters are kept in RAM and saved into the EEPROM by batches: after commit_pulses pulses, when the oldest
+ * unsaved pulse is commit_period seconds old and right before the transmission, so the receiver never gets the value
+ * that can be lost by reset. When the battery is low, every pulse is saved at once, as the brown-out can come any time.
+ */
+bool          low_battery = false;              // The battery voltage is below low_vcc_mv
+
+/*
+ * The versioned packet, see wm_data.h of the receiver: the header, the payload and CRC16 of the header and the payload
+ */
+const byte pkt_magic   = 0x57;                  // 'W'
+const byte pkt_version = 4;
+
+#define PKT_DATA    1                           // The packet types: the water meter counters
+#define PKT_HISTORY 2                           //                   the old counter snapshots
+#define PKT_BEACON  3                           //                   the receiver time and the transmit slots
+#define PKT_ACK     4                           //                   the acknowledgement of the data packet
+#define PKT_F_BOOT  0x01                        // The packet flags: the first packet after the transmitter reset
+#define PKT_F_LISTEN 0x02                       //                   the transmitter waits for the beacon after the packet
+#define PKT_F_SLOT  0x04                        //                   the packet is sent in the assigned slot
+#define PKT_F_ADAPTIVE 0x08                     //                   the periods without changes are skipped, see heartbeat_periods
+#define PKT_F_ACK   0x10                        //                   the packet is retried till it is acknowledged
+
+struct __attribute__((packed)) pkt_header {
+  byte     magic;
+  byte     version;
+  byte     type;
+  byte     flags;
+  byte     ID;                                  // The transmitter ID
+  uint16_t seq;                                 // The packet sequence number
+};
+
+struct __attribute__((packed)) pkt_data {       // PKT_DATA packet
+  struct   pkt_header hdr;
   uint16_t batt_mv;
-  byte     ID;
+  uint32_t ee_wear;                             // The EEPROM wear, ppm of the endurance of the most worn cell
+  byte     channels;                            // The number of the meters
+  uint32_t wm_data[WM_CHANNELS];
+  uint16_t crc;
+};
+
+struct __attribute__((packed)) hist_record {    // The snapshot in PKT_HISTORY packet
+  uint16_t age;                                 // Minutes before the packet was sent
+  uint32_t wm_data[WM_CHANNELS];
+};
+
+const byte hist_per_packet = (RH_RF22_MAX_MESSAGE_LEN - sizeof(struct pkt_header) - 4) / sizeof(struct hist_record);
+
+struct __attribute__((packed)) pkt_history {    // PKT_HISTORY packet, CRC follows the last snapshot sent
+  struct   pkt_header hdr;
+  byte     channels;                            // The number of the meters
+  byte     records;                             // The number of the snapshots
+  struct   hist_record rec[hist_per_packet];
+  uint16_t crc;
+};
+
+struct __attribute__((packed)) pkt_beacon_hdr { // PKT_BEACON packet, the slot records and CRC follow the header
+  struct   pkt_header hdr;
+  uint32_t frame_ms;                            // The position in the receiver frame at the end of the beacon, ms
+  byte     records;                             // The number of the slot records
+};
+
+struct __attribute__((packed)) beacon_slot {
+  byte     ID;                                  // The transmitter ID
+  byte     slot;                                // The slot number in the frame
+};
+
+struct __attribute__((packed)) pkt_ack {        // PKT_ACK packet
+  struct   pkt_header hdr;
+  byte     ID;                                  // The transmitter ID
+  uint16_t seq;                                 // The sequence number of the packet acknowledged
+  uint16_t crc;
+};
+
+/*
+ * The acknowledged delivery, see wm_data.h of the receiver. The data packet is answered by ACK or by the beacon.
+ * If there is no answer in ack_listen_ms, the packet is sent again with the same sequence number after the random
+ * backoff, that is doubled with every retry, so the transmitters collided do not collide again.
+ * In the slot the retry is sent only if it and the answer end before the slot is over, so it does not hit
+ * the next slot. The lost counters are sent in the next frame then. If even the first retry cannot fit,
+ * the packet in the slot is not acknowledged at all, so the transmitter does not wait for the answer in vain.
+ * The retry does not fit the slot of 750 ms, so only the packets of the random period would be acknowledged.
+ * There the retries add to the collisions: the fleet simulation of 200 transmitters delivers 79.9% of the packets
+ * with ACK against 82.3% without it and the transmitter is awake 4 times longer. So ACK is off, the lost counters
+ * are sent by the next packet anyway.
+ */
+const bool     ack_mode       = false;          // Retry the data packets till they are acknowledged
+const byte     ack_retries    = 3;              // The maximum number of the retries
+const uint16_t ack_listen_ms  = 250;            // The time to wait for the answer
+const uint16_t ack_backoff_ms = 50;             // The backoff before the first retry
+
+uint16_t      tx_seq = 0;                       // The packet sequence number
+byte          tx_flags = PKT_F_BOOT;            // The first packet after reset has boot flag set
+
+/*
+ * The data is sent in the first transmit period after the counters changed, so the rate is limited
+ * by the period. When nothing changes, the period is skipped without waking up the radio and reading Vcc,
+ * the heartbeat packet with the battery voltage is sent every heartbeat_periods periods.
+ */
+uint32_t      sent_data[WM_CHANNELS];           // The counters sent in the last packet
+byte          tx_skipped = 0;                   // The number of the transmit periods skipped in a row
+
+/*
+ * The transmit slots, see wm_data.h of the receiver. The receiver answers the packet with PKT_F_LISTEN flag
+ * by the beacon with the position in its frame and the slot of this transmitter, so the next packet is sent
+ * at the beginning of the slot. The time between the packets is counted by the WDT interrupts, the WDT period
+ * drifts with the temperature and the voltage and can be 10% off, so it is measured between the beacons.
+ * Until the slot is assigned and the WDT period is measured between two beacons, or when the beacons are lost,
+ * the transmit period is randomized to get out of the collision with the transmitter that has the same period.
+ * So the first packet in the slot is sent on time and does not hit the slots of the others.
+ * The schedule is in slots.h, the same code is built by the host simulation.
+ */
+const uint16_t frame_slots      = 256;          // The number of the slots in the frame
+const uint16_t slot_ms          = 750;          // The slot length, ms
+const uint16_t slot_guard       = 200;          // Start sending this time after the slot begins, ms
+const uint16_t beacon_listen_ms = 300;          // The time to wait for the beacon
+
+unsigned long tick_start  = 0;                  // millis() at the last WDT interrupt handled
+
+/*
+ * The history of the counters: the ring of the snapshots taken before the data transmission, when the counters
+ * have been changed, but not often than every hist_period seconds. The history is sent round the ring
+ * by hist_per_packet snapshots, so the receiver can fill the gaps in its log after it was down.
+ * There is no clock, the snapshot time is the number of the WDT interrupts since power on.
+ */
+struct snapshot {
+  uint32_t ts;                                  // uptime the snapshot was taken
+  uint32_t wm_data[WM_CHANNELS];
 };
-const byte pl_size = sizeof(struct data);       // The packet size
+
+uint32_t        uptime = 0;                     // Seconds since power on
+struct snapshot hist[HIST_SIZE];
+byte            hist_num  = 0;                  // The number of the snapshots in the ring
+byte            hist_head = 0;                  // The next snapshot to be written
+byte            hist_sent = 0;                  // The next snapshot to be sent, counted from the oldest one
+
+// CRC-16/CCITT-FALSE checksum, the same as the receiver uses
+uint16_t crc16(const void* data, uint16_t len) {
+  const byte *p = (const byte *)data;
+  uint16_t crc = 0xFFFF;
+  while (len--) {
+    crc ^= uint16_t(*p++) << 8;
+    for (byte i = 0; i < 8; ++i) {
+      if (crc & 0x8000)
+        crc = (crc << 1) ^ 0x1021;
+      else
+        crc <<= 1;
+    }
+  }
+  return crc;
+}
+
+#include "slots.h"                                    // The transmit schedule
+
+const uint16_t retry_ms   = retryMs(sizeof(struct pkt_data));    // The data packet and the wait for the answer
+const bool     slot_retry = slotRetry(sizeof(struct pkt_data));  // The retry fits in the slot
+struct tx_schedule tx;                                // The slot, the beacons and the WDT period
 
 // Read the Vcc in millivolts by using internal voltage regulator of 1.1 volts
 uint32_t readVcc() {
@@ -249,10 +304,19 @@ uint32_t readVcc() {
   return result;
 }
 
-// Enter into the power sleep mode. Wakes UP by WDT
+// Enter into the power sleep mode. Wakes UP by WDT, the pin change or the debounce timer
 void enterSleep(void) { 
-  set_sleep_mode(SLEEP_MODE_PWR_DOWN);                // the lowest power consumption
+  cli();
+  if (f_wdt > 0) {                                    // The WDT interrupt came while the MCU was awake
+    sei();
+    return;
+  }
+  if (debouncing)
+    set_sleep_mode(SLEEP_MODE_IDLE);                  // Keep the Timer2 running
+  else
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);              // the lowest power consumption
   sleep_enable();
+  sei();                                              // The instruction after sei() is executed before any interrupt
   sleep_cpu();                                       // Now enter sleep mode.
   
   // The program will continue from here after the key pressed or WDT interrupt
@@ -262,11 +326,18 @@ void enterSleep(void) {
 
 void setup() {
   pinMode(reset_pin, INPUT_PULLUP);
-  for (byte i = 0; i < 2; ++i) {
+  wm_port = portInputRegister(digitalPinToPort(wm_pin[0]));
+  for (byte i = 0; i < WM_CHANNELS; ++i) {
     pinMode(wm_pin[i], INPUT);                        // Use external resister to pull-up the pin 
-    delay(100);
-    wm_status[i] = (digitalRead(wm_pin[i]) == LOW);
+    wm_mask[i]    = digitalPinToBitMask(wm_pin[i]);
+    wm_port_mask |= wm_mask[i];
+    wm_pulses[i]  = 0;
+    *digitalPinToPCMSK(wm_pin[i]) |= bit(digitalPinToPCMSKbit(wm_pin[i]));  // Enable the pin change interrupt
+    PCIFR |= bit(digitalPinToPCICRbit(wm_pin[i]));
+    *digitalPinToPCICR(wm_pin[i]) |= bit(digitalPinToPCICRbit(wm_pin[i]));
   }
+  delay(100);
+  debounceInit(wm_db, ~*wm_port & wm_port_mask);
   pinMode(led_pin, OUTPUT);
   digitalWrite(led_pin, LOW);
   wm_data.init();                                     // Load the water meter data from the EEPROM
@@ -276,6 +347,8 @@ void setup() {
     radio.setModemConfig(RH_RF22::GFSK_Rb2Fd5);       ///< GFSK, No Manchester, Rb = 2kbs,    Fd = 5kHz
     radio.setTxPower(RH_RF22_TXPOW_5DBM);
   }
+  randomSeed(readVcc() + (uint16_t(my_ID) << 8));    // The transmitters get out of step with the random period
+  scheduleInit(tx);                                   // The random period till the slot is assigned
 
   for (byte i = 0; i < 10; ++i) {                     // % times blink
     digitalWrite(led_pin, i & 1);
@@ -288,44 +361,191 @@ void setup() {
   WDTCSR |= (1<<WDIE);                                // Enable the WD interrupt (note no reset).
 }
 
+// Start the Timer2 in CTC mode: 8 MHz / 1024 / 32 = 244 Hz, about 4 ms period
+void startDebounce(void) {
+  if (debouncing) return;
+  debouncing = true;
+  TCNT2  = 0;
+  OCR2A  = 31;
+  TCCR2A = (1<<WGM21);
+  TCCR2B = (1<<CS22) | (1<<CS21) | (1<<CS20);
+  TIMSK2 = (1<<OCIE2A);
+}
+
+void stopDebounce(void) {
+  TCCR2B = 0;
+  TIMSK2 = 0;
+  debouncing = false;
+}
+
+// Move the pulses counted by the interrupt handlers to the water meter data
 void checkWaterMeters(void) {
-  bool modified = false;
-  for (byte i = 0; i < 2; ++i) {
-    bool s = (digitalRead(wm_pin[i]) == LOW);         // Read status of the water meter
-    if (s && (s != wm_status[i])) {                   // The water meter have been just activated (0 in the last digit)
-      delay(50);                                      // The timeout to debounce
-      s = (digitalRead(wm_pin[i]) == LOW);
-      if (s) {
-        wm_data.increment(i);                         // Increment the count data on the water meter
-        modified = true;
-      }
+  for (byte i = 0; i < WM_CHANNELS; ++i) {
+    byte pulses;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      pulses = wm_pulses[i];
+      wm_pulses[i] = 0;
+    }
+    for ( ; pulses > 0; --pulses)
+      wm_data.increment(i);                           // Increment the count data on the water meter
+  }
+  if (low_battery || wm_data.needCommit())
+    wm_data.commit();                                 // Save the updated data to the EEPROM
+}
+
+void fillHeader(struct pkt_header& hdr, byte type, byte flags) {
+  hdr.magic   = pkt_magic;
+  hdr.version = pkt_version;
+  hdr.type    = type;
+  hdr.flags   = tx_flags | flags;
+  hdr.ID      = my_ID;
+  hdr.seq     = tx_seq++;
+  tx_flags    = 0;
+}
+
+// Send the packet, keep the receiver on if the beacon is expected right after the packet
+void transmit(const byte* buff, byte len, bool listen) {
+  radio.send(buff, len);
+  radio.waitPacketSent();
+  if (listen) {
+    radio.setModeRx();
+    return;
+  }
+  delay(10);
+  radio.sleep();
+}
+
+// Save the current counters into the history ring
+void takeSnapshot(void) {
+  if (hist_num > 0) {
+    struct snapshot &last = hist[(hist_head + HIST_SIZE - 1) % HIST_SIZE];
+    if (uptime - last.ts < hist_period) return;
+    bool changed = false;
+    for (byte i = 0; i < WM_CHANNELS; ++i)
+      if (last.wm_data[i] != wm_data.data(i)) changed = true;
+    if (!changed) return;
+  }
+  hist[hist_head].ts = uptime;
+  for (byte i = 0; i < WM_CHANNELS; ++i)
+    hist[hist_head].wm_data[i] = wm_data.data(i);
+  if (++hist_head >= HIST_SIZE) hist_head = 0;
+  if (hist_num < HIST_SIZE) ++hist_num;
+}
+
+// Send the next snapshots of the history ring
+void sendHistory(void) {
+  if (hist_num == 0) return;
+  struct pkt_history pkt;
+  fillHeader(pkt.hdr, PKT_HISTORY, 0);
+  pkt.channels = WM_CHANNELS;
+  byte n = 0;
+  for ( ; n < hist_per_packet && n < hist_num; ++n) {
+    if (hist_sent >= hist_num) hist_sent = 0;
+    struct snapshot &snap = hist[(hist_head + HIST_SIZE - hist_num + hist_sent) % HIST_SIZE];
+    ++hist_sent;
+    uint32_t age = (uptime - snap.ts) / 60;
+    pkt.rec[n].age = (age < 0xFFFF)?age:0xFFFF;
+    for (byte i = 0; i < WM_CHANNELS; ++i)
+      pkt.rec[n].wm_data[i] = snap.wm_data[i];
+  }
+  pkt.records = n;
+  byte len = offsetof(struct pkt_history, rec) + n * sizeof(struct hist_record);
+  uint16_t crc = crc16(&pkt, len);
+  memcpy((byte *)&pkt + len, &crc, sizeof(uint16_t));
+  transmit((const byte*)&pkt, len + sizeof(uint16_t), false);
+}
+
+// Check the counters have been changed since the last packet
+bool dataChanged(void) {
+  for (byte i = 0; i < WM_CHANNELS; ++i)
+    if (wm_data.data(i) != sent_data[i]) return true;
+  return false;
+}
+
+// Synchronize with the receiver frame by the beacon, return the number of the WDT interrupts till the slot, see syncFrame()
+int syncSlot(byte slot, uint32_t frame_ms) {
+  uint32_t since = millis() - tick_start;             // The time since the last WDT interrupt handled, ms
+  byte pending;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    wdt_reset();                                      // The next interrupt comes a full period after the beacon
+    pending = f_wdt;                                  // The interrupts not handled yet came before the restart
+  }
+  tick_start = millis();
+  return syncFrame(tx, slot, frame_ms, uptime, since, pending);
+}
+
+/*
+ * Wait for the answer to the packet seq: the beacon or ACK. Returns true if the answer received.
+ * If it is the beacon, ticks is set to the number of the WDT interrupts till the slot
+ */
+bool waitReply(uint16_t seq, uint16_t timeout, int& ticks) {
+  byte buff[RH_RF22_MAX_MESSAGE_LEN];
+  unsigned long start = millis();
+  for (unsigned long elapsed = 0; elapsed < timeout; elapsed = millis() - start) {
+    if (!radio.waitAvailableTimeout(timeout - elapsed)) break;
+    byte len = sizeof(buff);
+    if (!radio.recv(buff, &len)) continue;
+    int slot = beaconSlot(buff, len, my_ID);
+    if (slot >= 0) {
+      ticks = syncSlot(slot, ((struct pkt_beacon_hdr *)buff)->frame_ms);
+      return true;
     }
-    wm_status[i] = s;                                 // Update the sensor status
+    if (isAck(buff, len, my_ID, seq)) return true;
   }
-  if (modified) wm_data.save();                       // Save the updated data to the EEPROM
+  return false;
 }
 
-void sendWaterMeterData(void) {                       // Check the battery till it is not depleted
+// Send the data and retry it till the answer received. Returns the number of the WDT interrupts till the slot
+// if the beacon received, 0 otherwise
+int sendWaterMeterData(byte flags) {                  // Check the battery till it is not depleted
+  unsigned long start = millis();                     // The slot start plus slot_guard if the packet is sent in the slot
   digitalWrite(led_pin, HIGH);
   delay(10);
   uint16_t v = readVcc();
-  struct data send_data;
-  for (byte i = 0; i < 2; ++i)
+  low_battery = (v < low_vcc_mv);
+  wm_data.commit();                                   // Send the data saved in the EEPROM only
+  takeSnapshot();
+  if (ack_mode && (slot_retry || !(flags & PKT_F_SLOT))) flags |= PKT_F_ACK;
+  struct pkt_data send_data;
+  fillHeader(send_data.hdr, PKT_DATA, flags);
+  send_data.batt_mv  = v;
+  send_data.ee_wear  = wm_data.wear();
+  send_data.channels = WM_CHANNELS;
+  for (byte i = 0; i < WM_CHANNELS; ++i) {
     send_data.wm_data[i] = wm_data.data(i);           // Read the current water meter counter from the EEPROM
-  send_data.batt_mv = v;
-  send_data.ID = my_ID;
+    sent_data[i] = send_data.wm_data[i];
+  }
+  send_data.crc = crc16(&send_data, sizeof(struct pkt_data) - sizeof(uint16_t));
   digitalWrite(led_pin, LOW);
   delay(10);
-  radio.send((const byte*)&send_data, pl_size);
-  radio.waitPacketSent();
-  delay(10);
-  radio.sleep();
+  bool     listen  = flags & (PKT_F_LISTEN | PKT_F_ACK);
+  uint16_t timeout = (flags & PKT_F_LISTEN)?beacon_listen_ms:ack_listen_ms;
+  int      ticks   = 0;
+  for (byte retry = 0; ; ++retry) {
+    transmit((const byte*)&send_data, sizeof(struct pkt_data), listen);
+    if (!listen) break;
+    bool done = waitReply(send_data.hdr.seq, timeout, ticks) || !(flags & PKT_F_ACK) || retry >= ack_retries;
+    radio.sleep();
+    if (done) break;
+    uint16_t backoff = ack_backoff_ms << retry;
+    uint16_t wait    = random(backoff, 2 * backoff);  // Exponential backoff
+    if ((flags & PKT_F_SLOT) && millis() - start + wait + retry_ms > slot_ms - slot_guard) break;  // Keep in the slot
+    delay(wait);
+  }
+  return ticks;
 }
 
 void loop() {
-  static int transmit_count = 0;
-  if (f_wdt == 1) {
-    f_wdt = 0;
+  static int  transmit_count = 0;
+  static byte history_count  = 0;
+  checkWaterMeters();
+  if (f_wdt > 0) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      --f_wdt;
+    }
+    tick_start = millis();
+    ++uptime;
+    wm_data.tick();
     if (digitalRead(reset_pin) == LOW) {              // Reset button pressed, erase the EEPROM
       for (byte i = 0; i < 5; ++i) {
         digitalWrite(led_pin, HIGH);
@@ -334,17 +554,51 @@ void loop() {
         delay(100);
       }
       wm_data.reset();
+      hist_num = hist_head = hist_sent = 0;
     }
-    checkWaterMeters();
     if (--transmit_count <= 0) {
-      transmit_count = transmit_period + my_ID;
-      sendWaterMeterData();
+      // The first packet after reset is sent at once, every period is sent to get the beacons till the WDT period is known,
+      // unless the receiver does not answer, see calibrating()
+      if (tx_flags || dataChanged() || ++tx_skipped >= heartbeat_periods || calibrating(tx)) {
+        tx_skipped = 0;
+        byte flags = PKT_F_ADAPTIVE;
+        if (tx.slotted) {
+          delay(tx.tx_rem_ms);                        // Wait for the slot start
+          flags |= PKT_F_SLOT;
+        }
+        if (listenDue(tx, uptime))
+          flags |= PKT_F_LISTEN;
+        int ticks = sendWaterMeterData(flags);
+        transmit_count = nextTransmit(tx, ticks, flags & PKT_F_LISTEN, transmit_period + my_ID);
+        if (++history_count >= hist_every) {
+          history_count = 0;
+          sendHistory();
+        }
+      } else {
+        transmit_count = nextTransmit(tx, 0, false, transmit_period + my_ID);  // Nothing to send in this period
+      }
     }
-    enterSleep();
   }
+  enterSleep();
 }
 
 ISR(WDT_vect) {
-  if (f_wdt == 0) f_wdt = 1;
+  if (f_wdt < 255) ++f_wdt;                           // Count the interrupts while the MCU is busy with the radio
+}
+
+// The water meter pin level changed, start the debounce timer
+ISR(PCINT2_vect) {
+  startDebounce();
 }
-
+
+// Sample all the meter pins at once, accept the new level when it is stable
+ISR(TIMER2_COMPA_vect) {
+  byte closed  = ~*wm_port & wm_port_mask;            // The closed switch pulls the pin LOW
+  byte pressed = debounceSample(wm_db, closed);       // The switches closed
+  if (pressed) {
+    for (byte i = 0; i < WM_CHANNELS; ++i)
+      if ((pressed & wm_mask[i]) && wm_pulses[i] < 255) ++wm_pulses[i];
+  }
+  if (wm_db.state == closed) stopDebounce();          // All the inputs are stable
+}
+
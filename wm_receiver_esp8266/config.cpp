@@ -1,28 +1,17 @@
 #define FS_NO_GLOBALS
 #include <FS.h>
+#include <new>
 #include <Time.h>
 #include <TimeLib.h>
 #include "config.h"
+#include "crc.h"
 
-#define BUFF_SIZE 128
-
-void WMconfig::resetWM(byte i) {
-  wm_data[i].ID                 = 0;
-  wm_data[i].wm_location        = "";
-  wm_data[i].wm_serial[0]       = "x";
-  wm_data[i].wm_serial[1]       = "x";
-  wm_data[i].wm_maintenance[0]  = 0;
-  wm_data[i].wm_maintenance[1]  = 0;
-  wm_data[i].wm_shift[0]        = 0;
-  wm_data[i].wm_shift[1]        = 0;
-  wm_set[i]                     = false;
-}
-
-bool WMconfig::init(void) {
-  for (byte i = 0; i < MAX_WM; ++i) {
-    resetWM(i);
-  }
+void WMconfig::setDefaults(void) {
+  wm_list.clear();
+  w_ssid = w_password = t_server = b_auth = "";
+  t_shift   = 0;
   frac_size = 2;
+  log_flush = 300;
   smtp_relay_host = smtp_relay_from = smtp_relay_user = smtp_relay_pass = smtp_email_to = "";
   smtp_relay_ssl  = false;
   smtp_relay_port = 25;
@@ -30,128 +19,262 @@ bool WMconfig::init(void) {
   maintenance_urgent    =  604800;              // one week
   smtp_period           = 0;                    // do not send e-mail
   smtp_send_at          = 0;
-  
-  for (byte i = 0; i < WM_max_layers; ++i)
-    p_key[i] = "";
-  currentParent = currentKey = "";
-  index    = 0;
-  curr_ID  = 0;
-  w_nodename = String("esp8266-wm");
-  
-  JsonStreamingParser parser;
-  parser.setListener(this);
-
-  byte buff[BUFF_SIZE];
-  fs::File cf = SPIFFS.open(cf_name, "r");
-  if (!cf) return false;
 
-  int last = cf.size();
-  bool isBody = false;
+  cur_wm   = 0;
+  w_nodename = String("esp8266-wm");
+}
 
-  while(last > 0) {
-    int rb = last;
-    if (rb > BUFF_SIZE) rb = BUFF_SIZE;
-    rb = cf.read(buff, rb);
-    if (!rb) {
-      cf.close();
-      return false;
-    }
-    last -= rb;
-    for (byte i = 0; i < rb; ++i) {
-      char c = buff[i];
-      if (c == '{' || c == '[') {
-        isBody = true;
-      }
-      if (isBody) {
-        parser.parse(c);
+/*
+ * Load the configuration from the binary snapshot, if it is not valid, from the json file.
+ * If the json file is missing or incomplete (the power was lost while saving), load the previous generation.
+ */
+bool WMconfig::init(void) {
+  uint32_t start_ms = hal.ms();
+  if (dirty) save();                            // Do not loose the committed changes
+  setDefaults();
+  snapshot_loaded = loadSnapshot();
+  if (!snapshot_loaded) {
+    setDefaults();
+    if (!loadJson(cf_name)) {
+      setDefaults();
+      if (!loadJson(backupName())) {
+        setDefaults();
+        return false;
       }
     }
   }
-  cf.close();
 
-  for (byte i = 0; i < MAX_WM; ++i) {
-    wm_set[i] = (wm_data[i].ID && wm_data[i].wm_shift[WM_COLD] && wm_data[i].wm_shift[WM_HOT]);
-    if (!wm_set[i]) resetWM(i);
+  for (byte i = wm_list.size(); i > 0; --i) {   // Backwards, because removing moves the last controller
+    WMuData &w = wm_list.at(i-1);
+    w.configured = (w.ID && w.wm_shift[WM_COLD] && w.wm_shift[WM_HOT]);
+    if (!w.configured) wm_list.remove(w.ID);
   }
+  load_ms = hal.ms() - start_ms;
   return true;
 }
 
-void WMconfig::updateWM(byte ID, long cold_shift, long hot_shift) {
-  byte indx = wm_index(ID);
-  if (indx >= MAX_WM) return;                   // No valid water meter found in the config. Do not save!
-  wm_data[indx].wm_shift[0] = cold_shift;
-  wm_data[indx].wm_shift[1] = hot_shift;
-  wm_set[indx] = true;
+bool WMconfig::loadJson(const String& fn) {
+  fs::File cf = hal.fileSystem().open(fn, "r");
+  if (!cf) return false;
+  jsonParser parser(this);
+  bool ok = parser.parseFile(cf);
+  cf.close();
+  return ok && parser.complete();
 }
 
-void WMconfig::removeWM(byte ID) {
-  byte indx = wm_index(ID);
-  if (indx >= MAX_WM) return;                   // No valid water meter found in the config.
-  resetWM(indx);
+void WMconfig::run(void) {
+  if (dirty && (hal.ms() - dirty_ms >= quiet_ms))
+    save();
 }
 
-void WMconfig::updateWMserial(byte ID, bool hot, String sn, time_t nxt) {
-  byte indx = wm_index(ID);
-  if (indx >= MAX_WM) return;                   // No valid water meter found in the config. Do not save!
-  wm_data[indx].wm_serial[byte(hot)] = sn;
-  wm_data[indx].wm_maintenance[byte(hot)] = nxt;
-  wm_set[indx] = true;
+// Copy the string into the snapshot field, returns false if the string is too long
+static bool putStr(char* field, size_t size, const String& str) {
+  if (str.length() >= size) return false;
+  strcpy(field, str.c_str());
+  return true;
 }
 
-byte WMconfig::wm_index(byte ID) {
-  for (byte i = 0; i < MAX_WM; ++i) {
-    if (wm_data[i].ID == ID) return i;
+/*
+ * The snapshot is read by single read into the temporary buffer: the header and the controller records together,
+ * the checksum is calculated on the whole buffer. If there is no memory for the buffer, the json file is loaded.
+ */
+bool WMconfig::loadSnapshot(void) {
+  fs::File sf = hal.fileSystem().open(snapshotName(), "r");
+  if (!sf) return false;
+  uint32_t size = sf.size();
+  if (size < sizeof(struct cfg_snapshot) || size > sizeof(struct cfg_snapshot) + MAX_WM * sizeof(struct cfg_snapshot_wm)) {
+    sf.close();
+    return false;
   }
-  for (byte i = 0; i < MAX_WM; ++i) {
-    if (wm_data[i].ID == 0) {
-      wm_data[i].ID = ID;
-      return i;
-    }
+  byte *buff = new (std::nothrow) byte[size];
+  if (!buff) {
+    sf.close();
+    return false;
+  }
+  bool ok = (sf.read(buff, size) == size);
+  sf.close();
+  struct cfg_snapshot &s = *(struct cfg_snapshot *)buff;
+  ok = ok && s.magic == cfg_magic && s.version == cfg_version && s.size == sizeof(struct cfg_snapshot);
+  ok = ok && size == sizeof(struct cfg_snapshot) + uint32_t(s.wm_count) * sizeof(struct cfg_snapshot_wm);
+  if (ok) {
+    uint16_t crc = s.crc;
+    s.crc = 0;
+    ok = (crc16(buff, size) == crc);
+  }
+  if (!ok) {
+    delete[] buff;
+    return false;
+  }
+
+  struct cfg_snapshot_wm *w = (struct cfg_snapshot_wm *)(buff + sizeof(struct cfg_snapshot));
+  for (byte i = 0; i < s.wm_count; ++i, ++w) {
+    WMuData *wud = wm_list.add(w->ID);
+    if (!wud) continue;
+    wud->ID                      = w->ID;
+    wud->wm_location             = w->location;
+    wud->wm_serial[WM_COLD]      = w->serial[WM_COLD];
+    wud->wm_serial[WM_HOT]       = w->serial[WM_HOT];
+    wud->wm_maintenance[WM_COLD] = w->maintenance[WM_COLD];
+    wud->wm_maintenance[WM_HOT]  = w->maintenance[WM_HOT];
+    wud->wm_shift[WM_COLD]       = w->shift[WM_COLD];
+    wud->wm_shift[WM_HOT]        = w->shift[WM_HOT];
+  }
+  w_nodename          = s.nodename;
+  w_ssid              = s.ssid;
+  w_password          = s.password;
+  t_server            = s.ntp;
+  t_shift             = s.t_shift;
+  b_auth              = s.auth;
+  smtp_relay_host     = s.smtp_host;
+  smtp_relay_port     = s.smtp_port;
+  smtp_relay_ssl      = s.smtp_ssl;
+  smtp_relay_from     = s.smtp_from;
+  smtp_relay_user     = s.smtp_user;
+  smtp_relay_pass     = s.smtp_pass;
+  smtp_email_to       = s.email_to;
+  maintenance_warning = s.warning;
+  maintenance_urgent  = s.urgent;
+  smtp_period         = s.smtp_period;
+  smtp_send_at        = s.smtp_send_at;
+  frac_size           = s.frac_size;
+  log_flush           = s.log_flush;
+  delete[] buff;
+  return true;
+}
+
+// Fill the snapshot record of the water meter controller, returns false if some string does not fit
+static bool snapshotWM(WMuData& wud, struct cfg_snapshot_wm& w) {
+  memset(&w, 0, sizeof(struct cfg_snapshot_wm));
+  w.ID                    = wud.ID;
+  w.maintenance[WM_COLD]  = wud.wm_maintenance[WM_COLD];
+  w.maintenance[WM_HOT]   = wud.wm_maintenance[WM_HOT];
+  w.shift[WM_COLD]        = wud.wm_shift[WM_COLD];
+  w.shift[WM_HOT]         = wud.wm_shift[WM_HOT];
+  return putStr(w.location,        sizeof(w.location),        wud.wm_location)
+      && putStr(w.serial[WM_COLD], sizeof(w.serial[WM_COLD]), wud.wm_serial[WM_COLD])
+      && putStr(w.serial[WM_HOT],  sizeof(w.serial[WM_HOT]),  wud.wm_serial[WM_HOT]);
+}
+
+// Save the binary snapshot of the configuration. If some string does not fit, remove the snapshot to use the json file
+bool WMconfig::saveSnapshot(void) {
+  struct cfg_snapshot s;
+  memset(&s, 0, sizeof(struct cfg_snapshot));
+  s.magic     = cfg_magic;
+  s.version   = cfg_version;
+  s.size      = sizeof(struct cfg_snapshot);
+  bool ok = putStr(s.nodename,  sizeof(s.nodename),  w_nodename)
+         && putStr(s.ssid,      sizeof(s.ssid),      w_ssid)
+         && putStr(s.password,  sizeof(s.password),  w_password)
+         && putStr(s.ntp,       sizeof(s.ntp),       t_server)
+         && putStr(s.auth,      sizeof(s.auth),      b_auth)
+         && putStr(s.smtp_host, sizeof(s.smtp_host), smtp_relay_host)
+         && putStr(s.smtp_from, sizeof(s.smtp_from), smtp_relay_from)
+         && putStr(s.smtp_user, sizeof(s.smtp_user), smtp_relay_user)
+         && putStr(s.smtp_pass, sizeof(s.smtp_pass), smtp_relay_pass)
+         && putStr(s.email_to,  sizeof(s.email_to),  smtp_email_to);
+  s.t_shift      = t_shift;
+  s.warning      = maintenance_warning;
+  s.urgent       = maintenance_urgent;
+  s.smtp_port    = smtp_relay_port;
+  s.log_flush    = log_flush;
+  s.smtp_ssl     = smtp_relay_ssl;
+  s.frac_size    = frac_size;
+  s.smtp_period  = smtp_period;
+  s.smtp_send_at = smtp_send_at;
+  s.wm_count     = wmCount();
+
+  uint16_t crc = crc16(&s, sizeof(struct cfg_snapshot));
+  struct cfg_snapshot_wm w;
+  for (byte i = 0; ok && i < wm_list.size(); ++i) {   // The same controllers as in the json file
+    if (!wm_list.at(i).configured) continue;
+    ok = snapshotWM(wm_list.at(i), w);
+    crc = crc16(&w, sizeof(struct cfg_snapshot_wm), crc);
   }
-  return MAX_WM;                                // No valid slot found
+  if (!ok) {
+    hal.fileSystem().remove(snapshotName());
+    return false;
+  }
+  s.crc = crc;
+  String tmp_name = tmpName(snapshotName());
+  fs::File sf = hal.fileSystem().open(tmp_name, "w");
+  if (!sf) return false;
+  ok = (sf.write((byte *)&s, sizeof(struct cfg_snapshot)) == sizeof(struct cfg_snapshot));
+  for (byte i = 0; ok && i < wm_list.size(); ++i) {
+    if (!wm_list.at(i).configured) continue;
+    snapshotWM(wm_list.at(i), w);
+    ok = (sf.write((byte *)&w, sizeof(struct cfg_snapshot_wm)) == sizeof(struct cfg_snapshot_wm));
+  }
+  sf.close();
+  if (ok)
+    ok = hal.fileSystem().rename(tmp_name, snapshotName());
+  return ok;
+}
+
+void WMconfig::updateWM(byte ID, long cold_shift, long hot_shift) {
+  WMuData *w = wm_list.add(ID);
+  if (!w) return;                               // No room for the water meter in the config. Do not save!
+  w->ID          = ID;
+  w->wm_shift[0] = cold_shift;
+  w->wm_shift[1] = hot_shift;
+  w->configured  = true;
+}
+
+void WMconfig::removeWM(byte ID) {
+  wm_list.remove(ID);
+}
+
+void WMconfig::updateWMserial(byte ID, bool hot, String sn, time_t nxt) {
+  WMuData *w = wm_list.add(ID);
+  if (!w) return;                               // No room for the water meter in the config. Do not save!
+  w->ID                        = ID;
+  w->wm_serial[byte(hot)]      = sn;
+  w->wm_maintenance[byte(hot)] = nxt;
+  w->configured                = true;
 }
 
 void WMconfig::setLocation(byte ID, String location) {
-  byte indx = wm_index(ID);
+  WMuData *w = wm_list.add(ID);
+  if (!w) return;
+  w->ID = ID;
   if (location.length() > 23)
-    wm_data[indx].wm_location = location.substring(0, 23);
+    w->wm_location = location.substring(0, 23);
   else
-    wm_data[indx].wm_location = location;
+    w->wm_location = location;
 }
 
 byte WMconfig::wmCount() {
   byte cnt = 0;
-  for (byte i = 0; i < MAX_WM; ++i) {
-    if (wm_set[i]) ++cnt;
+  for (byte i = 0; i < wm_list.size(); ++i) {
+    if (wm_list.at(i).configured) ++cnt;
   }
   return cnt;
 }
 
 String WMconfig::location(byte ID) {
-  byte indx = wm_index(ID);
-  return wm_data[indx].wm_location;
+  WMuData *w = wm_list.find(ID);
+  return (w)?w->wm_location:String("");
 }
 
 String WMconfig::serial(byte ID, bool hot) {
-  byte indx = wm_index(ID);
-  return wm_data[indx].wm_serial[byte(hot)];
+  WMuData *w = wm_list.find(ID);
+  return (w)?w->wm_serial[byte(hot)]:String("x");
 }
 
 time_t WMconfig::nextMaintenance(byte ID, bool hot) {
-  byte indx = wm_index(ID);
-  return wm_data[indx].wm_maintenance[byte(hot)];
+  WMuData *w = wm_list.find(ID);
+  return (w)?w->wm_maintenance[byte(hot)]:0;
 }
 
 bool WMconfig::warningMaintenance(byte ID, bool hot) {
   if (maintenance_warning) {
-    return (now() + maintenance_warning > nextMaintenance(ID, hot));
+    return (hal.clock() + maintenance_warning > nextMaintenance(ID, hot));
   }
   return false;
 }
 
 bool WMconfig::urgentMaintenance(byte ID, bool hot) {
   if (maintenance_urgent) {
-    return (now() + maintenance_urgent > nextMaintenance(ID, hot));
+    return (hal.clock() + maintenance_urgent > nextMaintenance(ID, hot));
   }
   return false;
 }
@@ -174,7 +297,7 @@ String WMconfig::dataSendAt(void) {
 }
 
 time_t WMconfig::nextTimeDataSend(time_t at) {
-  if (at == 0) at = now();
+  if (at == 0) at = hal.clock();
   tmElements_t tm;
   breakTime(at, tm);
   
@@ -260,9 +383,17 @@ void WMconfig::setDataSendPeriod(String& period, String& at) {
   }
 }
 
+/*
+ * The configuration is written into the temporary file first. When it is complete, the current file becomes the backup
+ * and the temporary file is renamed to the configuration file. So the power loss never leaves the device without config.
+ */
 bool WMconfig::save(void) {
-  fs::File cf = SPIFFS.open(cf_name, "w");
+  fs::FS& fsys = hal.fileSystem();
+  String tmp_name = tmpName(cf_name);
+  fs::File cf = fsys.open(tmp_name, "w");
   if (!cf) return false;
+  dirty = false;
+  ++saves;
 
   cf.println("{\n \"wifi\": {");
   cf.println("  \"nodename\": \"" + w_nodename + "\",");
@@ -274,20 +405,23 @@ bool WMconfig::save(void) {
   cf.println(" \"blink_auth\": \"" + b_auth + "\",");
   byte wm_count = wmCount();
   cf.print(" \"wm_count\": \"");  cf.print(wm_count, DEC); cf.println("\",");
+  cf.print(" \"log_flush\": \"");  cf.print(log_flush, DEC); cf.println("\",");
   cf.print(" \"fraction_digits\": \"");  cf.print(frac_size, DEC);
   if (wm_count > 0) {
     cf.println("\","); cf.println(" \"wm_list\": [");
-    for (byte i = 0; i < wm_count; ++i) {
-      if (!wm_set[i]) continue;
-      cf.print("   { \"ID\": \""); cf.print(wm_data[i].ID, DEC);
-      cf.print("\", \"location\": \"" + wm_data[i].wm_location + "\",");
-      cf.print(" \"MAINT_COLD\": \""); cf.print(wm_data[i].wm_maintenance[WM_COLD], DEC);
-      cf.print("\", \"SN_COLD\": \"" + wm_data[i].wm_serial[WM_COLD] + "\",");
-      cf.print(" \"cold_shift\": \""); cf.print(wm_data[i].wm_shift[WM_COLD], DEC); cf.print("\", ");
-      cf.print(" \"MAINT_HOT\": \"");  cf.print(wm_data[i].wm_maintenance[WM_HOT], DEC);
-      cf.print("\", \"SN_HOT\":  \"" + wm_data[i].wm_serial[WM_HOT] + "\",");
-      cf.print(" \"hot_shift\": \""); cf.print(wm_data[i].wm_shift[WM_HOT], DEC);
-      if (i < wm_count -1) {
+    byte written = 0;
+    for (byte i = 0; i < wm_list.size(); ++i) {
+      WMuData &w = wm_list.at(i);
+      if (!w.configured) continue;
+      cf.print("   { \"ID\": \""); cf.print(w.ID, DEC);
+      cf.print("\", \"location\": \"" + w.wm_location + "\",");
+      cf.print(" \"MAINT_COLD\": \""); cf.print(w.wm_maintenance[WM_COLD], DEC);
+      cf.print("\", \"SN_COLD\": \"" + w.wm_serial[WM_COLD] + "\",");
+      cf.print(" \"cold_shift\": \""); cf.print(w.wm_shift[WM_COLD], DEC); cf.print("\", ");
+      cf.print(" \"MAINT_HOT\": \"");  cf.print(w.wm_maintenance[WM_HOT], DEC);
+      cf.print("\", \"SN_HOT\":  \"" + w.wm_serial[WM_HOT] + "\",");
+      cf.print(" \"hot_shift\": \""); cf.print(w.wm_shift[WM_HOT], DEC);
+      if (++written < wm_count) {
         cf.println("\"},");
       } else {
         cf.println("\"}");
@@ -311,128 +445,81 @@ bool WMconfig::save(void) {
   cf.print("\",\n    \"send_at\": \""); cf.print(smtp_send_at, DEC);  
   cf.println("\"\n  }\n}");
   cf.close();
-  return true;
-}
 
-void WMconfig::startObject() {
-  for (byte i = WM_max_layers-1; i > 0; --i) {
-    p_key[i] = p_key[i-1];
+  fsys.remove(snapshotName());                  // The old snapshot does not match the new file, never keep it longer
+  fsys.remove(backupName());
+  fsys.rename(cf_name, backupName());
+  if (!fsys.rename(tmp_name, cf_name)) {
+    fsys.rename(backupName(), cf_name);
+    return false;
   }
-  p_key[0] = currentParent;
-  currentParent = currentKey;
-}
-
-void WMconfig::endObject() {
-  currentParent = p_key[0];
-  for (byte i = 0; i < WM_max_layers-1; ++i) {
-    p_key[i] = p_key[i+1];
-  }
-  currentKey = currentArray;
-}
-
-void WMconfig::startArray() {
-  currentArray = currentKey;
-}
-
-void WMconfig::endArray() {
-  currentArray = "";
+  saveSnapshot();
+  return true;
 }
 
-void WMconfig::value(String value) {
-  if (currentParent == "wifi" && currentKey == "nodename") {
-    w_nodename = value;
-  } else
-  if (currentParent == "wifi" && currentKey == "ssid") {
-    w_ssid = value;
-  } else
-  if (currentParent == "wifi" && currentKey == "password") {
-    w_password = value;
-  } else
-  if (currentParent == "ntp" && currentKey == "server") {
-    t_server = value;
-  }  else
-  if (currentParent == "ntp" && currentKey == "time_shift") {
-    t_shift = value.toInt();
-  } else
-  if (currentKey == "blink_auth") {
-    b_auth  = value;
-  } else
-  if (currentKey == "fraction_digits") {
-    frac_size  = value.toInt();
-  } else {
-    if (currentParent == "wm_list") {
-      if (currentKey == "ID") {
-        if (curr_ID == 0) {
-          index  = 0;
-          curr_ID = value.toInt(); 
-          wm_data[index].ID = curr_ID;
-        } else {
-          if (index < MAX_WM - 1) {
-            ++index;
-            curr_ID = value.toInt();
-            wm_data[index].ID = curr_ID;
-          }
-        }
-      } else
-      if (currentKey == "location") {
-        wm_data[index].wm_location = value;
-      } else
-      if (currentKey == "MAINT_COLD") {
-        wm_data[index].wm_maintenance[WM_COLD] = value.toInt();
-      } else
-      if (currentKey == "MAINT_HOT") {
-        wm_data[index].wm_maintenance[WM_HOT] = value.toInt();
-      } else
-      if (currentKey == "SN_COLD") {
-        wm_data[index].wm_serial[WM_COLD] = value;
-      } else
-      if (currentKey == "SN_HOT") {
-        wm_data[index].wm_serial[WM_HOT]  = value;
-      } else
-      if (currentKey == "cold_shift") {
-        wm_data[index].wm_shift[WM_COLD] = value.toInt();
-      } else
-      if (currentKey == "hot_shift") {
-        wm_data[index].wm_shift[WM_HOT]  = value.toInt();
+void WMconfig::jsonValue(uint32_t parent, uint32_t key, const char* value) {
+  switch (parent) {
+    case 0:                                     // The top level parameters
+      switch (key) {
+        case jsonKey("blink_auth"):       b_auth     = value;        break;
+        case jsonKey("fraction_digits"):  frac_size  = atol(value);  break;
+        case jsonKey("log_flush"):        log_flush  = atol(value);  break;
+        default: break;
       }
-    } else
-    if (currentParent == "smtp") {
-      if (currentKey == "relay") {
-        smtp_relay_host = value;
-      } else
-      if (currentKey == "port") {
-        smtp_relay_port = value.toInt();
-      } else
-      if (currentKey == "ssl") {
-        smtp_relay_ssl = (value.toInt() == 1);
-      } else
-      if (currentKey == "from") {
-        smtp_relay_from = value;
-      } else
-      if (currentKey == "to") {
-        smtp_email_to = value;
-      } else
-      if (currentKey == "user") {
-        smtp_relay_user = value;
-      } else
-      if (currentKey == "password") {
-        smtp_relay_pass = value;
+      break;
+    case jsonKey("wifi"):
+      switch (key) {
+        case jsonKey("nodename"):         w_nodename = value;        break;
+        case jsonKey("ssid"):             w_ssid     = value;        break;
+        case jsonKey("password"):         w_password = value;        break;
+        default: break;
       }
-    } else
-    if (currentParent == "notify") {
-      if (currentKey == "warning") {
-        maintenance_warning = value.toInt();
-      } else
-      if (currentKey == "urgent") {
-        maintenance_urgent = value.toInt();
-      }  else
-      if (currentKey == "send_period") {
-        smtp_period = value.toInt();
-      } else
-      if (currentKey == "send_at") {
-        smtp_send_at = value.toInt();
+      break;
+    case jsonKey("ntp"):
+      switch (key) {
+        case jsonKey("server"):           t_server   = value;        break;
+        case jsonKey("time_shift"):       t_shift    = atol(value);  break;
+        default: break;
       }
-    }
+      break;
+    case jsonKey("wm_list"):
+      switch (key) {
+        case jsonKey("ID"):                     // The new controller record
+          cur_wm = wm_list.add(atol(value));
+          if (cur_wm) cur_wm->ID = atol(value);
+          break;
+        case jsonKey("location"):         if (cur_wm) cur_wm->wm_location             = value;        break;
+        case jsonKey("MAINT_COLD"):       if (cur_wm) cur_wm->wm_maintenance[WM_COLD] = atol(value);  break;
+        case jsonKey("MAINT_HOT"):        if (cur_wm) cur_wm->wm_maintenance[WM_HOT]  = atol(value);  break;
+        case jsonKey("SN_COLD"):          if (cur_wm) cur_wm->wm_serial[WM_COLD]      = value;        break;
+        case jsonKey("SN_HOT"):           if (cur_wm) cur_wm->wm_serial[WM_HOT]       = value;        break;
+        case jsonKey("cold_shift"):       if (cur_wm) cur_wm->wm_shift[WM_COLD]       = atol(value);  break;
+        case jsonKey("hot_shift"):        if (cur_wm) cur_wm->wm_shift[WM_HOT]        = atol(value);  break;
+        default: break;
+      }
+      break;
+    case jsonKey("smtp"):
+      switch (key) {
+        case jsonKey("relay"):            smtp_relay_host = value;              break;
+        case jsonKey("port"):             smtp_relay_port = atol(value);        break;
+        case jsonKey("ssl"):              smtp_relay_ssl  = (atol(value) == 1); break;
+        case jsonKey("from"):             smtp_relay_from = value;              break;
+        case jsonKey("to"):               smtp_email_to   = value;              break;
+        case jsonKey("user"):             smtp_relay_user = value;              break;
+        case jsonKey("password"):         smtp_relay_pass = value;              break;
+        default: break;
+      }
+      break;
+    case jsonKey("notify"):
+      switch (key) {
+        case jsonKey("warning"):          maintenance_warning = atol(value);    break;
+        case jsonKey("urgent"):           maintenance_urgent  = atol(value);    break;
+        case jsonKey("send_period"):      smtp_period         = atol(value);    break;
+        case jsonKey("send_at"):          smtp_send_at        = atol(value);    break;
+        default: break;
+      }
+      break;
+    default:
+      break;
   }
 }
-
@@ -1,41 +1,90 @@
 #ifndef WM_config_h
 #define WM_config_h
 
-#include <JsonListener.h>
-#include <JsonStreamingParser.h>
 #include "wm_data.h"
+#include "hal.h"
+#include "json.h"
+#include "registry.h"
 
-#define WM_max_layers 4
-#define MAX_WM  4                               // The maximum number of the water meter controllers
+#define MAX_WM  200                             // The maximum number of the water meter controllers
+#define CFG_VALUE_LEN 128                       // The longest string value of the configuration, the web forms limit it
+
+static_assert(CFG_VALUE_LEN < JSON_VALUE_SIZE, "The json parser should read back every value the configuration saves");
 #define WM_COLD 0
 #define WM_HOT  1
 
 //------------------------------------------ water meter configutation data ------------------------------------
 class WMuData {
   public:
-    WMuData()                                   { }
+    WMuData()                                   { ID = 0; wm_serial[0] = wm_serial[1] = "x"; wm_maintenance[0] = wm_maintenance[1] = 0;
+                                                  wm_shift[0] = wm_shift[1] = 0; configured = false; }
     byte     ID;
     String   wm_location;
     String   wm_serial[2];
     time_t   wm_maintenance[2];
     long     wm_shift[2];
+    bool     configured;                        // The controller counters have been set up
+};
+
+struct cfg_snapshot_wm {                        // The water meter controller data in the binary config snapshot
+  byte      ID;
+  char      location[32];
+  char      serial[2][24];
+  uint32_t  maintenance[2];
+  int32_t   shift[2];
 };
 
+/*
+ * The binary copy of the configuration, written by save() next to the json file. The structure is followed
+ * by wm_count records of the water meter controllers data, the checksum is calculated on all of them.
+ * init() loads it by single read and falls back to the json file if the snapshot is missing or corrupted.
+ * save() removes the snapshot before the json file is replaced, so the snapshot never outlives its json file.
+ */
+struct cfg_snapshot {
+  uint32_t  magic;
+  byte      version;
+  byte      reserved;
+  uint16_t  size;                               // The size of this structure
+  char      nodename[32];
+  char      ssid[33];
+  char      password[65];
+  char      ntp[64];
+  char      auth[40];
+  char      smtp_host[64];
+  char      smtp_from[64];
+  char      smtp_user[64];
+  char      smtp_pass[64];
+  char      email_to[64];
+  int32_t   t_shift;
+  uint32_t  warning;
+  uint32_t  urgent;
+  uint16_t  smtp_port;
+  uint16_t  log_flush;
+  byte      smtp_ssl;
+  byte      frac_size;
+  byte      smtp_period;
+  byte      smtp_send_at;
+  byte      wm_count;                           // Number of the controller records
+  byte      spare;
+  uint16_t  crc;                                // CRC16 of the structure with zero crc and the controller records
+};
+
+const uint32_t cfg_magic   = 0x47464357;        // "WCFG"
+const byte     cfg_version = 3;
+
 //------------------------------------------ water meter configutation parameters ------------------------------
-class WMconfig : public JsonListener {
+class WMconfig : public jsonHandler {
   public:
-    WMconfig(const char *cf = "/config.json") : JsonListener() { cf_name = cf; }
+    WMconfig(const char *cf = "/config.json") : jsonHandler(), wm_list(MAX_WM) { cf_name = cf; snapshot_loaded = false; load_ms = 0; dirty = false; saves = 0; }
     bool init(void);
-    bool save(void);
-    virtual   void key(String key)              { currentKey = String(key); }
-    virtual   void endObject();
-    virtual   void startObject();
-    virtual   void whitespace(char c)           { }
-    virtual   void startDocument()              { }
-    virtual   void endArray();
-    virtual   void endDocument()                { }
-    virtual   void startArray();
-    virtual   void value(String value);
+    bool save(void);                            // Write the configuration right now
+    void      commit(void)                      { dirty = true; dirty_ms = hal.ms(); }  // Save the changes a bit later
+    void      run(void);                        // Should be called from the loop(), saves the committed changes
+    bool      unsaved(void)                     { return dirty; }
+    uint32_t  saveCount(void)                   { return saves; }
+    bool      fromSnapshot(void)                { return snapshot_loaded; }
+    uint32_t  loadTime(void)                    { return load_ms; }
+    virtual   void jsonValue(uint32_t parent, uint32_t key, const char* value);
     String    ssid(void)                        { return w_ssid; }
     String    passwd(void)                      { return w_password; }
     String    ntp(void)                         { return t_server; }
@@ -48,8 +97,11 @@ class WMconfig : public JsonListener {
     void      setAuth(String auth)              { b_auth = auth; }
     byte      frac(void)                        { return frac_size; }
     void      setFrac(byte f)                   { frac_size = f; }
+    uint16_t  logFlush(void)                    { return log_flush; }
+    void      setLogFlush(uint16_t sec)         { log_flush = sec; }
     byte      wmCount(void);
-    WMuData*  getWMuData(void)                  { return wm_data; }
+    byte      wmSlots(void)                     { return wm_list.size(); }
+    WMuData*  getWMuData(byte slot)             { return (slot < wm_list.size())?&wm_list.at(slot):0; }
     void      updateWM(byte ID, long cold_shift, long hot_shift);
     void      removeWM(byte ID);                // Remove water meter controller data from the config
     void      setLocation(byte ID, String location);
@@ -83,16 +135,23 @@ class WMconfig : public JsonListener {
     void      setMaintenanceDays(time_t urgent, time_t warn);
     void      setDataSendPeriod(String& period, String& at);
   private:
-    byte      wm_index(byte ID);
-    void      resetWM(byte index);
+    String    snapshotName(void)                { return cf_name.substring(0, cf_name.lastIndexOf('.')) + ".bin"; }
+    String    tmpName(const String& fn)         { return fn + ".tmp"; }
+    String    backupName(void)                  { return cf_name + ".bak"; }
+    void      setDefaults(void);
+    bool      loadJson(const String& fn);
+    bool      loadSnapshot(void);
+    bool      saveSnapshot(void);
     String    cf_name;                          // config file name
-    byte      index;                            // Index of the current water meter controller read from the config
-    byte      curr_ID;                          // ID of the current WM controller
+    bool      snapshot_loaded;                  // The configuration was loaded from the binary snapshot
+    uint32_t  load_ms;                          // The time spent to load the configuration, ms
+    bool      dirty;                            // The configuration has been changed but not saved yet
+    uint32_t  dirty_ms;                         // The time of the last change, ms
+    uint32_t  saves;                            // Number of the configuration file writes
+    const     uint32_t quiet_ms = 3000;         // Save the configuration when there was no changes for this time
+    WMuData*  cur_wm;                           // The water meter controller being read from the config
     byte      frac_size;                        // Decimal fraction size (number of digits after cubic meters)
-    String    currentKey;                       // Internal variables for json parser
-    String    currentParent;
-    String    currentArray;
-    String    p_key[WM_max_layers];
+    uint16_t  log_flush;                        // The maximum time to keep the log records in RAM, seconds
     String    w_nodename;                       // WiFi nodename to connect to
     String    w_ssid;                           // WiFi ssid
     String    w_password;                       // WiFi password
@@ -110,8 +169,7 @@ class WMconfig : public JsonListener {
     time_t    maintenance_urgent;               // Time threshold for urgent message about the water meter maintenance
     byte      smtp_period;                      // Period to send the counter data: 0 not send, 1 - monthly, 2 - weekly, 3 - daily
     byte      smtp_send_at;
-    WMuData   wm_data[MAX_WM];
-    bool      wm_set[MAX_WM];
+    wmRegistry<WMuData> wm_list;                // The water meter controllers data
     const     String valid_period[4][2] = {
                 {"never",   "never"},
                 {"monthly", "monthly"},
@@ -121,4 +179,4 @@ class WMconfig : public JsonListener {
     const     String week_days[7] = {"mo", "tu", "we", "th", "fr", "sa", "su"};
 };
 
-#endif
+#endif
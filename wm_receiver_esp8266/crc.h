@@ -0,0 +1,9 @@
+#ifndef WM_crc_h
+#define WM_crc_h
+
+#include <Arduino.h>
+
+// CRC-16/CCITT-FALSE checksum of the data buffer. To calculate the checksum of several buffers pass previous result as crc
+uint16_t crc16(const void* data, uint16_t len, uint16_t crc = 0xFFFF);
+
+#endif
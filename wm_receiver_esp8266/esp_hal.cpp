@@ -0,0 +1,13 @@
+#include <WiFiClientSecure.h>
+#include <WiFiClient.h>
+#include "esp_hal.h"
+
+fs::FS& espHAL::fileSystem(void) {
+  return SPIFFS;
+}
+
+Client* espHAL::newClient(bool ssl) {
+  if (ssl)
+    return new WiFiClientSecure;
+  return new WiFiClient;
+}
@@ -0,0 +1,24 @@
+#ifndef WM_esp_hal_h
+#define WM_esp_hal_h
+
+#include "radio.h"
+#include "ntp.h"
+#include "hal.h"
+
+//------------------------------------------ esp8266 implementation of the HAL ---------------------------------
+class espHAL : public HAL {
+  public:
+    espHAL(rfQueue& radio, ntpClock& clk) : HAL(), rf22(radio), ntp(clk) { }
+    virtual   fs::FS&   fileSystem(void);
+    virtual   time_t    clock(void)             { return now(); }
+    virtual   bool      clockSet(void)          { return ntp.synchronized(); }
+    virtual   uint32_t  ms(void)                { return millis(); }
+    virtual   Client*   newClient(bool ssl);
+    virtual   bool      radioRecv(struct rx_packet& pkt)  { return rf22.pop(pkt); }
+    virtual   bool      radioSend(const byte* buff, byte len) { return rf22.transmit(buff, len); }
+  private:
+    rfQueue&  rf22;
+    ntpClock& ntp;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef WM_hal_h
+#define WM_hal_h
+
+/*
+ * Hardware abstraction layer of the receiver.
+ * The water meter pool, the configuration, the log and the notifier access the file system, the clock,
+ * the radio and the TCP client through this interface only. To run these classes on another platform
+ * (i.e. Linux host) implement this class and declare the global hal reference there.
+ */
+
+#define FS_NO_GLOBALS
+#include <FS.h>
+#include <Client.h>
+#include <TimeLib.h>
+#include "wm_data.h"
+
+//------------------------------------------ hardware abstraction layer ---------------------------------------
+class HAL {
+  public:
+    HAL()                                       { }
+    virtual   fs::FS&   fileSystem(void)        = 0;
+    virtual   time_t    clock(void)             = 0;    // Local time, seconds
+    virtual   bool      clockSet(void)          = 0;    // The clock has been set, the time can be logged
+    virtual   uint32_t  ms(void)                = 0;    // Milliseconds since start
+    virtual   Client*   newClient(bool ssl)     = 0;    // New TCP client, the caller should delete it
+    virtual   bool      radioRecv(struct rx_packet& pkt) = 0;  // Get received packet without waiting
+    virtual   bool      radioSend(const byte* buff, byte len) = 0;  // Send the packet, then continue receiving
+};
+
+extern HAL&       hal;                          // Global variable, declared in wm_receiver_esp8266.ino
+
+#endif
@@ -0,0 +1,153 @@
+#include "json.h"
+
+void jsonParser::reset(void) {
+  key        = hash = 0;
+  arrays     = 0;
+  depth      = 0;
+  in_string  = escape = in_literal = want_key = closed = overflow = false;
+  startValue();
+}
+
+void jsonParser::parse(char c) {
+  if (in_string) {
+    if (escape) {
+      escape = false;
+      switch (c) {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case 'r': c = '\r'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        default:  break;                        // '"', '\\', '/' and the unicode escapes are kept as is
+      }
+    } else if (c == '\\') {
+      escape = true;
+      return;
+    } else if (c == '"') {
+      in_string = false;
+      if (want_key) {
+        key = hash;
+      } else {
+        emitValue();
+      }
+      return;
+    }
+    if (want_key) {
+      hash = (hash ^ uint8_t(c)) * 16777619UL;
+    } else {
+      addChar(c);
+    }
+    return;
+  }
+
+  switch (c) {
+    case '"':
+      endLiteral();
+      in_string = true;
+      hash      = 2166136261UL;
+      startValue();
+      break;
+    case ':':
+      endLiteral();
+      want_key = false;
+      break;
+    case ',':
+      endLiteral();
+      want_key = !inArray();
+      break;
+    case '{':
+      endLiteral();
+      push(false);
+      want_key = true;
+      break;
+    case '[':
+      endLiteral();
+      push(true);
+      want_key = false;
+      break;
+    case '}':
+    case ']':
+      endLiteral();
+      pop();
+      break;
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+      endLiteral();
+      break;
+    default:                                    // Number or true, false, null
+      if (depth == 0) break;                    // Skip everything outside of the document
+      if (!in_literal) {
+        in_literal = true;
+        startValue();
+      }
+      addChar(c);
+      break;
+  }
+}
+
+bool jsonParser::parseFile(fs::File& f) {
+  byte buff[128];
+  int last = f.size();
+  while (last > 0) {
+    int rb = last;
+    if (rb > int(sizeof(buff))) rb = sizeof(buff);
+    rb = f.read(buff, rb);
+    if (rb <= 0) return false;
+    last -= rb;
+    for (int i = 0; i < rb; ++i)
+      parse(buff[i]);
+  }
+  endLiteral();
+  return !overflow;
+}
+
+void jsonParser::addChar(char c) {
+  if (len < JSON_VALUE_SIZE - 1) {
+    value[len++] = c;
+    value[len]   = '\0';
+  } else {
+    overflow = true;
+  }
+}
+
+void jsonParser::endLiteral(void) {
+  if (in_literal) {
+    in_literal = false;
+    emitValue();
+  }
+}
+
+void jsonParser::emitValue(void) {
+  if (depth > 0 && depth <= JSON_MAX_DEPTH)
+    handler->jsonValue(parent(), key, value);
+  startValue();
+}
+
+// The elements of the array inherit the array key
+void jsonParser::push(bool is_array) {
+  uint32_t k = (inArray())?path[depth-1]:key;
+  if (depth < JSON_MAX_DEPTH) {
+    path[depth] = k;
+    if (is_array)
+      arrays |=  (1 << depth);
+    else
+      arrays &= ~(1 << depth);
+  }
+  ++depth;
+  key = 0;
+}
+
+void jsonParser::pop(void) {
+  if (depth == 0) return;
+  bool is_object = !inArray();
+  --depth;
+  if (depth < JSON_MAX_DEPTH)
+    key = path[depth];                          // Restore the key of the closed object
+  if (depth == 0)
+    closed = true;
+  if (is_object)
+    handler->jsonEndObject(parent(), depth);
+  want_key = false;
+}
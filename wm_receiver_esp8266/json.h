@@ -0,0 +1,68 @@
+#ifndef WM_json_h
+#define WM_json_h
+
+/*
+ * The small streaming (SAX) json parser for the configuration files and the old logs.
+ * The parser does not allocate memory: the value being read is collected into the fixed buffer,
+ * the keys are not stored at all, only their hash is calculated. The handler gets the hash of the key and the hash
+ * of the parent object key, so it can dispatch by switch statement with the hashes precomputed at compile time:
+ *   switch (key) {
+ *     case jsonKey("ssid"): ...
+ * The elements of the array get the array key as the parent key. The top level keys have parent key 0.
+ * All the values are passed as strings, the quotes are removed. The value longer than the buffer is never truncated:
+ * the parse fails, parseFile() returns false and the document is not complete().
+ */
+
+#define FS_NO_GLOBALS
+#include <FS.h>
+
+#define JSON_VALUE_SIZE 129                     // The maximum length of the value plus 1, the longer value fails the parse
+#define JSON_MAX_DEPTH  6                       // The maximum nesting level of the objects and arrays
+
+// FNV-1a hash of the key, calculated at compile time for the constant strings
+constexpr uint32_t jsonKey(const char* s, uint32_t h = 2166136261UL) {
+  return (*s)?jsonKey(s + 1, (h ^ uint8_t(*s)) * 16777619UL):h;
+}
+
+//------------------------------------------ json parser event handler -----------------------------------------
+class jsonHandler {
+  public:
+    virtual   void jsonValue(uint32_t parent, uint32_t key, const char* value) = 0;
+    virtual   void jsonEndObject(uint32_t parent, byte depth) { }  // The object is complete, depth 0 is the document end
+};
+
+//------------------------------------------ streaming json parser ---------------------------------------------
+class jsonParser {
+  public:
+    jsonParser(jsonHandler* h)                  { handler = h; reset(); }
+    void      reset(void);
+    void      parse(char c);
+    bool      parseFile(fs::File& f);           // Parse the whole file by small chunks
+    bool      complete(void)                    { return closed && depth == 0 && !overflow; }  // The document has been read completely
+    bool      overflowed(void)                  { return overflow; }  // Some value did not fit the buffer
+  private:
+    void      startValue(void)                  { len = 0; value[0] = '\0'; }
+    void      addChar(char c);
+    void      endLiteral(void);
+    void      emitValue(void);
+    void      push(bool is_array);
+    void      pop(void);
+    uint32_t  parent(void)                      { return (depth > 0 && depth <= JSON_MAX_DEPTH)?path[depth-1]:0; }
+    bool      inArray(void)                     { return depth > 0 && depth <= JSON_MAX_DEPTH && (arrays & (1 << (depth-1))); }
+    jsonHandler* handler;
+    char      value[JSON_VALUE_SIZE];           // The value being read
+    byte      len;                              // The value length
+    uint32_t  key;                              // The hash of the current key
+    uint32_t  hash;                             // The hash of the string being read
+    uint32_t  path[JSON_MAX_DEPTH];             // The keys of the open objects and arrays
+    byte      arrays;                           // Bit mask of the open arrays in the path
+    byte      depth;                            // The current nesting level
+    bool      in_string;                        // Reading the string
+    bool      escape;                           // The previous character was backslash
+    bool      in_literal;                       // Reading the number or true, false, null
+    bool      want_key;                         // The next string is the key
+    bool      closed;                           // The top level object or array has been closed
+    bool      overflow;                         // The value longer than JSON_VALUE_SIZE - 1 has been read
+};
+
+#endif
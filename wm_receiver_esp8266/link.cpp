@@ -0,0 +1,253 @@
+#include "link.h"
+#include "crc.h"
+
+wmLink::STATUS wmLink::decode(const struct rx_packet& pkt, struct data& wm, struct history& hist) {
+  memset(&wm, 0, sizeof(struct data));
+  countAir(pkt.len);
+  if (pkt.len == legacy_size) {                 // The raw struct data: uint32_t wm_data[2], uint16_t batt_mv, byte ID
+    memcpy(wm.wm_data, pkt.buff, 2 * sizeof(uint32_t));
+    memcpy(&wm.batt_mv, &pkt.buff[8], sizeof(uint16_t));
+    wm.ID       = pkt.buff[10];
+    wm.channels = 2;
+    if (wm.ID == 0) {
+      ++pkt_bad;
+      return PKT_CORRUPTED;
+    }
+    ++pkt_legacy;
+    updateStats(wm.ID, pkt, (uint32_t(tx_period_base) + wm.ID) * 1000);
+    return PKT_LEGACY;
+  }
+
+  if (pkt.len < sizeof(struct pkt_header) + sizeof(uint16_t) || pkt.buff[0] != pkt_magic) {
+    ++pkt_bad;
+    return PKT_UNKNOWN;
+  }
+  struct pkt_header hdr;
+  memcpy(&hdr, pkt.buff, sizeof(struct pkt_header));
+  uint16_t crc;
+  memcpy(&crc, &pkt.buff[pkt.len - sizeof(uint16_t)], sizeof(uint16_t));
+  if (hdr.version == 0 || hdr.version > pkt_version || hdr.ID == 0 || crc != crc16(pkt.buff, pkt.len - sizeof(uint16_t))) {
+    ++pkt_bad;
+    return PKT_CORRUPTED;
+  }
+  byte data_size = sizeof(struct pkt_data_v2);
+  if (hdr.version == 1) {
+    data_size = pkt_v1_size;
+  } else if (hdr.version >= 3) {
+    byte channels = (pkt.len > pkt_data_size)?pkt.buff[offsetof(struct pkt_data, channels)]:0;
+    data_size = (channels > 0 && channels <= WM_MAX_CHANNELS)?pkt_data_size + channels * sizeof(uint32_t):0;
+  }
+  bool is_history = (hdr.type == PKT_HISTORY && hdr.version >= 3);
+  if (is_history?!historySize(pkt):(hdr.type != PKT_DATA || pkt.len != data_size)) {
+    ++pkt_bad;
+    return PKT_UNKNOWN;
+  }
+  struct link_stats *p = peers.add(hdr.ID);
+  if (!p) {                                     // No room to track the transmitter
+    ++pkt_untracked;
+    return PKT_UNTRACKED;
+  }
+  if (!checkSequence(p, hdr.seq, hdr.flags & PKT_F_BOOT)) {
+    ++pkt_dup;
+    return PKT_DUPLICATE;
+  }
+  if (is_history) {
+    decodeHistory(pkt, hist);
+    ++pkt_ok;
+    updateStats(hdr.ID, pkt, 0);                // Sent right after the data packet, out of the schedule
+    return PKT_BACKFILL;
+  }
+
+  wm.ID = hdr.ID;
+  if (hdr.version < 3) {
+    struct pkt_data_v2 pd;
+    memset(&pd, 0, sizeof(struct pkt_data_v2));
+    memcpy(&pd, pkt.buff, pkt.len - sizeof(uint16_t));  // The version 1 packet has no ee_wear field
+    wm.batt_mv    = pd.batt_mv;
+    wm.wm_data[0] = pd.wm_data[0];
+    wm.wm_data[1] = pd.wm_data[1];
+    wm.ee_wear    = pd.ee_wear;
+    wm.channels   = 2;
+  } else {
+    struct pkt_data pd;
+    memcpy(&pd, pkt.buff, pkt.len - sizeof(uint16_t));
+    wm.batt_mv    = pd.batt_mv;
+    wm.ee_wear    = pd.ee_wear;
+    wm.channels   = pd.channels;
+    for (byte i = 0; i < pd.channels; ++i)
+      wm.wm_data[i] = pd.wm_data[i];
+  }
+  ++pkt_ok;
+  uint32_t period = (uint32_t(tx_period_base) + hdr.ID) * 1000;
+  if (hdr.flags & PKT_F_SLOT)
+    period = uint32_t(frame_slots) * slot_ms;
+  else if (hdr.version >= 4)
+    period += (tx_period_spread - 1) * 500;     // The mean of the random period
+  updateStats(hdr.ID, pkt, period, hdr.flags & PKT_F_ADAPTIVE);
+  return PKT_OK;
+}
+
+// Check the history packet length by the number of the meters and the snapshots
+bool wmLink::historySize(const struct rx_packet& pkt) {
+  if (pkt.len < sizeof(struct pkt_history_hdr) + sizeof(uint16_t)) return false;
+  struct pkt_history_hdr ph;
+  memcpy(&ph, pkt.buff, sizeof(struct pkt_history_hdr));
+  if (ph.channels == 0 || ph.channels > WM_MAX_CHANNELS || ph.records == 0 || ph.records > hist_max_records) return false;
+  uint16_t rec_size = sizeof(uint16_t) + ph.channels * sizeof(uint32_t);
+  return pkt.len == sizeof(struct pkt_history_hdr) + ph.records * rec_size + sizeof(uint16_t);
+}
+
+void wmLink::decodeHistory(const struct rx_packet& pkt, struct history& hist) {
+  struct pkt_history_hdr ph;
+  memcpy(&ph, pkt.buff, sizeof(struct pkt_history_hdr));
+  memset(&hist, 0, sizeof(struct history));
+  hist.ID      = ph.hdr.ID;
+  hist.records = ph.records;
+  const byte *p = &pkt.buff[sizeof(struct pkt_history_hdr)];
+  for (byte r = 0; r < ph.records; ++r) {
+    memcpy(&hist.age[r], p, sizeof(uint16_t));
+    p += sizeof(uint16_t);
+    for (byte ch = 0; ch < ph.channels; ++ch) {
+      if (ch < 2) memcpy(&hist.wm_data[r][ch], p, sizeof(uint32_t));
+      p += sizeof(uint32_t);
+    }
+  }
+}
+
+// Accept the next sequence numbers only. The number far behind the last one means the transmitter has been restarted
+bool wmLink::checkSequence(struct link_stats* p, uint16_t seq, bool boot) {
+  uint16_t diff = seq - p->seq;
+  if (p->synced && !boot) {
+    if (diff == 0) return false;                // Duplicate
+    if (diff > 0x8000) {                        // The number is behind the last one
+      if (uint16_t(-diff) <= replay_window) return false;
+    } else {
+      pkt_lost    += diff - 1;
+      p->seq_lost += diff - 1;
+    }
+  }
+  p->seq    = seq;
+  p->synced = true;
+  return true;
+}
+
+byte wmLink::ack(byte ID, uint16_t seq, byte* buff) {
+  struct pkt_ack pa;
+  pa.hdr.magic   = pkt_magic;
+  pa.hdr.version = pkt_version;
+  pa.hdr.type    = PKT_ACK;
+  pa.hdr.flags   = 0;
+  pa.hdr.ID      = 0;
+  pa.hdr.seq     = reply_seq++;
+  pa.ID          = ID;
+  pa.seq         = seq;
+  pa.crc         = crc16(&pa, sizeof(struct pkt_ack) - sizeof(uint16_t));
+  memcpy(buff, &pa, sizeof(struct pkt_ack));
+  ++acks;
+  countAir(sizeof(struct pkt_ack));
+  return sizeof(struct pkt_ack);
+}
+
+// The transmit period is 0 for the packet out of the schedule, the interval statistics is not updated
+void wmLink::updateStats(byte ID, const struct rx_packet& pkt, uint32_t expected, bool adaptive) {
+  struct link_stats *p = peers.add(ID);
+  if (!p) return;
+  if (p->received == 0) {                       // The first packet from the transmitter
+    p->rssi_avg16 = int16_t(pkt.rssi) * 16;
+  } else {
+    p->rssi_avg16 += int16_t(pkt.rssi) - p->rssi_avg16 / 16;
+  }
+  p->rssi = pkt.rssi;
+  ++p->received;
+  if (expected == 0) return;
+  p->silence_ms = (adaptive)?expected * heartbeat_periods:expected;
+  if (p->last_ms) {
+    uint32_t interval = pkt.ms - p->last_ms;
+    uint32_t periods  = (interval + expected / 2) / expected;
+    if (periods == 0) periods = 1;
+    p->sched_lost += (adaptive)?(periods - 1) / heartbeat_periods:periods - 1;
+    uint32_t sched = periods * expected;        // The deviation from the schedule
+    uint32_t dev   = (interval > sched)?interval - sched:sched - interval;
+    if (p->jitter_ms == 0 && p->interval_ms == 0) {
+      p->jitter_ms = dev;
+    } else {
+      p->jitter_ms = p->jitter_ms + dev / 16 - p->jitter_ms / 16;
+    }
+    if (periods == 1) {                         // The average interval between consecutive packets
+      if (p->interval_ms == 0)
+        p->interval_ms = interval;
+      else
+        p->interval_ms = p->interval_ms + interval / 16 - p->interval_ms / 16;
+    }
+  }
+  p->last_ms = pkt.ms;
+}
+
+bool wmLink::stale(byte ID) {
+  const struct link_stats *p = peers.find(ID);
+  if (!p || p->last_ms == 0 || p->silence_ms == 0) return false;
+  return hal.ms() - p->last_ms > p->silence_ms * stale_periods;
+}
+
+// The beacon to the listening transmitter, the ACK to the packet accepted now or before. The replays are not answered
+byte wmLink::reply(const struct rx_packet& pkt, STATUS st, byte* buff) {
+  if (st != PKT_OK && st != PKT_BACKFILL && st != PKT_DUPLICATE) return 0;
+  struct pkt_header hdr;
+  memcpy(&hdr, pkt.buff, sizeof(struct pkt_header));
+  if (!(hdr.flags & (PKT_F_LISTEN | PKT_F_ACK))) return 0;
+  if (st == PKT_DUPLICATE) {                    // The answer to the packet has been lost
+    struct link_stats *p = peers.find(hdr.ID);
+    if (!p || p->seq != hdr.seq || !(hdr.flags & PKT_F_ACK)) return 0;
+    ++p->retries;
+  }
+  if (hdr.flags & PKT_F_LISTEN) return beacon(hdr.ID, buff);
+  return ack(hdr.ID, hdr.seq, buff);
+}
+
+// The beacon for the transmitter: its slot and the frame position at the time the beacon is received
+byte wmLink::beacon(byte ID, byte* buff) {
+  struct pkt_beacon_hdr bh;
+  struct beacon_slot    bs;
+  int16_t slot = txSlot(ID);
+  bh.records   = (slot >= 0)?1:0;               // The transmitter without the slot keeps the random period
+  byte len = sizeof(struct pkt_beacon_hdr) + bh.records * sizeof(struct beacon_slot) + sizeof(uint16_t);
+  bh.hdr.magic   = pkt_magic;
+  bh.hdr.version = pkt_version;
+  bh.hdr.type    = PKT_BEACON;
+  bh.hdr.flags   = 0;
+  bh.hdr.ID      = 0;
+  bh.hdr.seq     = reply_seq++;
+  bh.frame_ms    = (hal.ms() + airtime(len)) % (uint32_t(frame_slots) * slot_ms);
+  bs.ID          = ID;
+  bs.slot        = slot;
+  memcpy(buff, &bh, sizeof(struct pkt_beacon_hdr));
+  if (bh.records) memcpy(&buff[sizeof(struct pkt_beacon_hdr)], &bs, sizeof(struct beacon_slot));
+  uint16_t crc = crc16(buff, len - sizeof(uint16_t));
+  memcpy(&buff[len - sizeof(uint16_t)], &crc, sizeof(uint16_t));
+  ++beacons;
+  countAir(len);
+  return len;
+}
+
+static_assert(frame_slots == 256 && MAX_WM <= frame_slots, "The slot is the registry entry byte with the bits reversed");
+
+// The 256 slots of the frame are assigned by the reversed bits: 0, 128, 64, 192, 32, ...
+byte wmLink::spread(byte s) {
+  s = (s & 0xF0) >> 4 | (s & 0x0F) << 4;
+  s = (s & 0xCC) >> 2 | (s & 0x33) << 2;
+  return (s & 0xAA) >> 1 | (s & 0x55) << 1;
+}
+
+void wmLink::countAir(byte len) {
+  rollAir();
+  air_ms += airtime(len);
+}
+
+// Close the airtime window if it is over. It is also closed on read, so the load drops when the channel gets idle
+void wmLink::rollAir(void) {
+  uint32_t elapsed = hal.ms() - air_start;
+  if (elapsed < air_window) return;
+  air_load   = (elapsed < 2 * air_window)?air_ms * 1000 / air_window:0;  // The windows after it were idle
+  air_ms     = 0;
+  air_start += elapsed - elapsed % air_window;
+}
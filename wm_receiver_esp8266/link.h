@@ -0,0 +1,97 @@
+#ifndef WM_link_h
+#define WM_link_h
+
+/*
+ * The radio link layer of the receiver: decodes the packets received from the water meter controllers.
+ * The versioned packets are checked by CRC, the duplicates and the replayed packets are rejected by the sequence
+ * number of the transmitter, the gaps in the sequence are counted as lost packets. The versioned packets
+ * of the transmitters the registry has no room for are rejected and counted, their replays could not be detected.
+ * The old packets (raw struct data) are accepted as is while the transmitters are updated.
+ * The history packets are checked the same way and decoded separately, they do not update the current data.
+ * The transmitter that waits for the beacon after the packet (PKT_F_LISTEN) gets its slot in the frame, see wm_data.h.
+ * The packet with PKT_F_ACK flag is acknowledged, the retry of the last packet accepted is acknowledged again.
+ * The slot is the registry entry of the transmitter with the bits reversed, so the first transmitters registered
+ * are spread evenly over the frame and the free slots between them get fewer as the new ones come.
+ *
+ * The link statistics of every transmitter are collected from the accepted packets: the signal strength,
+ * the packet loss and the inter-arrival jitter. The loss is also estimated by the transmit schedule, so it is known
+ * for the old transmitters without the sequence number. The averages are exponential, weight 1/16.
+ * The adaptive transmitter (PKT_F_ADAPTIVE) skips the periods without changes, so only the missed heartbeats
+ * are counted as lost by the schedule, and the transmitter becomes stale after a few heartbeats missed.
+ * The airtime of every packet, good or bad, is summed up to see how busy the channel is (per mille of the last
+ * 10 minutes): without the slots the collisions grow fast when the channel is busy over a few percent.
+ */
+
+#include "wm_data.h"
+#include "config.h"
+#include "registry.h"
+
+struct link_stats {                             // The link statistics of one transmitter
+  uint32_t  received;                           // Number of the packets accepted
+  uint32_t  seq_lost;                           // Number of the packets missed in the sequence
+  uint32_t  sched_lost;                         // Number of the packets missed by the transmit schedule
+  uint32_t  last_ms;                            // The time the last packet was received, ms
+  uint32_t  interval_ms;                        // The average interval between the packets, ms
+  uint32_t  jitter_ms;                          // The average deviation of the interval from the schedule, ms
+  uint32_t  silence_ms;                         // The longest interval between the packets by the schedule, ms
+  int16_t   rssi_avg16;                         // The average signal strength, dBm * 16
+  int8_t    rssi;                               // The last signal strength, dBm
+  bool      synced;                             // The sequence number has been received
+  uint16_t  seq;                                // The last accepted sequence number
+  uint32_t  retries;                            // Number of the retries received after the acknowledgement was lost
+};
+
+//------------------------------------------ radio link of the water meter controllers -------------------------
+class wmLink {
+  public:
+    typedef   enum { PKT_OK = 0, PKT_LEGACY, PKT_BACKFILL, PKT_DUPLICATE, PKT_CORRUPTED, PKT_UNKNOWN, PKT_UNTRACKED } STATUS;
+    wmLink() : peers(MAX_WM)                    { pkt_ok = pkt_legacy = pkt_dup = pkt_bad = pkt_lost = pkt_untracked = beacons = acks = 0; reply_seq = 0; air_ms = air_start = 0; air_load = 0; }
+    STATUS    decode(const struct rx_packet& pkt, struct data& wm, struct history& hist);
+    byte      reply(const struct rx_packet& pkt, STATUS st, byte* buff);  // Build the answer to the packet, returns its length
+    int16_t   txSlot(byte ID)                   { byte s = peers.slot(ID); return (s != REG_NO_SLOT)?spread(s):-1; }  // -1 if no slot
+    uint32_t  beaconsSent(void)                 { return beacons; }
+    uint32_t  acksSent(void)                    { return acks; }
+    uint16_t  channelLoad(void)                 { rollAir(); return air_load; }
+    uint32_t  accepted(void)                    { return pkt_ok; }
+    uint32_t  legacy(void)                      { return pkt_legacy; }
+    uint32_t  duplicates(void)                  { return pkt_dup; }
+    uint32_t  corrupted(void)                   { return pkt_bad; }
+    uint32_t  lost(void)                        { return pkt_lost; }
+    uint32_t  untracked(void)                   { return pkt_untracked; }
+    byte      numPeers(void)                    { return peers.size(); }
+    byte      peerID(byte index)                { return peers.id(index); }
+    const     struct link_stats* stats(byte ID) { return peers.find(ID); }
+    bool      stale(byte ID);                   // No packets from the transmitter for stale_periods of its longest interval
+    static    int16_t averageRSSI(const struct link_stats* ls)  { return ls->rssi_avg16 / 16; }
+  private:
+    bool      checkSequence(struct link_stats* p, uint16_t seq, bool boot);
+    byte      beacon(byte ID, byte* buff);
+    byte      ack(byte ID, uint16_t seq, byte* buff);
+    bool      historySize(const struct rx_packet& pkt);
+    void      decodeHistory(const struct rx_packet& pkt, struct history& hist);
+    void      updateStats(byte ID, const struct rx_packet& pkt, uint32_t expected, bool adaptive = false);
+    static    uint16_t airtime(byte len)        { return uint16_t(len + rf_overhead) * byte_ms; }
+    static    byte spread(byte s);              // The bits of s reversed
+    void      countAir(byte len);
+    void      rollAir(void);
+    wmRegistry<struct link_stats> peers;
+    uint32_t  pkt_ok;                           // The number of the versioned packets accepted
+    uint32_t  pkt_legacy;                       // The number of the old packets accepted
+    uint32_t  pkt_dup;                          // The number of the duplicated and replayed packets rejected
+    uint32_t  pkt_bad;                          // The number of the packets with wrong size, version or CRC
+    uint32_t  pkt_lost;                         // The number of the packets missed in the sequence
+    uint32_t  pkt_untracked;                    // The number of the packets rejected, no room to track the transmitter
+    uint32_t  beacons;                          // The number of the beacons sent
+    uint32_t  acks;                             // The number of the acknowledgements sent
+    uint16_t  reply_seq;                        // The sequence number of the beacons and the acknowledgements
+    uint32_t  air_ms;                           // The airtime of the packets received and sent in the window, ms
+    uint32_t  air_start;                        // The beginning of the airtime window, ms
+    uint16_t  air_load;                         // The airtime in the last window, per mille
+    const     uint16_t replay_window = 64;      // The older sequence numbers are considered as the transmitter restart
+    const     byte stale_periods = 3;           // The transmitter is stale after missing 3 heartbeats
+    static    const byte rf_overhead = 13;      // The preamble, sync word, header, length and CRC of the radio packet, bytes
+    static    const byte byte_ms = 4;           // The airtime of one byte at 2 kbps, ms
+    static    const uint32_t air_window = 600000; // The channel load is measured every 10 minutes
+};
+
+#endif
@@ -1,112 +1,332 @@
 #define FS_NO_GLOBALS
 #include <FS.h>
 #include "log.h"
+#include "crc.h"
 
-#define BUFF_SIZE 128
+#define TAIL_RECORDS 8                          // Number of records read at once while scanning the log tail
 
 void wmlog::loadLog(byte *wm_list, byte num) {
-  resetData();
-  num_wm = num;
+  meters.clear();
   for (byte i = 0; i < num; ++i) {
-    wm_data[i]. ID = wm_list[i];
+    struct wm_log *w = meters.add(wm_list[i]);
+    if (w) w->ID = wm_list[i];
   }
 
-  currentKey = ""; currentID  = 0;
-  end_record = false;
-  JsonStreamingParser parser;
-  parser.setListener(this);
-  
-  byte buff[BUFF_SIZE];
-
-  String log_file = logName();
-  fs::File wml = SPIFFS.open(log_file, "r");
+  time_t n = hal.clock();
+  fs::File wml = hal.fileSystem().open(logName(n), "r");
   if (!wml) {
-    log_file = logName(true);                   // Try to load log file for the last month
-    wml = SPIFFS.open(log_file, "r");
+    wml = hal.fileSystem().open(logName(n - 86400 * 31), "r");  // Try to load log file for the last month
     if (!wml)
       return;
   }
-  long last = wml.size();
-  if (last > tail_bytes) {                      // Read tail of the long log
-    wml.seek(last-tail_bytes, fs::SeekSet);
-    last = tail_bytes;
-  }
-  
-  bool isBody = false;                          // Looking for the first '{' to start parsing
-  while(last > 0) {
-    int rb = last;
-    if (rb > BUFF_SIZE) rb = BUFF_SIZE;
-    rb = wml.read(buff, rb);
-    if (!rb) {
-      wml.close();
-      return;
-    }
-    last -= rb;
-    for (byte i = 0; i < rb; ++i) {
-      char c = buff[i];
-      if (!isBody && (c == '{')) {
-        isBody = true;
-      }
-      if (isBody) {
-        if (end_record) {                       // This variable is set in endDocument() callback
-          parser.reset();                       // Start reading new record
-          end_record = false;
-        }
-        parser.parse(c);
+
+  struct log_header hdr;
+  if (readHeader(wml, hdr)) {
+    byte found = 0;
+    for (byte i = 0; i < LOG_INDEX_SIZE; ++i) { // Load the last records from the index
+      struct log_record &rec = hdr.index[i];
+      if (rec.ID == 0 || !validRecord(rec)) continue;
+      struct wm_log *w = meters.find(rec.ID);
+      if (w) {
+        w->ts    = rec.ts;
+        w->cold  = rec.cold;
+        w->hot   = rec.hot;
+        ++found;
       }
     }
+    if (found < meters.size())                         // Some controllers are missing in the index
+      scanTail(wml, sizeof(struct log_header));
   }
   wml.close();
 
-  for (byte i = 0; i < num_wm; ++i) {           // Calculate next log time
-    next[i] = nextLogTime(wm_data[i].ts);
+  for (byte i = 0; i < meters.size(); ++i) {    // Calculate next log time
+    meters.at(i).next = nextLogTime(meters.at(i).ts);
+  }
+}
+
+// Read the log records from the end of the file back to find the last data of the controllers not loaded yet
+void wmlog::scanTail(fs::File& wml, uint32_t start) {
+  struct log_record rec[TAIL_RECORDS];
+  uint32_t records = (wml.size() - start) / sizeof(struct log_record);
+  uint32_t scanned = 0;
+  while (records > 0 && scanned < tail_records) {
+    byte n = TAIL_RECORDS;
+    if (n > records) n = records;
+    records -= n;
+    wml.seek(start + records * sizeof(struct log_record), fs::SeekSet);
+    if (wml.read((byte *)rec, n * sizeof(struct log_record)) != n * sizeof(struct log_record))
+      return;
+    for (char i = n-1; i >= 0; --i) {           // The latest record first
+      if (!validRecord(rec[byte(i)])) continue;
+      struct wm_log *w = meters.find(rec[byte(i)].ID);
+      if (w && w->ts == 0) {
+        w->ts    = rec[byte(i)].ts;
+        w->cold  = rec[byte(i)].cold;
+        w->hot   = rec[byte(i)].hot;
+      }
+    }
+    scanned += n;
   }
 }
 
 bool wmlog::data(byte ID, uint32_t& cold, uint32_t& hot, time_t& ts) {
-  byte i = index(ID);
-  if ((i < MAX_WM) && (wm_data[i].ts)) {
-    cold  = wm_data[i].cold;
-    hot   = wm_data[i].hot;
-    ts    = wm_data[i].ts;
+  struct wm_log *w = meters.find(ID);
+  if (w && w->ts) {
+    cold  = w->cold;
+    hot   = w->hot;
+    ts    = w->ts;
     return true;
   }
   return false;
 }
 
 void wmlog::log(byte ID, uint32_t cold, uint32_t hot) {
-  byte indx = index(ID);
-  if (indx >= MAX_WM) return;
-  time_t n = now();
+  struct wm_log *w = meters.find(ID);
+  if (!w) return;
+  time_t n = hal.clock();
+  rollup.update(ID, cold, hot, n);
   bool do_write = false;                        // Write new log entry only if some counter has been changed
-  if (n >= next[indx]) {                        // It is time to write the log
+  if (n >= w->next) {                        // It is time to write the log
     do_write = true;
   }
-  if (abs(cold - wm_data[indx].cold) >= matters) {
-    wm_data[indx].cold = cold;
+  if (abs(cold - w->cold) >= matters) {
     do_write = true;
   }
-  if (abs(hot - wm_data[indx].hot) >= matters)  {
-    wm_data[indx].hot  = hot;
+  if (abs(hot - w->hot) >= matters)  {
     do_write = true;
   }
   if (do_write) {
-    wm_data[indx].ts   = n;
-    next[indx]         = nextLogTime(n);
-    String log_file = logName(); 
-    fs::File wml = SPIFFS.open(log_file, "a");
-    if (!wml) return;
-
-    wml.print("{ \"ID\": \""); wml.print(ID, DEC); wml.print("\", \"ts\": \"");
-    wml.print(n, DEC); wml.print("\", \"cold\": \""); wml.print(cold, DEC);
-    wml.print("\", \"hot\": \""); wml.print(hot, DEC);
-    wml.print("\" }\n");
+    w->cold = cold;
+    w->hot  = hot;
+    w->ts   = n;
+    w->next = nextLogTime(n);
+    struct log_record rec;
+    rec.ts    = n;
+    rec.cold  = cold;
+    rec.hot   = hot;
+    rec.ID    = ID;
+    sealRecord(rec);
+    append(rec);
+  }
+}
+
+void wmlog::append(const struct log_record& rec) {
+  if (pending_num >= LOG_BUFFER_SIZE)
+    flush();
+  if (pending_num == 0)
+    pending_ms = hal.ms();
+  memcpy(&pending_rec[pending_num++], &rec, sizeof(struct log_record));
+  if (pending_num >= LOG_BUFFER_SIZE)
+    flush();
+}
+
+// The rollups are not updated, they have got the newer data already
+bool wmlog::merge(byte ID, uint32_t cold, uint32_t hot, time_t ts) {
+  struct wm_log *w = meters.find(ID);
+  if (!w || ts <= 0 || ts > hal.clock()) return false;
+  struct log_record rec;
+  rec.ts    = ts;
+  rec.cold  = cold;
+  rec.hot   = hot;
+  rec.ID    = ID;
+  sealRecord(rec);
+  if (ts > w->ts) {                             // Newer than the last record of the controller
+    if (w->ts && (cold == w->cold && hot == w->hot)) return false;
+    if (w->ts && (cold < w->cold || hot < w->hot)) return false;
+    w->cold = cold;
+    w->hot  = hot;
+    w->ts   = ts;
+    w->next = nextLogTime(ts);
+    append(rec);
+    return true;
+  }
+  flush();                                      // The newer records should be in the file
+  return insertRecord(rec);
+}
+
+/*
+ * Insert the record into the monthly log file before the records with greater timestamp. Only the tail of the file
+ * is scanned, the older record is skipped. The record is skipped also if the previous or the next record
+ * of the controller has the same data, or the data does not fit between them.
+ */
+bool wmlog::insertRecord(const struct log_record& rec) {
+  struct log_header hdr;
+  fs::File wml = openLog(logName(rec.ts), hdr);
+  if (!wml) return false;
+  const uint32_t start = sizeof(struct log_header);
+  struct log_record buff[TAIL_RECORDS];
+  uint32_t total   = (wml.size() - start) / sizeof(struct log_record);
+  uint32_t records = total;
+  uint32_t pos     = total;                     // The position to insert the record at
+  bool     pos_found = false;
+  struct   log_record *prev = 0, *next = 0;
+  struct   log_record prev_rec, next_rec;
+  uint32_t scanned = 0;
+  while (records > 0 && scanned < tail_records && !prev) {
+    byte n = TAIL_RECORDS;
+    if (n > records) n = records;
+    records -= n;
+    wml.seek(start + records * sizeof(struct log_record), fs::SeekSet);
+    if (wml.read((byte *)buff, n * sizeof(struct log_record)) != n * sizeof(struct log_record)) {
+      wml.close();
+      return false;
+    }
+    for (char i = n-1; i >= 0; --i) {           // The latest record first
+      struct log_record &r = buff[byte(i)];
+      if (!validRecord(r)) continue;
+      if (!pos_found && r.ts > rec.ts) {
+        pos = records + i;
+        if (r.ID == rec.ID) {
+          next_rec = r;
+          next = &next_rec;
+        }
+        continue;
+      }
+      pos_found = true;
+      if (r.ID == rec.ID) {
+        prev_rec = r;
+        prev = &prev_rec;
+        break;
+      }
+    }
+    scanned += n;
+  }
+  bool fit = pos_found || records == 0;         // The insert position is within the tail scanned
+  if (prev && (rec.cold < prev->cold || rec.hot < prev->hot || (rec.cold == prev->cold && rec.hot == prev->hot)))
+    fit = false;
+  if (next && (rec.cold > next->cold || rec.hot > next->hot || (rec.cold == next->cold && rec.hot == next->hot)))
+    fit = false;
+  if (!fit) {
+    wml.close();
+    return false;
+  }
+
+  uint32_t end = total;                         // Move the newer records by one from the end of the file
+  while (end > pos) {
+    byte n = TAIL_RECORDS;
+    if (n > end - pos) n = end - pos;
+    end -= n;
+    wml.seek(start + end * sizeof(struct log_record), fs::SeekSet);
+    wml.read((byte *)buff, n * sizeof(struct log_record));
+    wml.seek(start + (end + 1) * sizeof(struct log_record), fs::SeekSet);
+    bytes_written += wml.write((byte *)buff, n * sizeof(struct log_record));
+  }
+  wml.seek(start + pos * sizeof(struct log_record), fs::SeekSet);
+  bytes_written += wml.write((const byte *)&rec, sizeof(struct log_record));
+  if (indexRecord(hdr, rec) < LOG_INDEX_SIZE) {
+    wml.seek(offsetof(struct log_header, index), fs::SeekSet);
+    bytes_written += wml.write((byte *)hdr.index, sizeof(hdr.index));
+  }
+  wml.close();
+  return true;
+}
+
+void wmlog::run(void) {
+  if (pending_num && (hal.ms() - pending_ms >= uint32_t(durability) * 1000))
+    flush();
+}
+
+// Append the buffered records to the log files, one write per file, and update the file indexes
+void wmlog::flush(void) {
+  rollup.flush();
+  if (pending_num == 0) return;
+  uint32_t started = hal.ms();
+  byte i = 0;
+  while (i < pending_num) {
+    time_t ts = pending_rec[i].ts;
+    byte j = i + 1;                             // Records [i, j) belong to the same monthly file
+    while (j < pending_num && year(pending_rec[j].ts) == year(ts) && month(pending_rec[j].ts) == month(ts))
+      ++j;
+    struct log_header hdr;
+    fs::File wml = openLog(logName(ts), hdr);
+    if (wml) {
+      wml.seek(0, fs::SeekEnd);
+      bytes_written += wml.write((byte *)&pending_rec[i], (j - i) * sizeof(struct log_record));
+      bool update_index = false;
+      for (byte k = i; k < j; ++k) {
+        if (indexRecord(hdr, pending_rec[k]) < LOG_INDEX_SIZE)
+          update_index = true;
+      }
+      if (update_index) {                       // Update the index in place
+        wml.seek(offsetof(struct log_header, index), fs::SeekSet);
+        bytes_written += wml.write((byte *)hdr.index, sizeof(hdr.index));
+      }
+      wml.close();
+    }
+    i = j;
+  }
+  pending_num = 0;
+  ++flushes;
+  flush_ms = hal.ms() - started;
+  if (flush_ms > max_flush_ms) max_flush_ms = flush_ms;
+}
+
+// Open the log file for update, create new one if the file does not exist
+fs::File wmlog::openLog(const String& log_file, struct log_header& hdr) {
+  fs::File wml = hal.fileSystem().open(log_file, "r+");
+  if (wml) {
+    if (readHeader(wml, hdr)) return wml;
+    if (wml.size() >= sizeof(struct log_header)) {  // The header is corrupted, rebuild the index by new records
+      initHeader(hdr);
+      wml.seek(0, fs::SeekSet);
+      wml.write((byte *)&hdr, sizeof(struct log_header));
+      return wml;
+    }
     wml.close();
   }
+  wml = hal.fileSystem().open(log_file, "w+");
+  if (wml) {
+    initHeader(hdr);
+    wml.write((byte *)&hdr, sizeof(struct log_header));
+  }
+  return wml;
+}
+
+bool wmlog::readHeader(fs::File& wml, struct log_header& hdr) {
+  wml.seek(0, fs::SeekSet);
+  if (wml.read((byte *)&hdr, sizeof(struct log_header)) != sizeof(struct log_header))
+    return false;
+  return (hdr.magic == log_magic && hdr.version == log_version && hdr.index_size == LOG_INDEX_SIZE
+          && hdr.record_size == sizeof(struct log_record));
+}
+
+void wmlog::initHeader(struct log_header& hdr) {
+  memset(&hdr, 0, sizeof(struct log_header));
+  hdr.magic       = log_magic;
+  hdr.version     = log_version;
+  hdr.index_size  = LOG_INDEX_SIZE;
+  hdr.record_size = sizeof(struct log_record);
+}
+
+// Put the record into the header index if it is newer than indexed one. Returns the index entry number updated
+byte wmlog::indexRecord(struct log_header& hdr, const struct log_record& rec) {
+  byte empty = LOG_INDEX_SIZE;
+  for (byte i = 0; i < LOG_INDEX_SIZE; ++i) {
+    if (hdr.index[i].ID == rec.ID) {
+      if (validRecord(hdr.index[i]) && hdr.index[i].ts > rec.ts)
+        return LOG_INDEX_SIZE;                  // The index has newer data
+      memcpy(&hdr.index[i], &rec, sizeof(struct log_record));
+      return i;
+    }
+    if (hdr.index[i].ID == 0 && empty == LOG_INDEX_SIZE)
+      empty = i;
+  }
+  if (empty < LOG_INDEX_SIZE)
+    memcpy(&hdr.index[empty], &rec, sizeof(struct log_record));
+  return empty;
+}
+
+bool wmlog::validRecord(const struct log_record& rec) {
+  return rec.ID && rec.crc == crc16(&rec, sizeof(struct log_record) - sizeof(uint16_t));
+}
+
+void wmlog::sealRecord(struct log_record& rec) {
+  rec.reserved = 0;
+  rec.crc = crc16(&rec, sizeof(struct log_record) - sizeof(uint16_t));
 }
 
 void wmlog::removeOldLog(time_t ts) {
-  fs::Dir dir = SPIFFS.openDir("/");
+  fs::Dir dir = hal.fileSystem().openDir("/");
   while (dir.next()) {
     String fn = dir.fileName();
     if (fn.indexOf("/wmlog") == 0) {          // Found the log file
@@ -124,61 +344,281 @@ void wmlog::removeOldLog(time_t ts) {
         tm.Second = 0;
         time_t file_ts = makeTime(tm);
         if (file_ts < ts) {                   // This file should be deleted
-          SPIFFS.remove(fn);
+          hal.fileSystem().remove(fn);
         }
       }
     }
   }
 }
 
-void wmlog::resetData(void) {
-  for (byte i = 0; i < MAX_WM; ++i) {
-    wm_data[i].ts     = 0;
-    wm_data[i].cold   = 0;
-    wm_data[i].hot    = 0;
-    wm_data[i].ID     = 0;
-    next[i]           = 0;
+void wmlog::convertLogs(void) {
+  for (byte attempt = 0; attempt < 36; ++attempt) {  // Limit the number of files converted in case of file system errors
+    String json_name = "";
+    String tmp_name  = "";
+    fs::Dir dir = hal.fileSystem().openDir("/");
+    while (dir.next()) {
+      String fn = dir.fileName();
+      if (fn.indexOf("/wmlog_") != 0) continue;
+      if (fn.indexOf(".tmp") > 0) {
+        tmp_name = fn;
+        break;
+      }
+      if (fn.indexOf(".log") > 0 && json_name.length() == 0)
+        json_name = fn;
+    }
+    if (tmp_name.length() > 0) {                // The conversion was interrupted
+      String base = tmp_name.substring(0, tmp_name.indexOf(".tmp"));
+      if (hal.fileSystem().exists(base + ".log")) {
+        hal.fileSystem().remove(tmp_name);      // The json log is still there, convert it again
+      } else {
+        replaceLog(tmp_name, base + ".bin");    // The json log has been removed, the converted log is complete
+      }
+      continue;
+    }
+    if (json_name.length() == 0) return;        // Nothing to convert
+    convertLog(json_name);
+  }
+}
+
+/*
+ * Convert the json log file to the binary log file with the same name and .bin extension. The json records
+ * are written into the temporary file followed by the records of the binary log if it exists already.
+ * When the temporary file is complete, the json log is removed and the temporary file replaces the binary log.
+ * The conversion interrupted before the json log is removed is done again from the beginning, the one interrupted
+ * after that is finished by convertLogs(), so the records are never duplicated.
+ */
+bool wmlog::convertLog(const String& json_name) {
+  fs::File jsl = hal.fileSystem().open(json_name, "r");
+  if (!jsl) return false;
+  String base     = json_name.substring(0, json_name.indexOf(".log"));
+  String bin_name = base + ".bin";
+  String tmp_name = base + ".tmp";
+  struct log_header hdr;
+  hal.fileSystem().remove(tmp_name);
+  fs::File wml = openLog(tmp_name, hdr);
+  if (!wml) {
+    jsl.close();
+    return false;
+  }
+  wml.seek(0, fs::SeekEnd);
+
+  memset(&conv_rec, 0, sizeof(struct log_record));
+  conv_log = &wml;
+  conv_hdr = &hdr;
+  jsonParser parser(this);                      // The records are written in jsonEndObject()
+  bool ok = parser.parseFile(jsl);
+  jsl.close();
+  ok = ok && copyRecords(wml, hdr, bin_name);   // The binary log is newer than the json one
+  wml.seek(0, fs::SeekSet);                     // Save the index
+  ok = ok && (wml.write((byte *)&hdr, sizeof(struct log_header)) == sizeof(struct log_header));
+  wml.close();
+  if (!ok) {
+    hal.fileSystem().remove(tmp_name);
+    return false;
+  }
+  hal.fileSystem().remove(json_name);
+  return replaceLog(tmp_name, bin_name);
+}
+
+// Append the records of the log file to the end of the open log file, update its index
+bool wmlog::copyRecords(fs::File& wml, struct log_header& hdr, const String& log_file) {
+  fs::File src = hal.fileSystem().open(log_file, "r");
+  if (!src) return true;                        // Nothing to copy
+  struct log_header src_hdr;
+  if (!readHeader(src, src_hdr)) {
+    src.close();
+    return true;
+  }
+  struct log_record buff[TAIL_RECORDS];
+  bool ok = true;
+  while (ok) {
+    int rb = src.read((byte *)buff, sizeof(buff));
+    byte n = (rb > 0)?rb / sizeof(struct log_record):0;
+    if (n == 0) break;
+    ok = (wml.write((byte *)buff, n * sizeof(struct log_record)) == n * sizeof(struct log_record));
+    for (byte i = 0; i < n; ++i) {
+      if (validRecord(buff[i])) indexRecord(hdr, buff[i]);
+    }
+  }
+  src.close();
+  return ok;
+}
+
+// Replace the log file by the new one
+bool wmlog::replaceLog(const String& new_file, const String& log_file) {
+  hal.fileSystem().remove(log_file);
+  return hal.fileSystem().rename(new_file, log_file);
+}
+
+//------------------------------------------ log range query ---------------------------------------------------
+static time_t monthStart(time_t ts) {
+  tmElements_t tm;
+  breakTime(ts, tm);
+  tm.Day    = 1;
+  tm.Hour   = 0;
+  tm.Minute = 0;
+  tm.Second = 0;
+  return makeTime(tm);
+}
+
+logQuery::logQuery(wmRollup& roll, byte wm_ID, time_t from_ts, time_t to_ts, uint32_t step_sec) : rollup(roll) {
+  ID    = wm_ID;
+  from  = from_ts;
+  to    = to_ts;
+  step  = step_sec;
+  if (step == 0) step = 86400;
+  buff_len = buff_pos = 0;
+  have_bucket = have_prev = false;
+  month_ts = monthStart(from);
+  tier       = rollup.queryTier(from, step);
+  period_ts  = from;
+  period_end = to;
+  struct log_record rec;
+  if (tier < wmRollup::RT_NUM && rollup.read(ID, tier, rollup.prevPeriod(tier, from), rec)) {
+    prev_cold = rec.cold;                       // The consumption of the first step is known
+    prev_hot  = rec.hot;
+    have_prev = true;
   }
 }
 
-byte wmlog::index(byte ID) {
-  for (byte i = 0; i < MAX_WM; ++i) {
-    if (wm_data[i].ID == ID) return i;
+bool logQuery::next(struct log_bucket& bucket) {
+  struct log_record rec;
+  while (readRecord(rec)) {
+    time_t bts = from + ((rec.ts - from) / step) * step;
+    if (have_bucket && bts == cur.ts) {         // The same bucket
+      cur.cold = rec.cold;
+      cur.hot  = rec.hot;
+      ++cur.records;
+      continue;
+    }
+    if (have_bucket) {
+      closeBucket(bucket);
+      startBucket(rec, bts);
+      return true;
+    }
+    startBucket(rec, bts);
+  }
+  if (have_bucket) {                            // The last bucket in the range
+    closeBucket(bucket);
+    return true;
   }
-  return MAX_WM;
+  return false;
+}
+
+void logQuery::startBucket(const struct log_record& rec, time_t bts) {
+  cur.ts      = bts;
+  cur.cold    = first_cold = rec.cold;
+  cur.hot     = first_hot  = rec.hot;
+  cur.records = 1;
+  have_bucket = true;
 }
 
-String wmlog::logName(bool previous) {
-  time_t n = now();
-  if (previous)
-    n -= 60 * 60 * 3600 * 31;                   // 31 days ago, last month
-  String y = String(year(n));
-  String m = String(month(n));
-  return "/wmlog_" + y + "-" + m + ".log";
+void logQuery::closeBucket(struct log_bucket& bucket) {
+  uint32_t base_cold = (have_prev)?prev_cold:first_cold;
+  uint32_t base_hot  = (have_prev)?prev_hot:first_hot;
+  cur.used_cold = (cur.cold > base_cold)?cur.cold - base_cold:0;
+  cur.used_hot  = (cur.hot  > base_hot)?cur.hot - base_hot:0;
+  memcpy(&bucket, &cur, sizeof(struct log_bucket));
+  prev_cold   = cur.cold;
+  prev_hot    = cur.hot;
+  have_prev   = true;
+  have_bucket = false;
+}
+
+// Read next valid record of the controller in the range
+bool logQuery::readRecord(struct log_record& rec) {
+  while (true) {
+    if (tier < wmRollup::RT_NUM) {
+      if (readRollup(rec)) return true;
+      if (period_end >= to) return false;
+      tier = wmRollup::RT_NUM;                  // The month without the log file is over, continue with the log
+    }
+    if (buff_pos >= buff_len) {
+      if (!lf && !openNext()) {
+        if (tier < wmRollup::RT_NUM) continue;  // The log file has been removed, read the rollups of the month
+        return false;
+      }
+      int rb = lf.read((byte *)buff, sizeof(buff));
+      buff_len = rb / sizeof(struct log_record);
+      buff_pos = 0;
+      if (buff_len == 0) {                      // End of the file, switch to the next month
+        lf.close();
+        lf = fs::File();
+        continue;
+      }
+    }
+    struct log_record &r = buff[buff_pos++];
+    if (r.ID == ID && r.ts >= uint32_t(from) && r.ts < uint32_t(to) && wmlog::validRecord(r)) {
+      memcpy(&rec, &r, sizeof(struct log_record));
+      return true;
+    }
+  }
 }
 
-void wmlog::value(String value) {
-  if (currentKey == "ID") {
-    currentID = value.toInt();
-  } else
-  if (currentKey == "ts") {
-    byte indx = index(currentID);
-    if (indx < MAX_WM) {
-      wm_data[indx].ts = value.toInt();
-      time_t ts = wm_data[indx].ts;
-    } 
-  } else
-  if (currentKey == "cold") {
-    byte indx = index(currentID);
-    if (indx < MAX_WM) {
-      wm_data[indx].cold = value.toInt();
+// Read next rollup record of the controller in the range, the missing periods are skipped
+bool logQuery::readRollup(struct log_record& rec) {
+  while (period_ts < period_end) {
+    time_t p  = period_ts;
+    period_ts = rollup.nextPeriod(tier, p);
+    if (rollup.read(ID, tier, p, rec)) {
+      if (rec.ts < uint32_t(from)) rec.ts = from;  // The period started before the range
+      return true;
     }
-  } else
-  if (currentKey == "hot") {
-    byte indx = index(currentID);
-    if (indx < MAX_WM) {
-      wm_data[indx].hot = value.toInt();
+  }
+  return false;
+}
+
+/*
+ * Open the next monthly log file in the range. If the log file of the month does not exist, the rollup tier
+ * the month can be read from is set and false is returned.
+ */
+bool logQuery::openNext(void) {
+  while (month_ts < to) {
+    time_t start = (month_ts > from)?month_ts:from;
+    String fn = wmlog::logName(month_ts);
+    month_ts  = monthStart(month_ts + 32 * 86400);
+    lf = hal.fileSystem().open(fn, "r");
+    if (lf) {
+      lf.seek(sizeof(struct log_header), fs::SeekSet);
+      return true;
     }
+    if (rollup.keeps(wmRollup::RT_DAY, start))
+      tier = wmRollup::RT_DAY;
+    else
+    if (rollup.keeps(wmRollup::RT_MONTH, start))
+      tier = wmRollup::RT_MONTH;
+    else
+      continue;
+    period_ts  = rollup.periodStart(tier, start);
+    period_end = (month_ts < to)?month_ts:to;
+    return false;
+  }
+  return false;
+}
+
+String wmlog::logName(time_t ts) {
+  String y = String(year(ts));
+  String m = String(month(ts));
+  return "/wmlog_" + y + "-" + m + ".bin";
+}
+
+void wmlog::jsonValue(uint32_t parent, uint32_t key, const char* value) {
+  switch (key) {
+    case jsonKey("ID"):   conv_rec.ID   = atol(value); break;
+    case jsonKey("ts"):   conv_rec.ts   = atol(value); break;
+    case jsonKey("cold"): conv_rec.cold = atol(value); break;
+    case jsonKey("hot"):  conv_rec.hot  = atol(value); break;
+    default: break;
+  }
+}
+
+// The json log record is complete, write it to the binary log
+void wmlog::jsonEndObject(uint32_t parent, byte depth) {
+  if (depth != 0) return;
+  if (conv_rec.ID && conv_rec.ts) {
+    sealRecord(conv_rec);
+    conv_log->write((byte *)&conv_rec, sizeof(struct log_record));
+    indexRecord(*conv_hdr, conv_rec);
   }
+  memset(&conv_rec, 0, sizeof(struct log_record));
 }
-
@@ -2,56 +2,168 @@
 #define WM_log_h
 
 /*
- * Logging the Water Meter counters data using json syntax in the following form:
+ * Logging the Water Meter counters data into the monthly binary files /wmlog_<year>-<month>.bin
+ * The file starts with the header followed by the fixed size records. The header contains the index:
+ * the copy of the last record of each water meter controller, so the last data can be loaded by single read.
+ * If the controller is missing in the index, the tail of the log is scanned.
+ *
+ * The old log files /wmlog_<year>-<month>.log with json records in the following form:
  * { "ID": "<Controller ID>", "ts": "<unixtime>", "cold": "<cold counter data>", "hot": "<hot counter data>" }
+ * are converted to the binary format by convertLogs() through the temporary file /wmlog_<year>-<month>.tmp
+ *
+ * The new records are collected in the RAM buffer and written to the file at once when the buffer is full,
+ * when the oldest record is kept longer than the durability window or when flush() is called explicitly.
+ *
+ * The old readings received from the controller after the receiver was down are merged into the log by merge():
+ * the record is inserted before the newer records of the log file, so the log is kept in the timestamp order.
+ * The record is skipped if the log already has the same data of the controller.
  *
+ * Every reading is also aggregated into the hourly, daily and monthly rollups (see rollup.h), those keep the history
+ * after the old log files have been removed.
  */
- 
+
 #include <TimeLib.h>
-#include <Wire.h>
-#include <JsonListener.h>
-#include <JsonStreamingParser.h>
 #include "config.h"
+#include "rollup.h"
+#include "registry.h"
+
+#define LOG_INDEX_SIZE 16                       // The number of controllers in the log file index
+#define LOG_BUFFER_SIZE 16                      // The number of records kept in RAM before writing to the log file
 
 struct wm_log {
   time_t    ts;
   uint32_t  cold;
   uint32_t  hot;
   byte      ID;
+  time_t    next;                               // Next time the log record should be written
+};
+
+struct log_record {                             // The log file record, 16 bytes
+  uint32_t  ts;
+  uint32_t  cold;
+  uint32_t  hot;
+  byte      ID;
+  byte      reserved;
+  uint16_t  crc;                                // CRC16 of the previous fields
+};
+
+struct log_header {                             // The log file header
+  uint32_t  magic;
+  byte      version;
+  byte      index_size;
+  uint16_t  record_size;
+  struct    log_record index[LOG_INDEX_SIZE];   // The last record of each controller, ID == 0 means empty entry
 };
 
+const uint32_t log_magic   = 0x474C4D57;        // "WMLG"
+const byte     log_version = 1;
+
 //------------------------------------------ water meter controller log data -----------------------------------
-class wmlog : public JsonListener {
+class wmlog : public jsonHandler {
   public:
-    wmlog()                                     { }
+    wmlog() : meters(MAX_WM)                    { pending_num = 0; durability = 300; flushes = bytes_written = 0; flush_ms = max_flush_ms = 0; rollup.init(); }
     void      loadLog(byte *wm_list, byte num);
     bool      data(byte ID, uint32_t& cold, uint32_t& hot, time_t& ts);
     void      log(byte ID, uint32_t cold, uint32_t hot);
+    bool      merge(byte ID, uint32_t cold, uint32_t hot, time_t ts);  // Add the old reading, returns true if written
+    void      run(void);                        // Should be called from the loop(), writes the buffer when it is too old
+    void      flush(void);                      // Write the buffered records to the log files
+    void      setDurability(uint16_t sec)       { durability = sec; }
+    wmRollup& rollups(void)                     { return rollup; }
+    uint16_t  durabilityWindow(void)            { return durability; }
+    byte      pending(void)                     { return pending_num; }
+    uint32_t  flushCount(void)                  { return flushes; }
+    uint32_t  bytesWritten(void)                { return bytes_written; }
+    uint32_t  lastFlushTime(void)               { return flush_ms; }
+    uint32_t  maxFlushTime(void)                { return max_flush_ms; }
     void      removeOldLog(time_t ts);
-    virtual   void key(String key)              { currentKey = String(key); }
-    virtual   void endObject()                  { }
-    virtual   void startObject()                { }
-    virtual   void whitespace(char c)           { }
-    virtual   void startDocument()              { }
-    virtual   void endArray()                   { }
-    virtual   void endDocument()                { end_record = true; }
-    virtual   void startArray()                 { }
-    virtual   void value(String value);    
-
-  private: 
+    void      convertLogs(void);                // Convert the old json log files to the binary format
+    static    bool isLogFile(const String& fn)  { return fn.indexOf("/wmlog_") == 0 && fn.indexOf(".bin") > 0; }
+    static    bool validRecord(const struct log_record& rec);
+    static    void sealRecord(struct log_record& rec);
+    static    String logName(time_t ts);        // The log file name for the month the time ts belongs to
+    virtual   void jsonValue(uint32_t parent, uint32_t key, const char* value);
+    virtual   void jsonEndObject(uint32_t parent, byte depth);
+
+  private:
     time_t  nextLogTime(time_t ts)              { return ts - (ts % period) + period; }
-    String  logName(bool previous = false);
-    void    resetData(void);
-    byte    index(byte ID);
-    byte    num_wm;
-    struct  wm_log    wm_data[MAX_WM];
-    time_t  next[MAX_WM];
-    String  currentKey;
-    byte    currentID;
-    bool    end_record;
-    const   int tail_bytes = 600;               // Maximum number of bytes to be loaded from the tail of the log
+    fs::File openLog(const String& log_file, struct log_header& hdr);
+    bool    readHeader(fs::File& wml, struct log_header& hdr);
+    void    initHeader(struct log_header& hdr);
+    byte    indexRecord(struct log_header& hdr, const struct log_record& rec);
+    void    scanTail(fs::File& wml, uint32_t start);
+    void    append(const struct log_record& rec);  // Put the record into the RAM buffer
+    bool    insertRecord(const struct log_record& rec);
+    bool    convertLog(const String& json_name);
+    bool    copyRecords(fs::File& wml, struct log_header& hdr, const String& log_file);
+    bool    replaceLog(const String& new_file, const String& log_file);
+    wmRegistry<struct wm_log> meters;           // The last logged data of the controllers
+    struct  log_record conv_rec;                // The record being read from the json log
+    fs::File *conv_log;                         // The binary log the json log is converted to
+    struct  log_header *conv_hdr;               // Its header
+    wmRollup rollup;                            // Hourly, daily and monthly data
+    struct  log_record pending_rec[LOG_BUFFER_SIZE];  // The records to be written to the log
+    byte    pending_num;                        // Number of the records in the buffer
+    uint32_t pending_ms;                        // The time the oldest record was put into the buffer, ms
+    uint16_t durability;                        // The maximum time to keep the record in the buffer, seconds
+    uint32_t flushes;                           // Number of the buffer writes
+    uint32_t bytes_written;                     // Number of bytes written to the log files
+    uint32_t flush_ms;                          // The last buffer write time, ms
+    uint32_t max_flush_ms;                      // The longest buffer write time, ms
+    const   uint16_t tail_records = 64;         // Maximum number of records to be scanned from the tail of the log
     const   time_t period = 86400;              // Period data log, seconds
     const   uint16_t matters = 10;              // Minimal data change for logging
 };
 
-#endif
+struct log_bucket {                             // The log data aggregated for the query step
+  time_t    ts;                                 // The beginning of the step
+  uint32_t  cold;                               // The last counter values in the step
+  uint32_t  hot;
+  uint32_t  used_cold;                          // The consumption in the step
+  uint32_t  used_hot;
+  uint16_t  records;                            // Number of the log records in the step
+};
+
+/*
+ * The range query over the monthly log files. Reads the log records of one controller by small fixed buffer
+ * and aggregates them per step, so the memory used does not depend on the range size.
+ * If the step is the whole number of days or hours from the beginning of the day or hour, the query reads one
+ * rollup record per period instead of all the log records (see wmRollup::queryTier()).
+ * The months those log files have been removed are read from the daily rollups or, if they are older than
+ * the daily rollups keep, from the monthly rollups.
+ */
+//------------------------------------------ log range query ---------------------------------------------------
+class logQuery {
+  public:
+    logQuery(wmRollup& roll, byte wm_ID, time_t from_ts, time_t to_ts, uint32_t step_sec);
+    ~logQuery()                                 { if (lf) lf.close(); }
+    bool      next(struct log_bucket& bucket);  // Get next bucket in the range, returns false at the end
+  private:
+    bool      readRecord(struct log_record& rec);
+    bool      readRollup(struct log_record& rec);
+    bool      openNext(void);
+    void      startBucket(const struct log_record& rec, time_t bts);
+    void      closeBucket(struct log_bucket& bucket);
+    byte      ID;
+    time_t    from;
+    time_t    to;
+    uint32_t  step;
+    wmRollup& rollup;
+    wmRollup::TIER tier;                        // The rollup tier the data is read from, RT_NUM to read the log
+    time_t    period_ts;                        // The next rollup period to be read
+    time_t    period_end;                       // The end of the range read from the rollups
+    time_t    month_ts;                         // The next monthly log file to be read
+    fs::File  lf;                               // The log file being read
+    struct    log_record buff[8];
+    byte      buff_len;
+    byte      buff_pos;
+    bool      have_bucket;                      // The current bucket has data
+    struct    log_bucket cur;
+    uint32_t  first_cold;                       // The first counter values in the current bucket
+    uint32_t  first_hot;
+    bool      have_prev;                        // The previous bucket exists
+    uint32_t  prev_cold;                        // The last counter values of the previous bucket
+    uint32_t  prev_hot;
+};
+
+#endif
@@ -1,10 +1,11 @@
 #define FS_NO_GLOBALS
 #include <FS.h>
 #include "mail.h"
-#include "web.h"
+#include "log.h"
 
 extern WMconfig          cfg;                   // Global variable, declared in wm_receiver_esp8266.ino
 extern WMpool            pool;                  // Global variable, declared in wm_receiver_esp8266.ino
+extern wmlog             data_log;              // Global variable, declared in wm_receiver_esp8266.ino
 
 /*
  * base64 encoder and decoder, http://www.cplusplus.com/forum/beginner/51572/
@@ -180,147 +181,247 @@ void mail::server(const String& srv, uint16_t port, bool ssl) {
   smtp_server = srv; smtp_port = port;
   if (secure == ssl) return;
   if (client) delete client;
+  client = 0;
   secure = ssl;
 }
 
-mail::ANSWER mail::send(const String& to, const String& message, const String& subject, const String& from) {  
+mail::ANSWER mail::send(const String& to, const String& message, const String& subject, const String& from) {
   if (((from.length() == 0) && (smtp_from.length() == 0)) || smtp_server.length() == 0)
     return MAIL_SERVER;
 
-  if (!client) {
-    if (secure) {
-      client = new WiFiClientSecure;
+  m_to      = to;
+  m_message = message;
+  m_subject = subject;
+  m_from    = (from.length() > 0)?from:smtp_from;
+  reply_len = 0;
+  for (byte i = 0; i < PH_NUM; ++i)
+    phase_ms[i] = 0;
+  ph          = PH_CONNECT;
+  phase_start = hal.ms();
+  return MAIL_BUSY;
+}
+
+mail::ANSWER mail::run(uint16_t budget) {
+  uint32_t started = hal.ms();
+  while (ph != PH_IDLE) {
+    if (ph == PH_CONNECT) {                     // The only blocking step, limited by the client timeout
+      if (!client) {
+        client = hal.newClient(secure);
+      }
+      if (!client->connect(smtp_server.c_str(), smtp_port)) {
+        return finish(MAIL_CONNECT);
+      }
+      next(PH_GREETING);
+    } else
+    if (ph == PH_BODY && !body_sent) {
+      if (!sendBody()) {                        // The TCP buffer is full, continue on the next call
+        if (hal.ms() - body_ms > step_timeout) {  // The server has taken nothing for too long
+          return finish(MAIL_SEND_ERROR);
+        }
+        return MAIL_BUSY;
+      }
+    } else
+    if (readReply()) {
+      ANSWER ans = reply();
+      if (ans != MAIL_BUSY) return ans;
     } else {
-      client = new WiFiClient;
+      if (hal.ms() - phase_start > step_timeout) {
+        return finish(phaseError(ph));
+      }
+      return MAIL_BUSY;                         // Nothing to do till the server answers
     }
+    if (hal.ms() - started >= budget) break;
   }
+  return MAIL_BUSY;
+}
 
-  if (!client->connect(smtp_server.c_str(), smtp_port)) {
-    return MAIL_CONNECT;
-  }
-  if (!expect("220")) {
-    return MAIL_NO_ANSWER;
+/*
+ * Send the next chunk of the message body or the end of data mark after the body. The client can take less bytes
+ * than given, when its buffer is full, so the position is advanced by the bytes written.
+ * Returns false if the chunk has not been written completely.
+ */
+bool mail::sendBody(void) {
+  uint16_t msg_len = m_message.length();
+  uint16_t end_len = sizeof(end_mark) - 1;
+  const uint8_t *p;
+  uint16_t len;
+  if (body_pos < msg_len) {
+    p   = (const uint8_t *)m_message.c_str() + body_pos;
+    len = msg_len - body_pos;
+    if (len > body_chunk) len = body_chunk;
+  } else {
+    p   = (const uint8_t *)end_mark + (body_pos - msg_len);
+    len = msg_len + end_len - body_pos;
   }
-  client->println("HELO there");
-  if (!expect("250")){
-    return MAIL_IDENT;
+  size_t written = client->write(p, len);
+  body_pos += written;
+  if (written > 0) body_ms = hal.ms();
+  if (body_pos >= msg_len + end_len)
+    body_sent = true;
+  return written == len;
+}
+
+// Process complete server reply in the current phase
+mail::ANSWER mail::reply(void) {
+  switch (ph) {
+    case PH_GREETING:
+      if (reply_code != 220) break;
+      client->println("HELO there");
+      next(PH_HELO);
+      return MAIL_BUSY;
+    case PH_HELO:
+      if (reply_code != 250) break;
+      if (auth_user.length() > 0 && auth_pass.length() > 0) {
+        client->println("AUTH LOGIN");
+        next(PH_AUTH);
+      } else {
+        client->println("MAIL FROM: <" + m_from + '>');
+        next(PH_FROM);
+      }
+      return MAIL_BUSY;
+    case PH_AUTH:
+      if (reply_code != 334) break;
+      client->println(base64::encode(auth_user));
+      next(PH_USER);
+      return MAIL_BUSY;
+    case PH_USER:
+      if (reply_code != 334) break;
+      client->println(base64::encode(auth_pass));
+      next(PH_PASS);
+      return MAIL_BUSY;
+    case PH_PASS:
+      if (reply_code != 235) break;
+      client->println("MAIL FROM: <" + m_from + '>');
+      next(PH_FROM);
+      return MAIL_BUSY;
+    case PH_FROM:
+      if (reply_code / 100 != 2) break;
+      client->println("RCPT TO: <" + m_to + '>');
+      next(PH_RCPT);
+      return MAIL_BUSY;
+    case PH_RCPT:
+      if (reply_code / 100 != 2) break;
+      client->println("DATA");
+      next(PH_DATA);
+      return MAIL_BUSY;
+    case PH_DATA:
+      if (reply_code != 354) break;
+      client->println("From: <" + m_from + '>');
+      client->println("To: <" + m_to + '>');
+      if (m_subject.length() > 0) {
+        client->print("Subject: ");
+        client->println(m_subject);
+      }
+      client->println("Mime-Version: 1.0");
+      client->println("Content-Type: text/html; charset=\"UTF-8\"");
+      client->println("Content-Transfer-Encoding: 8bit");
+      client->println();
+      body_pos  = 0;                            // The message body and the end mark are sent by parts in run()
+      body_sent = false;
+      body_ms   = hal.ms();
+      next(PH_BODY);
+      return MAIL_BUSY;
+    case PH_BODY:
+      if (reply_code != 250) break;
+      client->println("QUIT");
+      next(PH_QUIT);
+      return MAIL_BUSY;
+    case PH_QUIT:
+      if (reply_code != 221) break;
+      return finish(MAIL_OK);
+    default:
+      break;
   }
-  if (auth_user.length() > 0 && auth_pass.length() > 0) {
-    client->println("AUTH LOGIN");
-    expect();
-    client->println(base64::encode(auth_user));
-    expect();
-    client->println(base64::encode(auth_pass));
-    if (!expect("235")) {
-      return MAIL_AUTH;
+  return finish(phaseError(ph));
+}
+
+// Read the server reply without waiting. Returns true when the last line of the reply has been received
+bool mail::readReply(void) {
+  while (client->available()) {
+    char c = client->read();
+    if (c == '\r') continue;
+    if (c != '\n') {
+      if (reply_len < sizeof(reply_line) - 1)
+        reply_line[reply_len++] = c;
+      continue;
+    }
+    reply_line[reply_len] = '\0';
+    bool last = (reply_len < 4 || reply_line[3] != '-');  // The multi-line reply has '-' after the code
+    reply_len = 0;
+    if (last) {
+      reply_code = atoi(reply_line);
+      return true;
     }
   }
-  
-  String mailFrom = "MAIL FROM: <";
-  if (from.length() > 0) {
-    mailFrom += from + '>';
-  } else {
-    mailFrom += smtp_from + '>';
-  }
-  client->println(mailFrom);
-  expect();
+  return false;
+}
 
-  String rcpt = "RCPT TO: <" + to + '>';
-  client->println(rcpt);
-  expect();
+void mail::next(PHASE p) {
+  uint32_t n = hal.ms();
+  phase_ms[ph] = n - phase_start;
+  phase_start  = n;
+  ph           = p;
+}
 
-  client->println("DATA");
-  if (!expect("354")) {
-    return MAIL_DATA;
-  }
-  
-  client->print("From: <");
-  if (from.length() > 0) {
-    client->println(from + '>');
-  } else {
-    client->println(smtp_from + '>');
-  }
-  client->println("To: <" + to + '>');
-  if (subject.length() >0) {
-    client->print("Subject: ");
-    client->println(subject);
-  }
-  
-  client->println("Mime-Version: 1.0");
-  client->println("Content-Type: text/html; charset=\"UTF-8\"");
-  client->println("Content-Transfer-Encoding: 8bit");
-  client->println();
-  String body = "<!DOCTYPE html><html lang=\"ru\">" + message + "</html>";
-  client->println(message);
-  client->println(".");
-  if (!expect("250")) {
-    return MAIL_SEND_ERROR;
-  }
-  client->println("QUIT");
-  if (!expect("221")) {
-    return MAIL_DISCONNECT;
-  }
-  return MAIL_OK;
+mail::ANSWER mail::finish(ANSWER ans) {
+  next(PH_IDLE);
+  if (client) client->stop();
+  m_message = "";                               // Release the memory
+  return ans;
 }
 
-bool mail::expect(const String responce, uint16_t timeout) {
-  uint32_t ts = millis();
-  while (!client->available()) {
-    if (millis() > (ts + timeout)) {
-      return false;
-    }
+mail::ANSWER mail::phaseError(PHASE p) {
+  switch (p) {
+    case PH_CONNECT:  return MAIL_CONNECT;
+    case PH_GREETING: return MAIL_NO_ANSWER;
+    case PH_HELO:     return MAIL_IDENT;
+    case PH_AUTH:
+    case PH_USER:
+    case PH_PASS:     return MAIL_AUTH;
+    case PH_DATA:     return MAIL_DATA;
+    case PH_QUIT:     return MAIL_DISCONNECT;
+    default:          return MAIL_SEND_ERROR;
   }
-  String resp = client->readStringUntil('\n');
-  if (responce && resp.indexOf(responce) == -1)
-    return false;
-  return true;
 }
 
-#define BUFF_SIZE 128
+void mail::end(void) {
+  if (ph != PH_IDLE) finish(MAIL_DISCONNECT);
+  if (client) delete client;
+  client = 0;
+}
+
+String mail::report(void) {
+  String ret = "";
+  for (byte i = PH_CONNECT; i < PH_NUM; ++i) {
+    if (phase_ms[i] == 0) continue;
+    if (ret.length() > 0) ret += ", ";
+    ret += phase_name[i];
+    ret += ": ";
+    ret += String(phase_ms[i]);
+    ret += " ms";
+  }
+  return ret;
+}
 
 bool notifier::init(void) {
   warn_notify_sent = urgent_notify_sent = data_sent = 0;
 
-  JsonStreamingParser parser;
-  parser.setListener(this);
-  
-  byte buff[BUFF_SIZE];
-  fs::File cf = SPIFFS.open(cf_name, "r");
+  fs::File cf = hal.fileSystem().open(cf_name, "r");
   if (!cf) {
     calculateNextEvents();
     return false;
   }
-
-  int last = cf.size();
-  bool isBody = false;
-
-  while(last > 0) {
-    int rb = last;
-    if (rb > BUFF_SIZE) rb = BUFF_SIZE;
-    rb = cf.read(buff, rb);
-    if (!rb) {
-      cf.close();
-      return false;
-    }
-    last -= rb;
-    for (byte i = 0; i < rb; ++i) {
-      char c = buff[i];
-      if (c == '{' || c == '[') {
-        isBody = true;
-      }
-      if (isBody) {
-        parser.parse(c);
-      }
-    }
-  }
+  jsonParser parser(this);
+  bool ok = parser.parseFile(cf);
   cf.close();
+  if (!ok) return false;
 
   calculateNextEvents();
   return true;
 }
 
 bool notifier::save(void) {
-  fs::File cf = SPIFFS.open(cf_name, "w");
+  fs::File cf = hal.fileSystem().open(cf_name, "w");
   if (!cf) return false;
 
   cf.print("{\n  \"warn\": \"");
@@ -339,18 +440,19 @@ bool notifier::save(void) {
 void notifier::calculateNextEvents() {
   time_t wp = cfg.warnMaintPeriod();
   time_t up = cfg.urgentMaintPeriod();
-  time_t n  = now();
+  time_t n  = hal.clock();
   next_warn_notify = next_urgent_notify = 0;
   next_data_send = cfg.nextTimeDataSend(data_sent);
   if (next_data_send <= n + 30)
     next_data_send = n + 300;                  // Send the data in five minutes, make sure to get ready after power on
 
-  byte wm_num = cfg.wmCount();
+  byte wm_num = cfg.wmSlots();
   if (wm_num > 0) {
-    WMuData *wud = cfg.getWMuData();
     for (byte i = 0; i < wm_num; ++i) {
+      WMuData *wud = cfg.getWMuData(i);
+      if (!wud->configured) continue;
       for (byte j = 0; j < 2; ++j) {
-        time_t maint = wud[i].wm_maintenance[j];
+        time_t maint = wud->wm_maintenance[j];
         time_t warn = 0;
         if (maint > wp)
           warn = maint - wp;
@@ -382,8 +484,21 @@ void notifier::calculateNextEvents() {
 }
 
 void notifier::send(void) {
+  if (e_mail.busy()) {                          // The letter is being sent
+    mail::ANSWER ans = e_mail.run(mail_budget);
+    if (ans == mail::MAIL_BUSY) return;
+    last_answer = ans;
+    e_mail.end();
+    if (ans == mail::MAIL_OK && pending_ts) {
+      *pending_ts = pending_at;                 // Set timestamp of the sent message
+      save();
+      calculateNextEvents();
+    }
+    pending_ts = 0;
+    return;
+  }
   if (cfg.wmCount() == 0) return;               // Do not notify because there is not WM in the config
-  time_t n = now();
+  time_t n = hal.clock();
   String message = "";
   String subject = "";
   time_t *ts = 0;
@@ -448,6 +563,7 @@ void notifier::send(void) {
   }
 
   if (msg_ready && message.length() > 0) {
+    data_log.flush();                           // The e-mail session can be long, save the log data first
     String    sn    = cfg.smtpRelayHost();
     uint16_t  p     = cfg.smtpRelayPort();
     bool      ssl   = cfg.smtpRelaySSL();
@@ -455,27 +571,39 @@ void notifier::send(void) {
     String    user  = cfg.smtpAuthUser();
     String    pass  = cfg.smtpAuthPass();
     String    to    = cfg.smtpEmailTo();
-    mail *e_mail = new mail;
-    e_mail->server(sn, p, ssl);
-    e_mail->auth(user, pass);
-    mail::ANSWER ans = e_mail->send(to, message, subject, from);
-    if (ans == mail::MAIL_OK) {
-      *ts = n;                                  // Set timestamp of the sent message
-      save();
-      calculateNextEvents();
+    e_mail.server(sn, p, ssl);
+    e_mail.auth(user, pass);
+    mail::ANSWER ans = e_mail.send(to, message, subject, from);
+    if (ans == mail::MAIL_BUSY) {               // The letter will be sent by next calls
+      pending_ts = ts;
+      pending_at = n;
+    } else {
+      last_answer = ans;
     }
-    delete e_mail;
   }
 }
 
-void notifier::value(String value) {
-  if (currentKey == "warn") {
-    warn_notify_sent = value.toInt();
-  } else
-  if (currentKey == "urgent") {
-    urgent_notify_sent = value.toInt();
-  } else
-  if (currentKey == "data") {
-    data_sent = value.toInt();
+String notifier::status(void) {
+  String ret = answer_name[e_mail.busy()?mail::MAIL_BUSY:last_answer];
+  if (e_mail.busy()) {
+    ret += " (";
+    ret += e_mail.phaseName(e_mail.phase());
+    ret += ")";
+  }
+  String r = e_mail.report();
+  if (r.length() > 0) {
+    ret += "; ";
+    ret += r;
   }
-}
+  return ret;
+}
+
+void notifier::jsonValue(uint32_t parent, uint32_t key, const char* value) {
+  if (parent != 0) return;
+  switch (key) {
+    case jsonKey("warn"):   warn_notify_sent   = atol(value); break;
+    case jsonKey("urgent"): urgent_notify_sent = atol(value); break;
+    case jsonKey("data"):   data_sent          = atol(value); break;
+    default: break;
+  }
+}
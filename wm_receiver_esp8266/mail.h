@@ -1,8 +1,7 @@
 #ifndef WM_mail_h
 #define WM_mail_h
 
-#include <WiFiClientSecure.h>
-#include <WiFiClient.h>
+#include <Client.h>
 #include "config.h"
 #include "wm.h"
 
@@ -27,52 +26,89 @@ class mailValidate {
     const     char valid_email_user[3] = {'!', '_', '.'};
 };
 
+/*
+ * The e-mail client does not wait for the SMTP server. send() starts new session and run() should be called
+ * from the loop() until it returns the answer other than MAIL_BUSY. Each call of run() takes no longer than
+ * the time budget (except the TCP connection). Each SMTP step should be finished in step_timeout ms, the message
+ * body is sent while the server takes some of it every step_timeout ms.
+ * The time spent in every phase of the last session is available by phaseTime() and report().
+ */
+
 //------------------------------------------ water meter e-mail client -----------------------------------------
 class mail : public base64 {
   public:
     typedef   enum {
       MAIL_OK = 0, MAIL_SERVER, MAIL_CONNECT, MAIL_NO_ANSWER, MAIL_IDENT,
-      MAIL_AUTH, MAIL_DATA, MAIL_SEND_ERROR, MAIL_DISCONNECT
+      MAIL_AUTH, MAIL_DATA, MAIL_SEND_ERROR, MAIL_DISCONNECT, MAIL_BUSY
     } ANSWER;
+    typedef   enum {
+      PH_IDLE = 0, PH_CONNECT, PH_GREETING, PH_HELO, PH_AUTH, PH_USER, PH_PASS,
+      PH_FROM, PH_RCPT, PH_DATA, PH_BODY, PH_QUIT, PH_NUM
+    } PHASE;
 
-    mail() : base64()                           { smtp_port = 25; smtp_server = auth_user = auth_pass = smtp_from = ""; client = 0; secure = false; }
+    mail() : base64()                           { smtp_port = 25; smtp_server = auth_user = auth_pass = smtp_from = ""; client = 0; secure = false; ph = PH_IDLE; }
     ~mail()                                     { if (client) delete client; }
     void      server(const String& srv, uint16_t port = 25, bool ssl = false);
     void      from(const String& f)             { smtp_from = f; }
     void      auth(const String& login, const String& password)
                                                 { auth_user = login; auth_pass = password; }
     ANSWER    send(const String& to, const String& message, const String& subject = "", const String& from = "");
+    ANSWER    run(uint16_t budget = 20);        // Continue the session, budget is the time limit in ms
+    void      end(void);                        // Abort the session if any and release the TCP client
+    bool      busy(void)                        { return ph != PH_IDLE; }
+    PHASE     phase(void)                       { return ph; }
+    const char* phaseName(PHASE p)              { if (p < PH_NUM) return phase_name[p]; return "-"; }
+    uint32_t  phaseTime(PHASE p)                { if (p < PH_NUM) return phase_ms[p]; return 0; }
+    String    report(void);                     // The phase latency list of the last session
   private:
-    bool      expect(const String responce = "", uint16_t timeout = 10000);
+    bool      readReply(void);
+    bool      sendBody(void);
+    ANSWER    reply(void);
+    void      next(PHASE p);
+    ANSWER    finish(ANSWER ans);
+    ANSWER    phaseError(PHASE p);
+    PHASE     ph;                               // Current phase of the SMTP session
+    uint32_t  phase_start;                      // The time the current phase started, ms
+    uint32_t  phase_ms[PH_NUM];                 // The time spent in every phase, ms
+    char      reply_line[64];                   // The server reply line, can be truncated
+    byte      reply_len;
+    uint16_t  reply_code;                       // The code of the last server reply
+    String    m_to;                             // The letter being sent
+    String    m_message;
+    String    m_subject;
+    String    m_from;
+    uint16_t  body_pos;                         // Number of bytes of the message body and the end mark written
+    bool      body_sent;
+    uint32_t  body_ms;                          // The time the message body was written last
     bool      secure;
     String    smtp_server;
     uint16_t  smtp_port;
     String    auth_user;
     String    auth_pass;
     String    smtp_from;
-    WiFiClient  *client;
+    Client    *client;
+    const     uint16_t step_timeout = 10000;    // The SMTP server reply timeout, ms
+    const     uint16_t body_chunk   = 256;      // The message body is sent by the chunks of this size
+    const     char end_mark[6] = "\r\n.\r\n";     // The end of the message data
+    const     char *phase_name[PH_NUM] = {
+                "idle", "connect", "greeting", "helo", "auth", "user", "password",
+                "from", "rcpt", "data", "body", "quit"
+    };
 };
 
-class notifier : public JsonListener {
+class notifier : public jsonHandler {
   public:
-    notifier(const char *cf = "/notify.json") : JsonListener() { cf_name = cf; }
+    notifier(const char *cf = "/notify.json") : jsonHandler() { cf_name = cf; pending_ts = 0; last_answer = mail::MAIL_OK; }
     bool      init(void);
-    void      send(void);
-    void      testLetter(void)                  { next_data_send = now() + 60; }
-    virtual   void key(String key)              { currentKey = String(key); }
-    virtual   void endObject()                  { }
-    virtual   void startObject()                { }
-    virtual   void whitespace(char c)           { }
-    virtual   void startDocument()              { }
-    virtual   void endArray()                   { }
-    virtual   void endDocument()                { }
-    virtual   void startArray()                 { }
-    virtual   void value(String value);
+    void      send(void);                       // Should be called from the loop(), does not wait for the SMTP server
+    bool      busy(void)                        { return e_mail.busy(); }
+    String    status(void);                     // The result of the last letter sent
+    void      testLetter(void)                  { next_data_send = hal.clock() + 60; }
+    virtual   void jsonValue(uint32_t parent, uint32_t key, const char* value);
   private:
     void      calculateNextEvents(void);        // Calculate the timestapps of the next events
     bool      save(void);                       // Update the configuration file
     String    cf_name;                          // The configuration file name
-    String    currentKey;                       // Internal variables for json parser
     time_t    warn_notify_sent;                 // The time when the warning about water counter maintenance was sent
     time_t    urgent_notify_sent;               // The time when the alert   about water counter maintenance was sent
     time_t    data_sent;                        // The time when the current status of the mater meters was sent
@@ -80,7 +116,16 @@ class notifier : public JsonListener {
     time_t    next_warn_notify;                 // When to send next warning
     time_t    next_urgent_notify;               // When to send next alert
     WMconfig  *pCfg;
+    mail      e_mail;                           // The e-mail client
+    time_t    *pending_ts;                      // The timestamp to be updated when the letter being sent is delivered
+    time_t    pending_at;                       // The time the letter being sent was prepared
+    mail::ANSWER last_answer;                   // The result of the last letter sent
     const     time_t resend_period = 600;       // The period to resend the letter in case of failure
+    const     uint16_t mail_budget = 20;        // Maximum time to spend in e-mail client per loop() call, ms
+    const     char *answer_name[mail::MAIL_BUSY + 1] = {
+                "ok", "no server", "connection failed", "no answer", "HELO rejected", "authentication failed",
+                "DATA rejected", "letter rejected", "QUIT failed", "sending"
+    };
 };
 
-#endif
+#endif
@@ -1,33 +1,43 @@
 #include <Time.h>
 #include <TimeLib.h>
 #include "ntp.h"
+#include "hal.h"
 
 //------------------------------------------ NTP clock ---------------------------------------------------------
-time_t ntpClock::ntpTime(void) {
-  IPAddress timeServerIP;
-  const char *c = ntp_server_name.c_str();
-  WiFi.hostByName(c, timeServerIP); 
-  sendNTPpacket(timeServerIP);
-  delay(1000);
+// Called on every WiFi connection: the clock set before stays valid, so the data is still logged till the NTP answers
+void ntpClock::init(String sn, int tz_mins) {
+  udp.begin(ntp_port);
+  tzSet(tz_mins);
+  ntp_server_name = sn;
+  nxt_sync        = 0;
+  ip_resolved     = false;
+  state           = NTP_IDLE;
+  slew_left       = 0;
+  failures        = 0;
+}
+
+time_t ntpClock::readNTPpacket(void) {
   int cb = udp.parsePacket();
-  if (cb) {
-    udp.read(packetBuffer, NTP_PACKET_SIZE);    // read the packet into the buffer
-    // the timestamp starts at byte 40 of the received packet and is four bytes, or two words, long. First, esxtract the two words:
-    uint32_t highWord = word(packetBuffer[40], packetBuffer[41]);
-    uint32_t lowWord = word(packetBuffer[42], packetBuffer[43]);
-    // combine the four bytes (two words) into a long integer this is NTP time (seconds since Jan 1 1900):
-    uint32_t secsSince1900 = highWord << 16 | lowWord;
-    // now convert NTP time into everyday time: Unix time starts on Jan 1 1970. In seconds, that's 2208988800:
-    time_t epoch = secsSince1900 - 2208988800UL;
-    epoch += long(tz) * 60;
-    setTime(epoch);
-    return epoch; 
-  }
-  return 0;
+  if (cb < NTP_PACKET_SIZE) return 0;
+  udp.read(packetBuffer, NTP_PACKET_SIZE);      // read the packet into the buffer
+  if ((packetBuffer[0] & 0x07) != 4 || packetBuffer[1] == 0)
+    return 0;                                   // Not a server answer or kiss-o'-death packet
+  // the timestamp starts at byte 40 of the received packet and is four bytes, or two words, long. First, esxtract the two words:
+  uint32_t highWord = word(packetBuffer[40], packetBuffer[41]);
+  uint32_t lowWord = word(packetBuffer[42], packetBuffer[43]);
+  // combine the four bytes (two words) into a long integer this is NTP time (seconds since Jan 1 1900):
+  uint32_t secsSince1900 = highWord << 16 | lowWord;
+  // now convert NTP time into everyday time: Unix time starts on Jan 1 1970. In seconds, that's 2208988800:
+  time_t epoch = secsSince1900 - 2208988800UL;
+  uint32_t frac_ms = (uint32_t(packetBuffer[44]) * 1000) >> 8;  // The fraction of the second, ms
+  frac_ms += (hal.ms() - sent_ms) >> 1;         // plus the one-way network delay
+  epoch   += (frac_ms + 500) / 1000;            // Round to the nearest second
+  epoch += long(tz) * 60;
+  return epoch;
 }
 
 String ntpClock::ntpTimeS(time_t ts) {
-  if (ts == 0) ts = ntpTime();
+  if (ts == 0) ts = hal.clock();
   char buff[30];
   sprintf(buff, "%2d:%02d %02d-%02d-%4d", hour(ts), minute(ts), day(ts), month(ts), year(ts));
   return String(buff);
@@ -59,12 +69,80 @@ void ntpClock::srvSet(String ntp_server) {
   } else {
     ntp_server_name = ntp_server;
   }
+  ip_resolved = false;
+  nxt_sync    = 0;                              // Synchronize with the new server as soon as possible
+}
+
+void ntpClock::tzSet(int TZ) {
+  if (synced && TZ != tz)
+    setTime(hal.clock() + (long(TZ) - tz) * 60);  // Move the local clock to the new time zone immediately
+  tz = TZ;
+}
+
+void ntpClock::adjust(time_t epoch) {
+  long offset = long(epoch - hal.clock());
+  if (!synced || offset > max_slew || offset < -max_slew) {
+    setTime(epoch);
+    slew_left = 0;
+  } else {
+    slew_left = offset;
+    nxt_slew  = hal.ms() + slew_step;
+  }
+  synced = true;
+}
+
+void ntpClock::slew(void) {
+  if (slew_left == 0 || long(hal.ms() - nxt_slew) < 0) return;
+  if (slew_left > 0) {
+    adjustTime(1);
+    --slew_left;
+  } else {
+    adjustTime(-1);
+    ++slew_left;
+  }
+  nxt_slew += slew_step;
 }
 
 void ntpClock::syncTime(bool force) {
-  if (force || now() > nxt_sync) {
-    time_t t = ntpTime();
-    setTime(t);
-    nxt_sync = t + sync_period;
+  slew();
+  switch (state) {
+    case NTP_IDLE:
+      if (!force && hal.clock() < nxt_sync) return;
+      if (!ip_resolved) {
+        const char *c = ntp_server_name.c_str();
+        ip_resolved = (WiFi.hostByName(c, server_ip) == 1);
+        if (!ip_resolved) {
+          nxt_sync = hal.clock() + retry_period;
+          return;
+        }
+      }
+      while (udp.parsePacket() > 0)             // Discard late answers to the previous requests
+        udp.flush();
+      sendNTPpacket(server_ip);
+      sent_ms = hal.ms();
+      state   = NTP_WAIT;
+      break;
+    case NTP_WAIT:
+      {
+        time_t epoch = readNTPpacket();
+        if (epoch) {
+          adjust(epoch);
+          failures = 0;
+          nxt_sync = hal.clock() + sync_period;
+          state    = NTP_IDLE;
+        } else
+        if (hal.ms() - sent_ms > ntp_timeout) {
+          if (++failures >= max_failures) {
+            ip_resolved = false;                // The server address may be changed
+            failures    = 0;
+          }
+          nxt_sync = hal.clock() + retry_period;
+          state    = NTP_IDLE;
+        }
+      }
+      break;
+    default:
+      state = NTP_IDLE;
+      break;
   }
-}
+}
@@ -7,28 +7,52 @@
 #include <Time.h>
 #include <TimeLib.h>
 
+/*
+ * The NTP clock never waits for the NTP server. syncTime() should be called from the loop(), it sends the request
+ * when the synchronization period expires and checks for the response on the next calls. The small difference
+ * between the local clock and the NTP time is corrected smoothly (slew), one second per slew_step milliseconds,
+ * the big difference is applied at once. All the display functions use the local clock only.
+ */
+
 //------------------------------------------ NTP clock ---------------------------------------------------------
 const int NTP_PACKET_SIZE = 48;                 // NTP time stamp is in the first 48 bytes of the message
 class ntpClock {
   public:
-    ntpClock()                                  { }
-    void    syncTime(bool force = false);       // Synchronize the local RTC with NTP source
-    void    init(String sn, int tz_mins)        { udp.begin(ntp_port); tz = tz_mins; ntp_server_name = sn; nxt_sync = 0; }
-    time_t  ntpTime(void);
-    String  ntpTimeS(time_t ts = 0);
+    typedef   enum { NTP_IDLE = 0, NTP_WAIT } NTP_STATE;
+    ntpClock()                                  { synced = false; tz = 0; }
+    void    syncTime(bool force = false);       // Synchronize the local RTC with NTP source, should be polled
+    void    init(String sn, int tz_mins);       // Start the new connection, the local clock is kept
+    String  ntpTimeS(time_t ts = 0);            // The local time string, does not communicate to the NTP server
     int     tzMinutes(void)                     { return tz; }
     String  ntpServerName(void)                 { return ntp_server_name; }
+    bool    synchronized(void)                  { return synced; }
     void    srvSet(String ntp_server);
-    void    tzSet(int TZ)                       { tz = TZ; }
+    void    tzSet(int TZ);
   private:
     void    sendNTPpacket(IPAddress& address);
+    time_t  readNTPpacket(void);                // Read the NTP server response, returns 0 if no valid response
+    void    adjust(time_t epoch);               // Step or slew the local clock to the NTP time
+    void    slew(void);                         // Apply the next second of the correction
     uint8_t packetBuffer[NTP_PACKET_SIZE];
     String  ntp_server_name;
+    IPAddress server_ip;                        // Cached NTP server address
+    bool    ip_resolved;                        // Whether server_ip is valid
+    bool    synced;                             // The local clock has been synchronized at least once
+    NTP_STATE state;
     int     tz;                                 // Time zone difference in minutes
     WiFiUDP udp;                                // A UDP instance to let us send and receive packets over UDP
     time_t  nxt_sync;
-    const time_t   sync_period = 1800;          // Synchronization local clock period, seconds
+    uint32_t sent_ms;                           // The time when the NTP request was sent, ms
+    long    slew_left;                          // The correction to be applied to the local clock, seconds
+    uint32_t nxt_slew;                          // The time to apply next second of the correction, ms
+    byte    failures;                           // Number of consecutive failed requests
+    const time_t   sync_period  = 1800;         // Synchronization local clock period, seconds
+    const time_t   retry_period = 60;           // Retry period when the NTP server failed to answer, seconds
+    const uint16_t ntp_timeout  = 2000;         // The NTP server response timeout, ms
+    const uint16_t slew_step    = 10000;        // The slew rate: one second per this period, ms
+    const long     max_slew     = 60;           // The maximum correction to be slewed, seconds. Bigger one is stepped
+    const byte     max_failures = 3;            // Resolve the server name again after so many failures
     const uint16_t ntp_port = 2390;             // local port to listen for UDP packets
 };
 
-#endif
+#endif
@@ -0,0 +1,53 @@
+#include "packet.h"
+#include "config.h"
+#include "wm.h"
+#include "log.h"
+#include "link.h"
+
+extern WMconfig          cfg;                   // Global variable, declared in wm_receiver_esp8266.ino
+extern WMpool            pool;                  // Global variable, declared in wm_receiver_esp8266.ino
+extern wmlog             data_log;              // Global variable, declared in wm_receiver_esp8266.ino
+extern wmLink            wm_link;               // Global variable, declared in wm_receiver_esp8266.ino
+
+// Process the packet received from the water meter controller
+void processPacket(struct rx_packet& pkt) {
+  struct data wm;                               // Defined in wm_data.h file
+  struct history hist;
+  wmLink::STATUS st = wm_link.decode(pkt, wm, hist);
+  byte answer[rx_max_len];                      // The transmitter is waiting for the beacon or ACK, answer first
+  byte len = wm_link.reply(pkt, st, answer);
+  if (len > 0) hal.radioSend(answer, len);
+  time_t ts = hal.clock() - (hal.ms() - pkt.ms) / 1000;
+  if (st == wmLink::PKT_BACKFILL) {
+    if (hal.clockSet()) mergeHistory(hist, ts);
+    return;
+  }
+  if (st != wmLink::PKT_OK && st != wmLink::PKT_LEGACY) return;
+  pool.update(wm, ts);
+  String loc = cfg.location(wm.ID);
+  if (loc.length() == 0) {
+    cfg.setLocation(wm.ID, String(wm.ID));
+  }
+  if (!hal.clockSet()) return;                  // The log and the rollups need the real date, wait for NTP
+  long cold = pool.shift(wm.ID, false) + wm.wm_data[WM_COLD];
+  long hot  = pool.shift(wm.ID, true)  + wm.wm_data[WM_HOT];
+  data_log.log(wm.ID, cold, hot);
+}
+
+// Merge the snapshots of the controller into the log, the oldest first
+void mergeHistory(struct history& hist, time_t ts) {
+  long sc = pool.shift(hist.ID, false);
+  long sh = pool.shift(hist.ID, true);
+  bool done[hist_max_records];
+  memset(done, 0, sizeof(done));
+  for (byte n = 0; n < hist.records; ++n) {
+    byte oldest = hist_max_records;
+    for (byte r = 0; r < hist.records; ++r) {
+      if (!done[r] && (oldest == hist_max_records || hist.age[r] > hist.age[oldest]))
+        oldest = r;
+    }
+    done[oldest] = true;
+    data_log.merge(hist.ID, sc + hist.wm_data[oldest][WM_COLD], sh + hist.wm_data[oldest][WM_HOT],
+                   ts - time_t(hist.age[oldest]) * 60);
+  }
+}
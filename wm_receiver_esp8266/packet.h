@@ -0,0 +1,15 @@
+#ifndef WM_packet_h
+#define WM_packet_h
+
+/*
+ * The radio packets of the water meter controllers: the packet is decoded by the link layer, answered
+ * by the beacon or the acknowledgement, then the data update the water meter pool and the log,
+ * the history snapshots are merged into the log.
+ */
+
+#include "wm_data.h"
+
+void processPacket(struct rx_packet& pkt);
+void mergeHistory(struct history& hist, time_t ts);  // Merge the snapshots received at ts into the log
+
+#endif
@@ -0,0 +1,25 @@
+#include "profile.h"
+
+const char* const loopProfile::section_name[LP_NUM] = {"radio", "network", "storage", "mail", "system"};
+
+void loopProfile::endLoop(void) {
+  ++loops;
+  uint32_t n = millis();
+  uint32_t elapsed = n - window_start;
+  if (elapsed < profile_window) return;
+  for (byte s = 0; s < LP_NUM; ++s) {
+    p_load[s]    = busy[s] / elapsed;              // us per ms is per mille
+    p_longest[s] = longest[s];
+    busy[s] = longest[s] = 0;
+  }
+  p_loops = uint32_t((uint64_t(loops) * profile_window) / elapsed);
+  loops = 0;
+  window_start = n;
+}
+
+uint16_t loopProfile::loadTotal(void) {
+  uint16_t l = 0;
+  for (byte s = 0; s < LP_SYSTEM; ++s)            // The system time is not the loop load
+    l += p_load[s];
+  return l;
+}
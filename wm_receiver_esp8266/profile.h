@@ -0,0 +1,52 @@
+#ifndef WM_profile_h
+#define WM_profile_h
+
+/*
+ * The time budget of the receiver main loop. The loop is split into the sections: the radio packets processing,
+ * the network (WiFi, Blynk and the web server), the storage (the configuration and the log), the e-mail notifier
+ * and the system time given away by yield(). The time of every section is accumulated by micros() during
+ * the window of profile_window ms, then the load of the section (per mille of the window) and the longest
+ * section run in the window are published. The longest run shows how long the loop can be blocked,
+ * so the radio queue should keep the packets received during this time.
+ */
+
+#include <Arduino.h>
+
+typedef enum { LP_RADIO = 0, LP_NET, LP_STORE, LP_MAIL, LP_SYSTEM, LP_NUM } LP_SECTION;
+
+//------------------------------------------ main loop time budget ---------------------------------------------
+class loopProfile {
+  public:
+    loopProfile()                               { memset(busy, 0, sizeof(busy)); memset(longest, 0, sizeof(longest));
+                                                  memset(p_load, 0, sizeof(p_load)); memset(p_longest, 0, sizeof(p_longest));
+                                                  loops = p_loops = 0; mark = 0; window_start = 0; }
+    void      start(void)                       { mark = micros(); }
+    void      section(LP_SECTION s);            // The section s is over, the next one begins
+    void      endLoop(void);                    // Count the loop, publish the window results when it is over
+    uint16_t  load(LP_SECTION s)                { return p_load[s]; }    // per mille
+    uint32_t  longestUs(LP_SECTION s)           { return p_longest[s]; }
+    uint16_t  loadTotal(void);                  // per mille of the window the loop was busy
+    uint32_t  loopsPerSecond(void)              { return p_loops * 1000 / profile_window; }
+    static    const char* name(LP_SECTION s)    { return section_name[s]; }
+  private:
+    uint32_t  busy[LP_NUM];                     // The time spent in the section during the window, us
+    uint32_t  longest[LP_NUM];                  // The longest run of the section during the window, us
+    uint16_t  p_load[LP_NUM];                   // The published load of the sections, per mille
+    uint32_t  p_longest[LP_NUM];                // The published longest runs, us
+    uint32_t  loops;                            // The number of the loops in the window
+    uint32_t  p_loops;                          // The published number of the loops
+    uint32_t  mark;                             // The beginning of the current section, us
+    uint32_t  window_start;                     // ms
+    static    const uint32_t profile_window = 60000;
+    static    const char* const section_name[LP_NUM];
+};
+
+inline void loopProfile::section(LP_SECTION s) {
+  uint32_t n = micros();
+  uint32_t d = n - mark;
+  mark = n;
+  busy[s] += d;
+  if (d > longest[s]) longest[s] = d;
+}
+
+#endif
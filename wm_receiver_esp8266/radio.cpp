@@ -0,0 +1,52 @@
+#include "radio.h"
+
+rfQueue* rfQueue::instance = 0;
+
+bool rfQueue::init(void) {
+  if (!RH_RF22::init()) return false;
+  instance = this;
+  attachInterrupt(digitalPinToInterrupt(irq), rxISR, FALLING);  // Replace the driver interrupt handler
+  setModeRx();
+  return true;
+}
+
+bool rfQueue::pop(struct rx_packet& pkt) {
+  if (tail == head) return false;
+  memcpy(&pkt, &queue[tail], sizeof(struct rx_packet));
+  tail = (tail + 1) % RX_QUEUE_SIZE;
+  return true;
+}
+
+bool rfQueue::transmit(const byte* buff, byte len) {
+  bool ok = send(buff, len) && waitPacketSent(500);
+  setModeRx();
+  return ok;
+}
+
+void ICACHE_RAM_ATTR rfQueue::rxISR(void) {
+  if (instance) {
+    instance->handleInterrupt();
+    instance->enqueue();
+  }
+}
+
+// Called from the interrupt handler only
+void ICACHE_RAM_ATTR rfQueue::enqueue(void) {
+  if (!_rxBufValid) return;                     // No new packet received
+  byte nxt = (head + 1) % RX_QUEUE_SIZE;
+  if (nxt == tail) {                            // The queue is full, drop the packet
+    ++rx_overflow;
+  } else {
+    struct rx_packet *p = &queue[head];
+    byte len = _bufLen;
+    if (len > rx_max_len) len = rx_max_len;
+    p->ms   = millis();
+    p->rssi = _lastRssi;
+    p->len  = len;
+    memcpy(p->buff, _buf, len);
+    head = nxt;
+    ++rx_count;
+  }
+  clearRxBuf();
+  setModeRx();                                  // Get ready to receive next packet
+}
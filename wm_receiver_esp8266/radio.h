@@ -0,0 +1,39 @@
+#ifndef WM_radio_h
+#define WM_radio_h
+
+/*
+ * The radio driver with the receive queue. The nIrq pin interrupt handler of RH_RF22 is replaced by rxISR(),
+ * that calls the driver handler and moves every received packet into the ring buffer together with
+ * the reception time and the signal strength. So the radio is ready to receive next packet immediately and
+ * the packets are not lost while the main loop is busy. The main loop reads the queue without waiting.
+ * The receiver sends the short beacons only, so transmit() waits for the packet is sent and returns to the receive mode.
+ */
+
+#include <RH_RF22.h>
+#include "wm_data.h"
+
+#define RX_QUEUE_SIZE 8                         // The receive queue size, packets
+
+//------------------------------------------ radio receiver with the packet queue ------------------------------
+class rfQueue : public RH_RF22 {
+  public:
+    rfQueue(uint8_t ss_pin, uint8_t irq_pin) : RH_RF22(ss_pin, irq_pin) { irq = irq_pin; head = tail = 0; rx_count = rx_overflow = 0; }
+    bool      init(void);
+    bool      pop(struct rx_packet& pkt);       // Get the oldest packet from the queue, returns false if queue is empty
+    bool      transmit(const byte* buff, byte len);  // Send the packet and wait till it is sent
+    uint32_t  received(void)                    { return rx_count; }
+    uint32_t  overflows(void)                   { return rx_overflow; }
+    byte      queued(void)                      { return (head + RX_QUEUE_SIZE - tail) % RX_QUEUE_SIZE; }
+  private:
+    static    void rxISR(void);
+    void      enqueue(void);
+    static    rfQueue* instance;                // The radio instance to handle the interrupt
+    byte      irq;                              // The nIrq pin number
+    struct    rx_packet queue[RX_QUEUE_SIZE];
+    volatile  byte head;                        // The next element to be written by the interrupt handler
+    volatile  byte tail;                        // The next element to be read by the main loop
+    volatile  uint32_t rx_count;                // The number of the packets received
+    volatile  uint32_t rx_overflow;             // The number of the packets dropped because the queue was full
+};
+
+#endif
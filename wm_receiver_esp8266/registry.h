@@ -0,0 +1,101 @@
+#ifndef WM_registry_h
+#define WM_registry_h
+
+/*
+ * The registry of the water meter controllers. Maps the controller ID (1-255) to the dense slot number [0; size())
+ * through the 256-entry lookup table and keeps the data of type T in each slot.
+ * The slot storage is allocated by small steps when the new controller is added, up to the limit given in constructor.
+ * find(), slot() and id() never change the registry, only add() allocates the slot for the new controller.
+ * When the controller is removed, the last slot is moved into its place, so the slots are always dense.
+ */
+
+#include <Arduino.h>
+
+#define REG_NO_SLOT   0xFF                      // The controller is not registered
+#define REG_GROW_STEP 4                         // The number of slots allocated at once
+
+//------------------------------------------ water meter controller registry -----------------------------------
+template <typename T> class wmRegistry {
+  public:
+    wmRegistry(byte max_size)                   { limit = (max_size < REG_NO_SLOT)?max_size:REG_NO_SLOT; items = 0; ids = 0; num = allocated = 0; memset(lut, REG_NO_SLOT, sizeof(lut)); }
+    ~wmRegistry()                               { delete[] items; delete[] ids; }
+    byte      slot(byte ID)                     { return (ID)?lut[ID]:REG_NO_SLOT; }
+    T*        find(byte ID)                     { byte s = slot(ID); return (s != REG_NO_SLOT)?&items[s]:0; }
+    T*        add(byte ID);                     // Find the controller, register it if not found. Returns 0 if no room
+    bool      remove(byte ID);
+    void      clear(void);                      // Remove all the controllers, keep the allocated storage
+    byte      size(void)                        { return num; }
+    byte      capacity(void)                    { return allocated; }
+    byte      maxSize(void)                     { return limit; }
+    byte      id(byte s)                        { return (s < num)?ids[s]:0; }
+    T&        at(byte s)                        { return items[s]; }
+  private:
+    wmRegistry(const wmRegistry&);              // Not copyable
+    bool      grow(void);
+    byte      lut[256];                         // Controller ID to slot lookup table
+    T*        items;                            // Per slot data
+    byte*     ids;                              // Slot to controller ID
+    byte      num;                              // Number of the registered controllers
+    byte      allocated;                        // Number of the allocated slots
+    byte      limit;                            // The maximum number of the slots
+};
+
+template <typename T> T* wmRegistry<T>::add(byte ID) {
+  if (ID == 0) return 0;
+  byte s = lut[ID];
+  if (s != REG_NO_SLOT) return &items[s];
+  if (num >= allocated && !grow()) return 0;
+  s = num++;
+  ids[s]    = ID;
+  items[s]  = T();
+  lut[ID]   = s;
+  return &items[s];
+}
+
+template <typename T> bool wmRegistry<T>::remove(byte ID) {
+  byte s = slot(ID);
+  if (s == REG_NO_SLOT) return false;
+  byte last = num - 1;
+  if (s != last) {                              // Move the last slot to the free one
+    items[s]  = items[last];
+    ids[s]    = ids[last];
+    lut[ids[s]] = s;
+  }
+  items[last] = T();
+  lut[ID] = REG_NO_SLOT;
+  --num;
+  return true;
+}
+
+template <typename T> void wmRegistry<T>::clear(void) {
+  for (byte s = 0; s < num; ++s) {
+    lut[ids[s]] = REG_NO_SLOT;
+    items[s]    = T();
+  }
+  num = 0;
+}
+
+template <typename T> bool wmRegistry<T>::grow(void) {
+  uint16_t n_size = uint16_t(allocated) + REG_GROW_STEP;
+  if (n_size > limit) n_size = limit;
+  if (n_size <= allocated) return false;        // The limit reached
+  T*    n_items = new T[n_size];
+  byte* n_ids   = new byte[n_size];
+  if (!n_items || !n_ids) {
+    delete[] n_items;
+    delete[] n_ids;
+    return false;
+  }
+  for (byte s = 0; s < num; ++s) {
+    n_items[s] = items[s];
+    n_ids[s]   = ids[s];
+  }
+  delete[] items;
+  delete[] ids;
+  items     = n_items;
+  ids       = n_ids;
+  allocated = n_size;
+  return true;
+}
+
+#endif
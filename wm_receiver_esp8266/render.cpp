@@ -0,0 +1,90 @@
+#include "render.h"
+#if defined(UMM_STATS_FULL)
+#include <umm_malloc/umm_malloc_cfg.h>
+#endif
+
+uint32_t htmlStream::ttfb_ms   = 0;
+uint32_t htmlStream::heap_used = 0;
+
+htmlStream::htmlStream(ESP8266WebServer& srv) : server(srv) {
+  len        = 0;
+  sent       = false;
+  start_ms   = millis();
+#if defined(UMM_STATS_FULL)
+  start_heap = min_heap = umm_free_heap_size_min_reset();
+#else
+  start_heap = min_heap = ESP.getFreeHeap();
+#endif
+}
+
+void htmlStream::begin(const char* type) {
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, type, "");
+}
+
+void htmlStream::end(void) {
+  flush();
+  server.sendContent("");                       // The last chunk
+#if defined(UMM_STATS_FULL)
+  min_heap  = umm_free_heap_size_lw_min();
+#endif
+  heap_used = start_heap - min_heap;
+}
+
+void htmlStream::print_P(PGM_P s) {
+  char c;
+  while ((c = pgm_read_byte(s++)) != 0) {
+    if (len >= render_buff_size) flush();
+    buff[len++] = c;
+  }
+}
+
+void htmlStream::fill_P(PGM_P tmpl, std::initializer_list<String> args) {
+  checkHeap();                                  // The arguments are on the heap now
+  char c;
+  while ((c = pgm_read_byte(tmpl++)) != 0) {
+    if (c == '{') {                             // The placeholder {N}
+      char n = pgm_read_byte(tmpl);
+      if (n >= '0' && n <= '9' && pgm_read_byte(tmpl + 1) == '}') {
+        byte i = n - '0';
+        if (i < args.size()) {
+          const String& a = *(args.begin() + i);
+          write(a.c_str(), a.length());
+        }
+        tmpl += 2;
+        continue;
+      }
+    }
+    if (len >= render_buff_size) flush();
+    buff[len++] = c;
+  }
+}
+
+void htmlStream::write(const char* s, uint16_t n) {
+  while (n > 0) {
+    if (len >= render_buff_size) flush();
+    uint16_t part = render_buff_size - len;
+    if (part > n) part = n;
+    memcpy(&buff[len], s, part);
+    len += part;
+    s   += part;
+    n   -= part;
+  }
+}
+
+void htmlStream::flush(void) {
+  checkHeap();
+  if (len == 0) return;
+  server.sendContent(buff, len);
+  len = 0;
+  if (!sent) {
+    sent    = true;
+    ttfb_ms = millis() - start_ms;
+  }
+}
+
+// Without the heap statistics the free heap is sampled, the temporary Strings freed between the samples are missed
+void htmlStream::checkHeap(void) {
+  uint32_t h = ESP.getFreeHeap();
+  if (h < min_heap) min_heap = h;
+}
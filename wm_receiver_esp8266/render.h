@@ -0,0 +1,48 @@
+#ifndef WM_render_h
+#define WM_render_h
+
+/*
+ * The streaming renderer of the web pages. The page is written into the fixed buffer, the buffer is sent
+ * as the next chunk of the chunked transfer when it is full, so the page of any size needs render_buff_size bytes
+ * on the stack instead of the String growing on the heap. The static parts of the page are the templates in PROGMEM:
+ * fill_P() writes the template replacing {0}..{9} with its arguments.
+ * The time to the first byte of the page and the heap used while the page is rendered are kept for the last page.
+ * The heap used is the low water mark of the free heap if the core keeps the heap statistics (UMM_STATS_FULL),
+ * so the String temporaries of the template arguments are counted too. The page should be created before them.
+ */
+
+#include <ESP8266WebServer.h>
+#include <initializer_list>
+
+const uint16_t render_buff_size = 512;          // The chunk size
+
+//------------------------------------------ streaming web page renderer ---------------------------------------
+class htmlStream {
+  public:
+    htmlStream(ESP8266WebServer& srv);
+    void      begin(const char* type = "text/html");  // Send the answer header, the page is sent by chunks
+    void      end(void);                        // Send the rest of the page and the last chunk
+    htmlStream& operator+=(const char* s)       { write(s, strlen(s)); return *this; }
+    htmlStream& operator+=(const String& s)     { write(s.c_str(), s.length()); return *this; }
+    htmlStream& operator+=(char c)              { write(&c, 1); return *this; }
+    void      print_P(PGM_P s);                 // Write the string from PROGMEM
+    void      fill_P(PGM_P tmpl, std::initializer_list<String> args);  // Write the template with the arguments
+    static    uint32_t firstByteMs(void)        { return ttfb_ms; }
+    static    uint32_t heapUsed(void)           { return heap_used; }
+  private:
+    htmlStream(const htmlStream&);              // Not copyable
+    void      write(const char* s, uint16_t n);
+    void      flush(void);
+    void      checkHeap(void);
+    ESP8266WebServer& server;
+    char      buff[render_buff_size];
+    uint16_t  len;                              // The number of bytes in the buffer
+    bool      sent;                             // The first chunk has been sent
+    uint32_t  start_ms;                         // The time the page rendering started
+    uint32_t  start_heap;                       // Free heap before the page rendering
+    uint32_t  min_heap;                         // The minimal free heap while the page is rendered
+    static    uint32_t ttfb_ms;                 // The time to the first byte of the last page, ms
+    static    uint32_t heap_used;               // The heap used by the last page, bytes
+};
+
+#endif
@@ -0,0 +1,191 @@
+#define FS_NO_GLOBALS
+#include <FS.h>
+#include "rollup.h"
+#include "log.h"
+
+void wmRollup::update(byte ID, uint32_t cold, uint32_t hot, time_t ts) {
+  struct period *p = meters.find(ID);
+  if (!p) {
+    if (!admit(ID)) return;                     // No room for the rollups of this controller
+    p = meters.add(ID);
+    if (!p) return;
+  }
+  for (byte t = 0; t < RT_NUM; ++t) {
+    time_t ps = periodStart(TIER(t), ts);
+    if (p->ts[t] != uint32_t(ps)) {             // New period started, save the previous one
+      if (p->dirty[t]) {
+        struct log_record rec;
+        rec.ts    = p->ts[t];
+        rec.cold  = p->cold;
+        rec.hot   = p->hot;
+        rec.ID    = ID;
+        wmlog::sealRecord(rec);
+        write(TIER(t), rec);
+      }
+      p->ts[t] = ps;
+      p->dirty[t] = changed = true;
+    } else
+    if (p->cold != cold || p->hot != hot) {     // The period record has to be written again
+      p->dirty[t] = changed = true;
+    }
+  }
+  p->cold = cold;
+  p->hot  = hot;
+}
+
+void wmRollup::flush(void) {
+  if (!changed) return;
+  changed = false;
+  for (byte i = 0; i < meters.size(); ++i) {
+    struct period &p = meters.at(i);
+    for (byte t = 0; t < RT_NUM; ++t) {
+      if (!p.dirty[t]) continue;
+      struct log_record rec;
+      rec.ts    = p.ts[t];
+      rec.cold  = p.cold;
+      rec.hot   = p.hot;
+      rec.ID    = meters.id(i);
+      wmlog::sealRecord(rec);
+      write(TIER(t), rec);
+      p.dirty[t] = false;
+    }
+  }
+}
+
+bool wmRollup::read(byte ID, TIER tier, time_t ts, struct log_record& rec) {
+  if (tier >= RT_NUM) return false;
+  time_t p = periodStart(tier, ts);
+  struct period *cur = meters.find(ID);
+  if (cur && cur->dirty[tier] && cur->ts[tier] == uint32_t(p)) {  // Not saved yet
+    rec.ts    = p;
+    rec.cold  = cur->cold;
+    rec.hot   = cur->hot;
+    rec.ID    = ID;
+    wmlog::sealRecord(rec);
+    return true;
+  }
+  fs::File rf = hal.fileSystem().open(tierName(ID, tier), "r");
+  if (!rf) return false;
+  rf.seek(slot(tier, p) * sizeof(struct log_record), fs::SeekSet);
+  bool ok = (rf.read((byte *)&rec, sizeof(struct log_record)) == sizeof(struct log_record));
+  rf.close();
+  return ok && wmlog::validRecord(rec) && rec.ID == ID && rec.ts == uint32_t(p);
+}
+
+// The consumption in the period ts belongs to: the difference of its record and the record of the previous period
+bool wmRollup::used(byte ID, TIER tier, time_t ts, uint32_t& cold, uint32_t& hot) {
+  struct log_record cur, prev;
+  if (!read(ID, tier, ts, cur) || !read(ID, tier, prevPeriod(tier, ts), prev)) return false;
+  cold = (cur.cold > prev.cold)?cur.cold - prev.cold:0;
+  hot  = (cur.hot  > prev.hot)?cur.hot - prev.hot:0;
+  return true;
+}
+
+// The tier has one record per query step if the step is a multiple of the tier period and the range starts at the period
+wmRollup::TIER wmRollup::queryTier(time_t from, uint32_t step) {
+  if (step % 86400 == 0 && from % 86400 == 0 && keeps(RT_DAY, from))  return RT_DAY;
+  if (step % 3600 == 0  && from % 3600 == 0  && keeps(RT_HOUR, from)) return RT_HOUR;
+  return RT_NUM;
+}
+
+bool wmRollup::keeps(TIER tier, time_t ts) {
+  time_t n = hal.clock();
+  if (ts > n) return true;
+  if (tier == RT_HOUR) return (periodStart(tier, n) - periodStart(tier, ts)) / 3600 < slots[tier];
+  if (tier == RT_DAY)  return (periodStart(tier, n) - periodStart(tier, ts)) / 86400 < slots[tier];
+  return (uint32_t(year(n)) * 12 + month(n)) - (uint32_t(year(ts)) * 12 + month(ts)) < slots[tier];
+}
+
+// Count the controllers those rollup files exist and the number of the controllers the rollups fit
+void wmRollup::scan(void) {
+  scanned = true;
+  memset(has_files, 0, sizeof(has_files));
+  kept = 0;
+  fs::Dir dir = hal.fileSystem().openDir("/");
+  while (dir.next()) {
+    String fn = dir.fileName();
+    if (fn.indexOf("/wmroll_h_") != 0) continue;
+    long ID = fn.substring(10).toInt();
+    if (ID <= 0 || ID > 255) continue;
+    has_files[ID >> 3] |= 1 << (ID & 7);
+    ++kept;
+  }
+  fs::FSInfo info;
+  uint32_t fit = 0;
+  if (hal.fileSystem().info(info)) fit = info.totalBytes / fs_share / meter_bytes;
+  room = (fit < MAX_WM)?fit:MAX_WM;
+}
+
+// The controller keeps the rollups if it has them already or if there is room for the new ones
+bool wmRollup::admit(byte ID) {
+  if (!scanned) scan();
+  if (has_files[ID >> 3] & (1 << (ID & 7))) return true;
+  if (kept >= room) return false;
+  has_files[ID >> 3] |= 1 << (ID & 7);
+  ++kept;
+  return true;
+}
+
+// Write the record into its slot, create the tier file if it does not exist
+bool wmRollup::write(TIER tier, const struct log_record& rec) {
+  String fn = tierName(rec.ID, tier);
+  fs::File rf = hal.fileSystem().open(fn, "r+");
+  if (!rf) {
+    rf = hal.fileSystem().open(fn, "w+");
+    if (!rf) {
+      ++write_errors;
+      return false;
+    }
+    byte buff[128];
+    memset(buff, 0, sizeof(buff));
+    uint32_t size = uint32_t(slots[tier]) * sizeof(struct log_record);
+    for (uint32_t w = 0; w < size; w += sizeof(buff)) {
+      uint32_t len = size - w;
+      if (len > sizeof(buff)) len = sizeof(buff);
+      if (rf.write(buff, len) != len) {         // The file system is full, do not leave the short file
+        rf.close();
+        hal.fileSystem().remove(fn);
+        ++write_errors;
+        return false;
+      }
+    }
+  }
+  rf.seek(slot(tier, rec.ts) * sizeof(struct log_record), fs::SeekSet);
+  bool ok = (rf.write((const byte *)&rec, sizeof(struct log_record)) == sizeof(struct log_record));
+  rf.close();
+  if (!ok) ++write_errors;
+  return ok;
+}
+
+time_t wmRollup::periodStart(TIER tier, time_t ts) {
+  if (tier == RT_HOUR) return ts - ts % 3600;
+  if (tier == RT_DAY)  return ts - ts % 86400;
+  tmElements_t tm;
+  breakTime(ts, tm);
+  tm.Day    = 1;
+  tm.Hour   = 0;
+  tm.Minute = 0;
+  tm.Second = 0;
+  return makeTime(tm);
+}
+
+time_t wmRollup::nextPeriod(TIER tier, time_t ts) {
+  if (tier == RT_HOUR) return periodStart(tier, ts) + 3600;
+  if (tier == RT_DAY)  return periodStart(tier, ts) + 86400;
+  return periodStart(tier, periodStart(tier, ts) + 32 * 86400);
+}
+
+uint32_t wmRollup::slot(TIER tier, time_t ts) {
+  if (tier == RT_HOUR) return (ts / 3600)  % slots[tier];
+  if (tier == RT_DAY)  return (ts / 86400) % slots[tier];
+  return (uint32_t(year(ts)) * 12 + month(ts) - 1) % slots[tier];
+}
+
+String wmRollup::tierName(byte ID, TIER tier) {
+  String fn = "/wmroll_";
+  fn += tier_char[tier];
+  fn += "_";
+  fn += String(ID);
+  fn += ".bin";
+  return fn;
+}
@@ -0,0 +1,72 @@
+#ifndef WM_rollup_h
+#define WM_rollup_h
+
+/*
+ * The long time history of the water meter counters. Every counter reading is aggregated into three tiers:
+ * hourly, daily and monthly. Each tier of each controller is the fixed size file /wmroll_<tier>_<ID>.bin,
+ * the ring of the log records (see log.h), one record per period. The record timestamp is the beginning of the period,
+ * the counter values are the last values read in the period. The consumption in the period is the difference
+ * with the previous record. The record is updated in place when the period is over or the log is flushed, only
+ * the periods changed since the last write are written, so the file size never changes.
+ * The range queries with the step of whole hours or days read the rollup records instead of the log (see logQuery),
+ * the consumption of the day and the month is shown from the rollups.
+ * The rollups of one controller take meter_bytes (13 KB) of the flash, all of them take not more than 1/fs_share
+ * of the file system, so the number of the controllers having the rollups is limited: 19 controllers on 1 MB file
+ * system, 59 on 3 MB. The controllers those files exist keep them, the new ones get the rollups while there is room.
+ * The queries of the other controllers read the log. The failed writes of the rollup records are counted.
+ */
+
+#include <TimeLib.h>
+#include "config.h"
+#include "registry.h"
+
+struct log_record;
+
+//------------------------------------------ water meter data rollups ------------------------------------------
+class wmRollup {
+  public:
+    typedef   enum { RT_HOUR = 0, RT_DAY, RT_MONTH, RT_NUM } TIER;
+    wmRollup() : meters(MAX_WM)                 { changed = scanned = false; kept = room = 0; write_errors = 0; }
+    void      init(void)                        { meters.clear(); changed = scanned = false; }
+    byte      controllers(void)                 { return kept; }  // The number of the controllers having the rollups
+    byte      capacity(void)                    { return room; }  // The number of the controllers the rollups fit
+    uint32_t  writeErrors(void)                 { return write_errors; }
+    void      update(byte ID, uint32_t cold, uint32_t hot, time_t ts);
+    void      flush(void);                      // Write the current periods of all the controllers
+    bool      read(byte ID, TIER tier, time_t ts, struct log_record& rec);  // Read the record of the period ts belongs to
+    bool      used(byte ID, TIER tier, time_t ts, uint32_t& cold, uint32_t& hot);  // The consumption in the period
+    TIER      queryTier(time_t from, uint32_t step);  // The tier the range query can be read from, RT_NUM if none
+    bool      keeps(TIER tier, time_t ts);      // The tier still keeps the period ts belongs to
+    time_t    periodStart(TIER tier, time_t ts);
+    time_t    nextPeriod(TIER tier, time_t ts);
+    time_t    prevPeriod(TIER tier, time_t ts)  { return periodStart(tier, periodStart(tier, ts) - 1); }
+  private:
+    struct    period {                          // The current periods of the controller
+      uint32_t  ts[RT_NUM];                     // The current period of each tier
+      uint32_t  cold;                           // The last counter values
+      uint32_t  hot;
+      bool      dirty[RT_NUM];                  // The current period has not been written yet
+    };
+    String    tierName(byte ID, TIER tier);
+    void      scan(void);
+    bool      admit(byte ID);
+    uint32_t  slot(TIER tier, time_t ts);
+    bool      write(TIER tier, const struct log_record& rec);
+    wmRegistry<struct period> meters;
+    bool      changed;                          // Some current period has not been written yet
+    bool      scanned;                          // The rollup files have been counted
+    byte      kept;                             // The number of the controllers having the rollups
+    byte      room;                             // The number of the controllers the rollups can be kept for
+    byte      has_files[32];                    // The bit per controller ID: the rollups are kept
+    uint32_t  write_errors;                     // The number of the records failed to be written
+    const     uint16_t slots[RT_NUM] = {
+                24 * 14,                        // Hourly data for two weeks
+                366,                            // Daily data for one year
+                120                             // Monthly data for ten years
+    };
+    const     char tier_char[RT_NUM] = {'h', 'd', 'm'};
+    static    const uint32_t meter_bytes = (24 * 14 + 366 + 120) * 16;  // The rollup files of one controller
+    static    const byte fs_share = 4;          // The rollups take up to 1/4 of the file system
+};
+
+#endif
@@ -3,12 +3,22 @@
 #include "web.h"
 #include "ntp.h"
 #include "config.h"
+#include "radio.h"
+#include "log.h"
+#include "link.h"
+#include "profile.h"
+#include "render.h"
 
 extern WMconfig          cfg;                   // Global variable, declared in wm_receiver_esp8266.ino
 extern WMpool            pool;                  // Global variable, declared in wm_receiver_esp8266.ino
 extern ntpClock          ntp;                   // Global variable, declared in wm_receiver_esp8266.ino
 extern web               server;                // Global variable, declared in wm_receiver_esp8266.ino
 extern notifier          e_notify;              // Global variable, declared in wm_receiver_esp8266.ino
+extern rfQueue           rf22;                  // Global variable, declared in wm_receiver_esp8266.ino
+extern wmLink            wm_link;               // Global variable, declared in wm_receiver_esp8266.ino
+extern loopProfile       loop_profile;          // Global variable, declared in wm_receiver_esp8266.ino
+extern wmlog             data_log;              // Global variable, declared in wm_receiver_esp8266.ino
+extern uint32_t          boot_ms;               // Global variable, declared in wm_receiver_esp8266.ino
 
 // WEB handlers
 void handleRoot(void);
@@ -19,6 +29,8 @@ void handleWMsetup(void);
 void handleWMremove(void);
 void handleMailsetup(void);
 void handleWMlog(void);
+void handleLogQuery(void);
+void handleLinkStats(void);
 void handleNotFound(void);
 
 // These functions are defined in the main file
@@ -75,6 +87,8 @@ void web::setupWEBserver(void) {
   ESP8266WebServer::on("/wm_remove",   handleWMremove);
   ESP8266WebServer::on("/mail_setup",  handleMailsetup);
   ESP8266WebServer::on("/log",         handleWMlog);
+  ESP8266WebServer::on("/log/query",   handleLogQuery);
+  ESP8266WebServer::on("/link",        handleLinkStats);
   ESP8266WebServer::onNotFound(handleNotFound);
   ESP8266WebServer::begin();
 }
@@ -86,89 +100,80 @@ String main_menu[3][2] = {
   {"Notifications", "/mail_setup"},
 };
 
-void header(const String title, bool refresh = false) {
-  String hdr = "<!DOCTYPE HTML>\n<html><head>\n";
-  if (refresh) hdr += "<meta http-equiv='refresh' content='40'/>";
-  hdr += "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">\n<title>";
-  hdr += title;
-  hdr += "</title>\n";
-  server.sendContent(hdr);
-  server.sendContent_P(style);
+const char page_head[] PROGMEM = "<!DOCTYPE HTML>\n<html><head>\n{0}<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">\n<title>{1}</title>\n";
+const char menu_item[] PROGMEM = "<li><a {0}href='{1}'>{2}</a></li>\n";
+const char menu_tail[] PROGMEM = "<li style='float:right'><a href='/wifi_setup'>{0}</a></li>\n</ul>\n";
+
+// Start the page: the answer header, the page title and the styles
+void header(htmlStream& page, const String title, bool refresh = false) {
+  page.begin();
+  page.fill_P(page_head, {(refresh)?"<meta http-equiv='refresh' content='40'/>":"", title});
+  page.print_P(style);
 }
 
-String mainMenu(byte active, byte active_WM) {
+void mainMenu(htmlStream& page, byte active, byte active_WM) {
   if ((active_WM == 0) && (active >= 3))        // If selected menu item, not water meter
     active = 0;
   byte wm_ID[MAX_WM];
   int wm_num = pool.idList(wm_ID);
-  String menu = "<ul>";
+  page += "<ul>";
   for (byte i = 0; i < 3; ++i) {                // Main menu
-      menu += "<li><a ";
-    if ((active_WM == 0) && (i == active))      // This is active menu item
-      menu += "class='active' ";
-      menu += "href='" + main_menu[i][1] + "'>" + main_menu[i][0] + "</a></li>\n";
+    bool is_active = (active_WM == 0) && (i == active);
+    page.fill_P(menu_item, {(is_active)?"class='active' ":"", main_menu[i][1], main_menu[i][0]});
   }
   for (byte i = 0; i < wm_num; ++i) {           // Water meter
-    menu += "<li><a ";
-    if (active_WM == wm_ID[i])
-      menu += "class='active' ";
-    menu += "href='/wm_info?id="; 
-    menu += String(wm_ID[i]);
-    menu += "'>";
-    menu += cfg.location(wm_ID[i]);
-    menu += "</a></li>\n";
+    page.fill_P(menu_item, {(active_WM == wm_ID[i])?"class='active' ":"", String("/wm_info?id=") + String(wm_ID[i]),
+                            cfg.location(wm_ID[i])});
   }
-  menu += "<li style='float:right'><a href='/wifi_setup'>";
-  menu += ntp.ntpTimeS();
-  menu += "</a></li>\n</ul>\n";
-  return menu;
+  page.fill_P(menu_tail, {ntp.ntpTimeS()});
+}
+
+const char setup_form[] PROGMEM = R"=====(<div align='center'><t1>Network Setup</t1></div><br>
+<form action='/wifi_setup'>
+<div align='center'><fieldset class='myframe'><div class='field'><label for='ssid'>Wifi SSID:</label><input type='text' name='ssid' maxlength='128' value='{0}'></div>
+<div class='field'><label for='passwd'>Wifi Password:</label><input type='text' name='passwd' maxlength='128' value='{1}'></div>
+<div class='field'><label for='auth'>Blynk Auth Key:</label><input type='text' name='auth' maxlength='128' value='{2}'></div>
+<div class='field'><label for='server_name'>NTP Server Name:</label><input type='text' name='server_name' maxlength='128' value='{3}'></div>
+<div class='field'><label for='tz_minute'>Greenwich Difference in Minutes:</label><input type='text' name='tz_minute' value='{4}'></div></fieldset>
+</div><br><div align="center"><input type="submit" value="Apply"></div>
+</form>
+</body>
+</html>)=====";
+
+// The string value of the configuration from the form, the browser limits it by maxlength, the request may not
+String configArg(const char* name) {
+  String v = server.arg(name);
+  if (v.length() > CFG_VALUE_LEN) v = v.substring(0, CFG_VALUE_LEN);
+  return v;
 }
 
 void setupPage(bool menu = true) {
+  htmlStream page(server);
   if (server.args() > 0) {                      // Setup new NTP and WiFi values
-    String sn = server.arg("server_name");
+    String sn = configArg("server_name");
     ntp.srvSet(sn);
     String p = server.arg("tz_minute");
     int tz = p.toInt();
     ntp.tzSet(tz);
     cfg.setNTP(sn, tz);
-    String s = server.arg("ssid");
-    p = server.arg("passwd");    
+    String s = configArg("ssid");
+    p = configArg("passwd");    
     cfg.setWifi(s, p);
-    p = server.arg("auth");
+    p = configArg("auth");
     cfg.setAuth(p);
-    cfg.save();
+    cfg.commit();
   }
-  String body = "<body>";
+  header(page, "setup");
+  page += "<body>";
   if (menu) {
-    body += mainMenu(1, 0);
+    mainMenu(page, 1, 0);
   }
-  body += "<div align='center'><t1>Network Setup";
-  header("setup");
-  body += "</t1></div><br>\n<form action='/wifi_setup'>\n";
-  body += "<div align='center'><fieldset class='myframe'>";
-  body += "<div class='field'><label for='ssid'>Wifi SSID:</label>";
-  body += "<input type='text' name='ssid' value='";
-  body += cfg.ssid();
-  body += "'></div>\n<div class='field'><label for='passwd'>Wifi Password:</label>";
-  body += "<input type='text' name='passwd' value='";
-  body += cfg.passwd();
-  body += "'></div>\n<div class='field'><label for='auth'>Blynk Auth Key:</label>";
-  body += "<input type='text' name='auth' value='";
-  body += cfg.auth();
-  body += "'></div>\n<div class='field'><label for='server_name'>NTP Server Name:</label>";
-  body += "<input type='text' name='server_name' value='";
-  body += cfg.ntp();
-  body += "'></div>\n<div class='field'><label for='tz_minute'>Greenwich Difference in Minutes:</label>";
-  body += "<input type='text' name='tz_minute' value='";
-  body += cfg.tz();
-  body += "'></div></fieldset>\n</div><br><div align=\"center\"><input type=\"submit\" value=\"Apply\"></div>\n";
-  body += "</form>\n</body>\n</html>";
-  server.sendContent(body);
+  page.fill_P(setup_form, {cfg.ssid(), cfg.passwd(), cfg.auth(), cfg.ntp(), String(cfg.tz())});
+  page.end();
 }
 
 String dateStr(time_t ts) {
-  if (ts == 0) ts = ntp.ntpTime();
+  if (ts == 0) ts = hal.clock();
   char buff[15];
   sprintf(buff, "%02d-%02d-%4d", day(ts), month(ts), year(ts));
   return String(buff);
@@ -229,122 +234,199 @@ time_t strDate(String tm) {
 }
 
 //------------------------------------------ URL handlers ------------------------------------------------------
+const char root_table[] PROGMEM = R"=====(<table cellspacing='1' cellpadding='10' border='1' align='center'>
+<tbody>
+<tr>
+<th><h1>Location</h1></th>
+<th><h1>Water</h1></th><th><h1>Serial number</h1></th>
+<th><h1>Data (m<sup>3</sup>)</h1></th>
+<th><h1>Updated</h1></th></tr>)=====";
+
+const char root_row[] PROGMEM = R"=====(<tr>
+<td rowspan='2' colspan='1'><a href="/wm_info?id={0}">{1}</a></td>
+<td>cold water</td><td>{2}</td>
+<td align='right'>{3}</td>
+<td rowspan='2' colspan='1'>{4}</td></tr>
+<tr>
+<td>hot water</td><td>{5}</td>
+<td align="right">{6}</td>
+</tr>
+)=====";
+
+const char root_stats[] PROGMEM = R"=====(</tbody>
+</table><br>
+<div align='center'>Radio packets received: {0}, dropped: {1}<br>Packets accepted: {2}, old format: {3}, lost: {4}, duplicates: {5}, corrupted: {6}, beacons sent: {7}, acknowledgements sent: {8}, channel busy: {9}%)=====";
+
+const char root_untracked[] PROGMEM = ", untracked: {0}";
+const char root_rollup[]  PROGMEM = "<br>Rollups kept for {0} controllers of {1} the flash fits, write errors: {2}";
+const char root_loop[]    PROGMEM = "<br>Main loop: {0} per second, busy: {1}%";
+const char root_section[] PROGMEM = ", {0} {1}% (max {2} ms)";
+const char root_boot[]    PROGMEM = R"=====(<br>Boot time: {0} ms, config loaded from {1} in {2} ms<br>Last page: first byte in {3} ms, heap used {4} bytes</div>
+</body></html>)=====";
+
+// The per mille value as percent
+String permille(uint16_t v) {
+  return String(v / 10.0, 1);
+}
+
+// The counter value, highlighted if it was changed last 15 minutes
+String freshValue(byte ID, bool hot, time_t n) {
+  time_t changed = pool.tsDataChanged(ID, hot);
+  if ((n - changed) < 900)
+    return "<font color='red'>" + pool.valueS(ID, hot) + "</font>";
+  return pool.valueS(ID, hot);
+}
+
 void handleRoot(void) {
-  time_t n = now();
+  htmlStream page(server);
+  time_t n = hal.clock();
   byte wm_ID[MAX_WM];
   byte wm_num = pool.idList(wm_ID);
-  header("Water Meters", true);
-  String body = "<body>";
-  body += mainMenu(0, 0);
-  body += "<div align=\"center\"><t1>Water Meter Data</t1></div>\n";
+  header(page, "Water Meters", true);
+  page += "<body>";
+  mainMenu(page, 0, 0);
+  page += "<div align=\"center\"><t1>Water Meter Data</t1></div>\n";
   if (wm_num == 0) {
-    body += "<h1><div align=\"center\">No controller available</div></h1></body>\n</html>\n"; 
-  } else {
-    body += "<table cellspacing='1' cellpadding='10' border='1' align='center'>\n<tbody>\n<tr>\n";
-    body += "<th><h1>Location</h1></th>\n";
-    body += "<th><h1>Water</h1></th><th><h1>Serial number</h1></th>\n<th><h1>Data (m<sup>3</sup>)</h1></th>\n";
-    body += "<th><h1>Updated</h1></th></tr>";
-    for (byte i = 0; i < wm_num; ++i) {
-      byte ID = wm_ID[i];
-      body += "<tr>\n<td rowspan='2' colspan='1'><a href=\"/wm_info?id=";
-      body += String(ID);
-      body += "\">";
-      body += cfg.location(ID);
-      body += "</a></td>\n<td>cold water</td><td>";
-      body += cfg.serial(ID, false);
-      body += "</td>\n<td align='right'>";
-      time_t changed = pool.tsDataChanged(ID, true);
-      if ((n - changed) < 900) {                // Was changed last 15 minutes
-        body += "<font color='red'>";
-        body += pool.valueS(ID, false);
-        body += "</font>";
-      } else {
-        body += pool.valueS(ID, false);
-      }
-      body += "</td>\n";
-      body += "<td rowspan='2' colspan='1'>";
-      if (pool.battery(ID) > 0) {
-        time_t ts = pool.ts(ID);
-        body += ntp.ntpTimeS(ts);
-      } else {
-        body += String("---");
-      }
-      body += "</td></tr>\n<tr>\n<td>hot water</td><td>";
-      body += cfg.serial(ID, true);
-      body += "</td>\n<td align=\"right\">";
-      changed = pool.tsDataChanged(ID, true);
-      if ((n - changed) < 900) {                // Was changed last 15 minutes
-        body += "<font color='red'>";
-        body += pool.valueS(ID, true);
-        body += "</font>";
-      } else {
-        body += pool.valueS(ID, true);
-      }      body += "</td>\n</tr>\n";
+    page += "<h1><div align=\"center\">No controller available</div></h1></body>\n</html>\n"; 
+    page.end();
+    return;
+  }
+  page.print_P(root_table);
+  for (byte i = 0; i < wm_num; ++i) {
+    byte ID = wm_ID[i];
+    String updated = "---";
+    if (pool.battery(ID) > 0) {
+      updated = ntp.ntpTimeS(pool.ts(ID));
+      if (wm_link.stale(ID))                    // The heartbeats are missed, the data can be out of date
+        updated = "<font color='gray'>" + updated + "<br>no signal</font>";
     }
-    body += "</tbody>\n</table><br>\n</body></html>";
+    page.fill_P(root_row, {String(ID), cfg.location(ID), cfg.serial(ID, false), freshValue(ID, false, n), updated,
+                           cfg.serial(ID, true), freshValue(ID, true, n)});
   }
-  server.sendContent(body);
+  page.fill_P(root_stats, {String(rf22.received()), String(rf22.overflows()), String(wm_link.accepted()),
+                           String(wm_link.legacy()), String(wm_link.lost()), String(wm_link.duplicates()),
+                           String(wm_link.corrupted()), String(wm_link.beaconsSent()), String(wm_link.acksSent()),
+                           permille(wm_link.channelLoad())});
+  if (wm_link.untracked() > 0)                  // More transmitters than the receiver can keep
+    page.fill_P(root_untracked, {String(wm_link.untracked())});
+  wmRollup& roll = data_log.rollups();
+  page.fill_P(root_rollup, {String(roll.controllers()), String(roll.capacity()), String(roll.writeErrors())});
+  page.fill_P(root_loop, {String(loop_profile.loopsPerSecond()), permille(loop_profile.loadTotal())});
+  for (byte s = 0; s < LP_NUM; ++s) {
+    LP_SECTION ls = LP_SECTION(s);
+    page.fill_P(root_section, {loopProfile::name(ls), permille(loop_profile.load(ls)),
+                               String(loop_profile.longestUs(ls) / 1000)});
+  }
+  page.fill_P(root_boot, {String(boot_ms), (cfg.fromSnapshot())?"snapshot":"json", String(cfg.loadTime()),
+                          String(htmlStream::firstByteMs()), String(htmlStream::heapUsed())});
+  page.end();
+}
+
+const char info_ctrl[] PROGMEM = R"=====(<div align='center'><t1>Controller setup</t1></div>
+<form action='/wm_setup'>
+<input type='hidden' name='ctrl_id' value='{0}'>
+<div align='center'>
+<fieldset class='myframe'><legend>Controller (ID = {0})</legend>
+<div class='field'><label for='location'>Location:</label>
+<input type='text' name='location' maxlength='128' value='{1}'></div>
+<div class='field'><label for='voltage'>Battery Voltage:</label>
+<input type='text' name='voltage' value='{2}' readonly></div>
+<div class='field'><label for='frac_size'>Fraction Size:</label>
+<input type='number' min='1' max='4' step='1' name='frac_size' value='{3}'></div></fieldset>
+)=====";
+
+const char info_meter[] PROGMEM = R"=====(<fieldset class='myframe'><legend>{0} Water</legend>
+<div class='field'><label for='sn_{1}'>Serial:</label><input type='text' name='sn_{1}' maxlength='128' value='{2}'></div>
+<div class='field'><label for='maint_{1}'>Next Inspection:</label>
+<input type='text' name='maint_{1}' value='{3}'></div>
+<div class='field'><label for='value_{1}'>Data:</label>
+<input type='number' step=any name='value_{1}' value='{4}'></div>
+</fieldset>
+)=====";
+
+const char info_field[] PROGMEM = "<div class='field'><label>{0}:</label>{1}</div>\n";
+
+const char info_link[] PROGMEM = R"=====(<fieldset class='myframe'><legend>Radio link</legend>
+<div class='field'><label>Signal strength, dBm:</label>{0} (average {1})</div>
+<div class='field'><label>Packets received:</label>{2}</div>
+<div class='field'><label>Packets lost:</label>{3} (by schedule {4})</div>
+<div class='field'><label>Retries after ACK lost:</label>{5}</div>
+<div class='field'><label>Interval, s:</label>{6} (jitter {7} ms)</div>
+<div class='field'><label>Last packet, s ago:</label>{8}</div>
+)=====";
+
+const char info_tail[] PROGMEM = R"=====(</div><br><div align='center'><input type='submit' formaction='/wm_remove' style='margin-right:50px' value='Remove'></td><input type='submit' value='Save'></div>
+</form>
+</body>
+</html>)=====";
+
+// The consumption of the controller in the period ts belongs to from the rollups: cold / hot
+String usedS(byte ID, wmRollup::TIER tier, time_t ts) {
+  uint32_t cold, hot;
+  if (!data_log.rollups().used(ID, tier, ts, cold, hot)) return "---";
+  return pool.amountS(cold) + " / " + pool.amountS(hot);
 }
 
 void handleWMinfo(void) {
-  header("WM setup");
-  String body = "<body>\n";
-  if (server.hasArg("id")) {
-    String id = server.arg("id");
-    byte ID = id.toInt();
-    byte wm_num = pool.numWM();
-    body += mainMenu(0, ID);
-    body += "<div align='center'><t1>Controller setup";
-    String n = "Water Meter ";
-    n += id;
-    body += "</t1></div>\n<form action='/wm_setup'>\n<input type='hidden' name='ctrl_id' value='";
-    body += id;
-    body += "'>\n<div align='center'>\n<fieldset class='myframe'><legend>Controller (ID = ";
-    body += String(ID);
-    body += ")</legend>\n";
-    body += "<div class='field'><label for='location'>Location:</label>\n";
-    body += "<input type='text' name='location' value='";
-    body += cfg.location(ID);
-    body += "'></div>\n<div class='field'><label for='voltage'>Battery Voltage:</label>\n";
-    body += "<input type='text' name='voltage' value='";
-    body += pool.batteryS(ID);
-    body += "' readonly></div>\n<div class='field'><label for='frac_size'>Fraction Size:</label>\n";
-    body += "<input type='number' min='1' max='4' step='1' name='frac_size' value='";
-    body += String(cfg.frac());
-    body += "'></div></fieldset>\n<fieldset class='myframe'><legend>Cold Water</legend>\n";
-    body += "<div class='field'><label for='sn_cold'>Serial:</label><input type='text' name='sn_cold' value='";
-    body += cfg.serial(ID, false);
-    body += "'></div>\n<div class='field'><label for='maint_cold'>Next Inspection:</label>\n";
-    body += "<input type='text' name='maint_cold' value='";
-    time_t nxt = cfg.nextMaintenance(ID, false);
-    body += dateStr(nxt);
-    body += "'></div>\n<div class='field'><label for='value_cold'>Data:</label>\n";
-    body += "<input type='number' step=any name='value_cold' value='";
-    body += pool.valueS(ID, false);
-    body += "'></div>\n</fieldset><fieldset class='myframe'><legend>Hot Water</legend>\n";
-    body += "<div class='field'><label for='sn_hot'>Serial:</label><input type='text' name='sn_hot' value='";
-    body += cfg.serial(ID, true);
-    body += "'></div>\n<div class='field'><label for='maint_hot'>Next Inspection:</label>\n";
-    body += "<input type='text' name='maint_hot' value='";
-    nxt = cfg.nextMaintenance(ID, true);
-    body += dateStr(nxt);
-    body += "'></div>\n<div class='field'><label for='value_hot'>Data:</label><input type='number' step=any name='value_hot' value='";
-    body += pool.valueS(ID, true);
-    body += "'></div></fieldset>\n</div><br>";
-    body += "<div align='center'><input type='submit' formaction='/wm_remove' style='margin-right:50px' value='Remove'></td>";
-    body += "<input type='submit' value='Save'></div>\n";
-    body += "</form>\n</body>\n</html>";
-  } else {
-    body += "<div align='center'><t1>Controller setup";
-    body += "<h1><div align='center'>No controller defined</div></h1></body>\n</html>\n"; 
+  htmlStream page(server);
+  header(page, "WM setup");
+  page += "<body>\n";
+  if (!server.hasArg("id")) {
+    page += "<div align='center'><t1>Controller setup";
+    page += "<h1><div align='center'>No controller defined</div></h1></body>\n</html>\n"; 
+    page.end();
+    return;
+  }
+  byte ID = server.arg("id").toInt();
+  mainMenu(page, 0, ID);
+  page.fill_P(info_ctrl, {String(ID), cfg.location(ID), pool.batteryS(ID), String(cfg.frac())});
+  page.fill_P(info_meter, {"Cold", "cold", cfg.serial(ID, false), dateStr(cfg.nextMaintenance(ID, false)), pool.valueS(ID, false)});
+  page.fill_P(info_meter, {"Hot", "hot", cfg.serial(ID, true), dateStr(cfg.nextMaintenance(ID, true)), pool.valueS(ID, true)});
+  byte channels = pool.channels(ID);
+  if (channels > 2) {
+    page += "<fieldset class='myframe'><legend>Other meters</legend>\n";
+    for (byte ch = 2; ch < channels; ++ch)
+      page.fill_P(info_field, {String("Meter ") + String(ch + 1), String(pool.counter(ID, ch))});
+    page += "</fieldset>\n";
+  }
+  if (hal.clockSet()) {
+    time_t n = hal.clock();
+    wmRollup& roll = data_log.rollups();
+    page += "<fieldset class='myframe'><legend>Consumption, cold / hot</legend>\n";
+    page.fill_P(info_field, {"Today",      usedS(ID, wmRollup::RT_DAY, n)});
+    page.fill_P(info_field, {"Yesterday",  usedS(ID, wmRollup::RT_DAY, roll.prevPeriod(wmRollup::RT_DAY, n))});
+    page.fill_P(info_field, {"This month", usedS(ID, wmRollup::RT_MONTH, n)});
+    page.fill_P(info_field, {"Last month", usedS(ID, wmRollup::RT_MONTH, roll.prevPeriod(wmRollup::RT_MONTH, n))});
+    page += "</fieldset>\n";
+  }
+  const struct link_stats *ls = wm_link.stats(ID);
+  if (ls) {
+    page.fill_P(info_link, {String(ls->rssi), String(wmLink::averageRSSI(ls)), String(ls->received), String(ls->seq_lost),
+                            String(ls->sched_lost), String(ls->retries), String(ls->interval_ms / 1000),
+                            String(ls->jitter_ms), String((hal.ms() - ls->last_ms) / 1000)});
+    uint32_t wear = pool.eepromWear(ID);
+    if (wear > 0) {
+      char value[32];
+      sprintf(value, "%lu.%02d", (unsigned long)(wear / 10000), int(wear % 10000 / 100));
+      String w = value;
+      uint16_t days = pool.eepromLifetime(ID);
+      if (days > 0) {
+        w += " (lifetime ";
+        w += String(days);
+        w += " days)";
+      }
+      page.fill_P(info_field, {"EEPROM wear, %", w});
+    }
+    page += "</fieldset>\n";
   }
-  server.sendContent(body);
+  page.print_P(info_tail);
+  page.end();
 }
 
 void handleWMsetup(void) {
   if (server.hasArg("ctrl_id")) {
     byte ID = server.arg("ctrl_id").toInt();
-    String p  = server.arg("location");
+    String p  = configArg("location");
     if (p.length() > 0)
       cfg.setLocation(ID, p);
     p = server.arg("frac_size");
@@ -361,16 +443,16 @@ void handleWMsetup(void) {
     long hot_shift  = pool.shift(ID, true);
     cfg.updateWM(ID, cold_shift, hot_shift);
 
-    String sn = server.arg("sn_cold");
+    String sn = configArg("sn_cold");
     p = server.arg("maint_cold");
     time_t nxt = strDate(p);
     cfg.updateWMserial(ID, false, sn, nxt);
-    sn = server.arg("sn_hot");
+    sn = configArg("sn_hot");
     p  = server.arg("maint_hot");
     nxt = strDate(p);
     cfg.updateWMserial(ID, true, sn, nxt);
   }
-  cfg.save();
+  cfg.commit();
   e_notify.init();
   blynkInfoRefresh();                           // Defined in the main file
   server.sendHeader("Location", String("/"), true);
@@ -382,30 +464,57 @@ void handleWMremove(void) {
     byte ID = server.arg("ctrl_id").toInt();
     cfg.removeWM(ID);
     e_notify.init();
-    cfg.save();
+    cfg.commit();
   }
   server.sendHeader("Location", String("/"), true);
   server.send(302, "text/plain", "");
 }
 
+const char mail_form[] PROGMEM = R"=====(<div align='center'>
+<form method='post' action='/mail_setup'><fieldset class='myframe'><legend>Mail Relay Server</legend><div class='field'><label for='host'>Server Name:</label><input type='text' name='host' maxlength='128' value='{0}'></div>
+<div class='field'><label for='port'>Port:</label><input type='number' step='1' min='25' max='65536' name='port' value='{1}'></div>
+<div class='field'><label for='user'>User Name:</label><input type='text' name='user' maxlength='128' value='{2}'></div>
+<div class='field'><label for='password'>Password:</label><input type='password' name='password' maxlength='128' size='20' value='{3}'></div>
+<div class='field'><label for='sender'>Sender Address:</label><input type='email' name='sender' maxlength='128' value='{4}'></div>
+<div align='right'><input type='hidden' name='ssl'{5}></div></fieldset>
+<fieldset class='myframe'><legend>Notifications</legend>
+<div class='field'><label for='address'>Send To:</label><input type='email' name='address' maxlength='128' value='{6}'></div>
+<div align='left' class='myheader'>Notification Types:</div>
+<div class='field'><label for='tr_urgent'>Urgent Inspection (days):</label><input type='number' min='0' max='30' step='1' name='tr_urgent' value='{7}'></div>
+<div class='field'><label for='tr_warn'>Warning About Inspection (days):</label><input type='number' min='0' max='100' step='1' name='tr_warn' value='{8}'></div>
+<div class='field'><label for='period'>Water Meter Data Send Period:</label>
+<select name='period'>
+)=====";
+
+const char mail_option[] PROGMEM = "<option value='{0}'{1}>{2}</option>\n";
+
+const char mail_tail[] PROGMEM = R"=====(</select></div>
+<div class='field'><label for='period_value'>Send At:</label><input type='text' name='period_value' value='{0}'></div>
+</fieldset>
+<div style='margin-top:30px'><input type='submit' value='Apply'></div>
+</form>
+<div>Last letter: {1}</div></div></body>
+</html>)=====";
+
 void handleMailsetup(void) {
+  htmlStream page(server);
   if (server.args() > 0) {                      // submit button pressed, setup new values
     mailValidate *mv = new mailValidate;
-    String sn = server.arg("host");
+    String sn = configArg("host");
     sn = mv->validateFQDN(sn);
     String value = server.arg("port");
     uint16_t p = value.toInt();
     value = server.arg("ssl");
     bool ssl = (value.compareTo("on") == 0);
     cfg.setSmtpRelayHost(sn, p, ssl);
-    String user = server.arg("user");
-    String pass = server.arg("password");
+    String user = configArg("user");
+    String pass = configArg("password");
     cfg.setSmtpAuthUser(user, pass);
-    value = server.arg("sender");
+    value = configArg("sender");
     value = mv->validateEmail(value);
     cfg.setSmtpRelayFrom(value);
 
-    value = server.arg("address");
+    value = configArg("address");
     value = mv->validateEmail(value);
     cfg.setSmtpEmailTo(value);
     value = server.arg("tr_urgent");
@@ -417,64 +526,24 @@ void handleMailsetup(void) {
     value = server.arg("period_value");
     cfg.setDataSendPeriod(period, value);
     delete mv;
-    cfg.save();
+    cfg.commit();
     e_notify.init();
     e_notify.testLetter();                      // Send test letter in one minute!
   }
-  header("Mail setup");
-  String body = "<body>\n";
-  body += mainMenu(2, 0);
-  body += "<div align='center'>\n<form method='post' action='/mail_setup'>";
-  body += "<fieldset class='myframe'><legend>Mail Relay Server</legend>";
-  body += "<div class='field'><label for='host'>Server Name:</label>";
-  body += "<input type='text' name='host' value='";
-  body += cfg.smtpRelayHost();
-  body +="'></div>\n<div class='field'><label for='port'>Port:</label>";
-  body += "<input type='number' step='1' min='25' max='65536' name='port' value='";
-  body += cfg.smtpRelayPort();
-  body += "'></div>\n<div class='field'><label for='user'>User Name:</label>";
-  body += "<input type='text' name='user' value='";
-  body += cfg.smtpAuthUser();
-  body += "'></div>\n<div class='field'><label for='password'>Password:</label>";
-  body += "<input type='password' name='password' size='20' value='";
-  body += cfg.smtpAuthPass();
-  body += "'></div>\n<div class='field'><label for='sender'>Sender Address:</label>";
-  body += "<input type='email' name='sender' value='";
-  body += cfg.smtpRelayFrom();
-  body += "'></div>\n<div align='right'><input type='hidden' name='ssl'";
-  if (cfg.smtpRelaySSL()) {
-    body += " checked";
-  }
-  body += "></div></fieldset>\n";
-  body += "<fieldset class='myframe'><legend>Notifications</legend>\n";
-  body += "<div class='field'><label for='address'>Send To:</label>";
-  body += "<input type='email' name='address' value='";
-  body += cfg.smtpEmailTo();
-  body += "'></div>\n<div align='left' class='myheader'>Notification Types:</div>\n";
-  body += "<div class='field'><label for='tr_urgent'>Urgent Inspection (days):</label>";
-  body += "<input type='number' min='0' max='30' step='1' name='tr_urgent' value='";
-  body += cfg.urgentMaintDays();
-  body += "'></div>\n<div class='field'><label for='tr_warn'>Warning About Inspection (days):</label>";
-  body += "<input type='number' min='0' max='100' step='1' name='tr_warn' value='";
-  body += cfg.warnMaintDays();
-  body += "'></div>\n<div class='field'><label for='period'>Water Meter Data Send Period:</label>\n";
+  header(page, "Mail setup");
+  page += "<body>\n";
+  mainMenu(page, 2, 0);
+  page.fill_P(mail_form, {cfg.smtpRelayHost(), String(cfg.smtpRelayPort()), cfg.smtpAuthUser(), cfg.smtpAuthPass(),
+                          cfg.smtpRelayFrom(), (cfg.smtpRelaySSL())?" checked":"", cfg.smtpEmailTo(),
+                          cfg.urgentMaintDays(), cfg.warnMaintDays()});
 
   // Create the drop-down menu, (type='select') based on possible values on config class, see config.h
-  body += "<select name='period'>\n";
   byte period = cfg.dataSendPeriod();
   for (byte i = 0; i < cfg.numDataSendPeriods(); ++i) {
-    body += "<option value='" + cfg.dataSendPeriodName(i) + "'";
-    if (period == i) body += " selected";
-    body += ">" + cfg.dataSendPeriodLabel(i) + "</option>\n";
+    page.fill_P(mail_option, {cfg.dataSendPeriodName(i), (period == i)?" selected":"", cfg.dataSendPeriodLabel(i)});
   }
-  body += "</select></div>\n";
-  
-  body += "<div class='field'><label for='period_value'>Send At:</label><input type='text' name='period_value' value='";
-  body += cfg.dataSendAt();
-  body += "'></div>\n</fieldset>\n<div style='margin-top:30px'>"; 
-  body += "<input type='submit' value='Apply'></div>\n";
-  body += "</form></div></body>\n</html>";
-  server.sendContent(body);
+  page.fill_P(mail_tail, {cfg.dataSendAt(), e_notify.status()});
+  page.end();
 }
 
 void handleSetup(void) {
@@ -485,14 +554,60 @@ void initialSetup(void) {
   setupPage(false);
 }
 
+// Stream the binary log file as text, one record per line: ID, timestamp, cold and hot water counters
+void streamLog(const String& fn) {
+  fs::File f = hal.fileSystem().open(fn, "r");
+  if (!f) {
+    handleNotFound();
+    return;
+  }
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain", "");
+  f.seek(sizeof(struct log_header), fs::SeekSet);
+  struct log_record rec[8];
+  while (true) {
+    int rb = f.read((byte *)rec, sizeof(rec));
+    byte n = rb / sizeof(struct log_record);
+    if (n == 0) break;
+    String chunk = "";
+    for (byte i = 0; i < n; ++i) {
+      if (!wmlog::validRecord(rec[i])) continue;
+      char line[48];
+      sprintf(line, "%d,%lu,%lu,%lu\n", rec[i].ID, (unsigned long)rec[i].ts,
+              (unsigned long)rec[i].cold, (unsigned long)rec[i].hot);
+      chunk += line;
+    }
+    if (chunk.length() > 0)
+      server.sendContent(chunk);
+  }
+  f.close();
+  server.sendContent("");                       // The last chunk
+}
+
+const char log_head[] PROGMEM = R"=====(<div align='center'><h1>Water Meter logs</h1></div><table cellspacing='1' cellpadding='10' border='0' align='center'>
+<tbody>
+<tr>
+)=====";
+
+const char log_row[]  PROGMEM = "<td align='left'><a href='/log?fn={0}'>{0}</a></td><td align='right'>{1}</td><td><a href='/log?remove=1&fn={0}'>remove</a></td></tr>\n";
+
+const char log_tail[] PROGMEM = R"=====(</tbody></table>
+<div align='center'>Log buffer: {0} records pending, {1} writes, {2} bytes written, last write {3} ms, longest write {4} ms</div></body>
+</html>)=====";
+
 void handleWMlog(void) {
+  data_log.flush();                             // Show the actual log data
   if (server.args() > 0) {                      // File has been selected
     if (server.hasArg("fn")) {
       String fn = server.arg("fn");
       if (server.hasArg("remove")) {
-        SPIFFS.remove(fn);
+        hal.fileSystem().remove(fn);
+      } else
+      if (wmlog::isLogFile(fn)) {
+        streamLog(fn);
+        return;
       } else {
-        fs::File f = SPIFFS.open(fn, "r");
+        fs::File f = hal.fileSystem().open(fn, "r");
         server.streamFile(f, "text/html");
         f.close();
         return;
@@ -500,20 +615,15 @@ void handleWMlog(void) {
     }
   }
   
-  header("WM Log");
-  String body = "<body>\n";
-  body += "<div align='center'><h1>Water Meter logs</h1></div>";
-  body += "<table cellspacing='1' cellpadding='10' border='0' align='center'>\n<tbody>\n<tr>\n";
-  fs::Dir dir = SPIFFS.openDir("/");
+  htmlStream page(server);
+  header(page, "WM Log");
+  page += "<body>\n";
+  page.print_P(log_head);
+  fs::Dir dir = hal.fileSystem().openDir("/");
   while (dir.next()) {
     String fn = dir.fileName();
-    if (fn.indexOf(".log") == -1)
+    if (fn.indexOf(".log") == -1 && !wmlog::isLogFile(fn))
       continue;
-    body += "<td align='left'><a href='/log?fn=";
-    body += fn;
-    body += "'>";
-    body += fn;
-    body += "</a></td><td align='right'>";
     uint32_t s = dir.fileSize();
     char m = ' ';
     if (s >= 1024) {
@@ -524,13 +634,97 @@ void handleWMlog(void) {
         m = 'M';
       }
     }
-    body += String(s) + m;
-    body += "</td><td><a href='/log?remove=1&fn=";
-    body += fn;
-    body += "'>remove</a></td></tr>\n";
+    page.fill_P(log_row, {fn, String(s) + m});
+  }
+  page.fill_P(log_tail, {String(data_log.pending()), String(data_log.flushCount()), String(data_log.bytesWritten()),
+                         String(data_log.lastFlushTime()), String(data_log.maxFlushTime())});
+  page.end();
+}
+
+// Write the line of the log query answer into the buffer of size bytes, returns the line length as snprintf() does
+int queryLine(char* buff, size_t size, bool json, bool first, const struct log_bucket& b) {
+  if (json)
+    return snprintf(buff, size, "%s{\"ts\":%lu,\"cold\":%lu,\"hot\":%lu,\"used_cold\":%lu,\"used_hot\":%lu}",
+                    (first)?"":",", (unsigned long)b.ts, (unsigned long)b.cold, (unsigned long)b.hot,
+                    (unsigned long)b.used_cold, (unsigned long)b.used_hot);
+  return snprintf(buff, size, "%lu,%lu,%lu,%lu,%lu\n", (unsigned long)b.ts, (unsigned long)b.cold,
+                  (unsigned long)b.hot, (unsigned long)b.used_cold, (unsigned long)b.used_hot);
+}
+
+/*
+ * The log data of one controller aggregated by step: /log/query?id=<ID>&from=<unixtime>&to=<unixtime>&step=<sec>&format=<csv|json>
+ * The default range is the last week by day. The answer is built in the small fixed buffer and sent by chunks:
+ * the buffer is sent when the next line does not fit into the rest of it. The months those log files have been
+ * removed are answered from the rollups (see logQuery).
+ */
+void handleLogQuery(void) {
+  data_log.flush();                             // Query the actual log data
+  byte     ID   = server.arg("id").toInt();
+  time_t   to   = (server.hasArg("to"))?time_t(server.arg("to").toInt()):hal.clock();
+  time_t   from = (server.hasArg("from"))?time_t(server.arg("from").toInt()):to - 7 * 86400;
+  uint32_t step = (server.hasArg("step"))?server.arg("step").toInt():86400;
+  bool     json = (server.arg("format") == "json");
+  if (step < 60) step = 60;
+  if (ID == 0 || from >= to) {
+    server.send(400, "text/plain", "Wrong query parameters\n");
+    return;
+  }
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, (json)?"application/json":"text/csv", "");
+  char out[512];
+  uint16_t len = 0;
+  if (json)
+    len = snprintf(out, sizeof(out), "{\"id\":%d,\"from\":%lu,\"to\":%lu,\"step\":%lu,\"data\":[", ID,
+                   (unsigned long)from, (unsigned long)to, (unsigned long)step);
+  else
+    len = snprintf(out, sizeof(out), "ts,cold,hot,used_cold,used_hot\n");
+
+  logQuery q(data_log.rollups(), ID, from, to, step);
+  struct log_bucket b;
+  bool first = true;
+  while (q.next(b)) {
+    int n = queryLine(out + len, sizeof(out) - len, json, first, b);
+    if (len + n >= sizeof(out)) {               // No room for the line, send the buffer and write the line again
+      server.sendContent(out, len);
+      len = 0;
+      n = queryLine(out, sizeof(out), json, first, b);
+    }
+    len += n;
+    first = false;
+    yield();
+  }
+  if (json) {
+    if (len + 3 >= sizeof(out)) {
+      server.sendContent(out, len);
+      len = 0;
+    }
+    len += snprintf(out + len, sizeof(out) - len, "]}\n");
   }
-  body += "</tbody></table></body>\n</html>";
-  server.sendContent(body);
+  if (len > 0)
+    server.sendContent(out, len);
+  server.sendContent("");                       // The last chunk
+}
+
+// The link statistics of all the transmitters in json format, streamed by chunks: the whole list does not fit the heap
+void handleLinkStats(void) {
+  htmlStream page(server);
+  page.begin("application/json");
+  page += '[';
+  uint32_t n = hal.ms();
+  for (byte i = 0; i < wm_link.numPeers(); ++i) {
+    byte ID = wm_link.peerID(i);
+    const struct link_stats *ls = wm_link.stats(ID);
+    char buff[224];
+    sprintf(buff, "%s\n{\"id\":%d,\"slot\":%d,\"rssi\":%d,\"rssi_avg\":%d,\"received\":%lu,\"lost\":%lu,\"lost_schedule\":%lu,"
+                  "\"interval_ms\":%lu,\"jitter_ms\":%lu,\"age_s\":%lu}", (i)?",":"", ID, wm_link.txSlot(ID), ls->rssi, wmLink::averageRSSI(ls),
+                  (unsigned long)ls->received, (unsigned long)ls->seq_lost, (unsigned long)ls->sched_lost,
+                  (unsigned long)ls->interval_ms, (unsigned long)ls->jitter_ms, (unsigned long)((n - ls->last_ms) / 1000));
+    page += buff;
+    yield();
+  }
+  page += "\n]\n";
+  page.end();
 }
 
 void handleNotFound(void) {
@@ -549,4 +743,4 @@ void handleNotFound(void) {
 
   server.send(404, "text/plain", message);
 }
-
+
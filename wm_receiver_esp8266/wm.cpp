@@ -4,6 +4,11 @@
 void WM::init(void) {
   ID = 0;
   updated = 0;
+  ee_wear = wear_start = 0;
+  wear_ts = 0;
+  num_channels = 2;
+  for (byte i = 0; i < WM_MAX_CHANNELS-2; ++i)
+    extra[i] = 0;
   for (byte i = 0; i < 2; ++i) {
     wm_data[i]          = 0;
     wm_shift[i]         = 0;
@@ -26,13 +31,13 @@ long WM::data(bool hot) {
 
 void WM::setValue(bool hot, long d, time_t ts) {
   if (wm_data[byte(hot)] && (wm_data[byte(hot)] != d)) {
-    ts_data_changed[byte(hot)] = now();
+    ts_data_changed[byte(hot)] = hal.clock();
   }
   wm_data[byte(hot)] = d;
   if (ts) {
     updated = ts;
   } else {
-    updated = now();
+    updated = hal.clock();
   }
 }
 
@@ -40,105 +45,139 @@ void WM::setAbsValue(bool hot, long d) {
   wm_shift[byte(hot)] = d - wm_data[byte(hot)];
 }
 
+void WM::setWear(uint32_t ppm) {
+  if (ppm == 0) return;                         // Not reported
+  if (wear_ts == 0 || ppm < wear_start) {       // The first report or the EEPROM of the controller has been erased
+    wear_start = ppm;
+    wear_ts    = hal.clock();
+  }
+  ee_wear = ppm;
+}
+
+void WM::setCounters(const struct data &wmd) {
+  if (wmd.channels < 2) return;
+  num_channels = wmd.channels;
+  for (byte ch = 2; ch < num_channels; ++ch)
+    extra[ch-2] = wmd.wm_data[ch];
+}
+
+// Extrapolate the wear rate observed since the first report
+uint16_t WM::lifetime(void) {
+  if (wear_ts == 0 || ee_wear <= wear_start || ee_wear >= 1000000) return 0;
+  uint32_t elapsed = hal.clock() - wear_ts;
+  uint32_t days = uint64_t(1000000 - ee_wear) * elapsed / (ee_wear - wear_start) / 86400;
+  return (days < 0xFFFF)?days:0xFFFF;
+}
+
 //------------------------------------------ water meter pool --------------------------------------------------
 void WMpool::WMinit(byte ID, long cold_shift, long hot_shift) {
-  byte indx = index(ID);
-  wm[indx].WMinit(ID, cold_shift, hot_shift);
+  WM* w = wm.add(ID);
+  if (w) w->WMinit(ID, cold_shift, hot_shift);
 }
 
+// The new controller is registered when its first packet received
 void WMpool::update(struct data &wmd, time_t ts) {
-  byte indx = index(wmd.ID);
-  if (indx >= MAX_WM) return;
-  wm[indx].setBattery(wmd.batt_mv);
+  WM* w = wm.add(wmd.ID);
+  if (!w) return;
+  w->setID(wmd.ID);
+  w->setBattery(wmd.batt_mv);
+  w->setWear(wmd.ee_wear);
+  w->setCounters(wmd);
   for (byte i = 0; i < 2; ++i)
-    wm[indx].setValue(i, wmd.wm_data[i], ts);
-}
-
-byte WMpool::numWM(void) {
-  byte n = 0;
-  for (byte i = 0; i < MAX_WM; ++i) {
-    if (wm[i].id()) ++n;
-  }
-  return n;
+    w->setValue(i, wmd.wm_data[i], ts);
 }
 
 byte WMpool::idList(byte list[MAX_WM]) {
-  byte n = 0;
-  for (byte i = 0; i < MAX_WM; ++i) {
-    if (wm[i].id()) {
-      list[n] = wm[i].id();
-      ++n;
-    }
-  }
+  byte n = wm.size();
+  for (byte i = 0; i < n; ++i)
+    list[i] = wm.id(i);
   return n;
 }
 
-byte WMpool::index(byte ID) {
-  for (byte i = 0; i < MAX_WM; ++i) {
-    if (wm[i].id() == ID) return i;
-  }
-  for (byte i = 0; i < MAX_WM; ++i) {
-    if (wm[i].id() == 0) {
-      wm[i].setID(ID);
-      return i;
-    }
-  }
-  return MAX_WM;
-}
-
 long WMpool::value(byte ID, bool hot) {
-  byte indx = index(ID);
-  if (indx < MAX_WM)
-    return wm[indx].data(hot);
+  WM* w = wm.find(ID);
+  if (w)
+    return w->data(hot);
   return 0;
 }
 
 String WMpool::valueS(byte ID, bool hot) {
   if (battery(ID) > 0) {
-    long v = value(ID, hot);
-    char buff[10];
-    byte i = 8;
-    for ( ; i > 0; --i) {                       // Write the long value from right to left, last <frac_size> digits are decimal fraction
-      if (i == 8 - frac_size) {                 // Where the decimal point should be placed
-        buff[i] = '.';                          // Place the decimal point
-        --i;
-      }
-      buff[i] = char(v % 10 + '0');
-      v /= 10;
-      if (v == 0 && (i < 8-frac_size)) break;   // Surely stop on integer part, not decimal fraction
-    }
-    buff[9] = '\0';
-    return String(&buff[i]);
+    return amountS(value(ID, hot));
   } else {
     return String("???");
   }
 }
 
+String WMpool::amountS(long v) {
+  char buff[10];
+  byte i = 8;
+  for ( ; i > 0; --i) {                         // Write the long value from right to left, last <frac_size> digits are decimal fraction
+    if (i == 8 - frac_size) {                   // Where the decimal point should be placed
+      buff[i] = '.';                            // Place the decimal point
+      --i;
+    }
+    buff[i] = char(v % 10 + '0');
+    v /= 10;
+    if (v == 0 && (i < 8-frac_size)) break;     // Surely stop on integer part, not decimal fraction
+  }
+  buff[9] = '\0';
+  return String(&buff[i]);
+}
+
 long WMpool::shift(byte ID, bool hot) {
-  byte indx = index(ID);
-  if (indx < MAX_WM)
-    return wm[indx].shift(hot);
+  WM* w = wm.find(ID);
+  if (w)
+    return w->shift(hot);
   return 0;
 }
 
 time_t WMpool::ts(byte ID) {
-  byte indx = index(ID);
-  if (indx < MAX_WM)
-    return wm[indx].ts();
+  WM* w = wm.find(ID);
+  if (w)
+    return w->ts();
   return 0;
 }
 
 time_t WMpool::tsDataChanged(byte ID, bool hot) {
-  byte indx = index(ID);
-  if (indx < MAX_WM)
-    return wm[indx].tsDataChanged(hot);
+  WM* w = wm.find(ID);
+  if (w)
+    return w->tsDataChanged(hot);
   return 0;
 }
 
 uint16_t WMpool::battery(byte ID) {
-  byte indx = index(ID);
-  if (indx < MAX_WM)
-    return wm[indx].battery();
+  WM* w = wm.find(ID);
+  if (w)
+    return w->battery();
+  return 0;
+}
+
+uint32_t WMpool::eepromWear(byte ID) {
+  WM* w = wm.find(ID);
+  if (w)
+    return w->wear();
+  return 0;
+}
+
+uint16_t WMpool::eepromLifetime(byte ID) {
+  WM* w = wm.find(ID);
+  if (w)
+    return w->lifetime();
+  return 0;
+}
+
+byte WMpool::channels(byte ID) {
+  WM* w = wm.find(ID);
+  if (w)
+    return w->channels();
+  return 0;
+}
+
+uint32_t WMpool::counter(byte ID, byte ch) {
+  WM* w = wm.find(ID);
+  if (w)
+    return w->counter(ch);
   return 0;
 }
 
@@ -153,14 +192,14 @@ String WMpool::batteryS(byte ID) {
 }
 
 void WMpool::setAbsValue(byte ID, bool hot, long value) {
-  byte indx = index(ID);
-  if (indx < MAX_WM)
-    wm[indx].setAbsValue(hot, value);
+  WM* w = wm.find(ID);
+  if (w)
+    w->setAbsValue(hot, value);
 }
 
 void WMpool::setAbsValueS(byte ID, bool hot, String value) {
-  byte indx = index(ID);
-  if (indx < MAX_WM) {
+  WM* w = wm.find(ID);
+  if (w) {
     long v = 0;
     bool fr = false;
     byte frac_read = 0;
@@ -179,6 +218,6 @@ void WMpool::setAbsValueS(byte ID, bool hot, String value) {
     for (byte i = frac_read; i < frac_size; ++i) {
       v *= 10; 
     }
-    wm[indx].setAbsValue(hot, v);
+    w->setAbsValue(hot, v);
   }
-}
+}
@@ -4,11 +4,12 @@
 #include <Time.h>
 #include <TimeLib.h>
 #include "config.h"
+#include "registry.h"
 
 //------------------------------------------ water meter data --------------------------------------------------
 class WM {
   public:
-    WM()                                        { }
+    WM()                                        { init(); }
     void      init(void);
     void      WMinit(byte wm_ID, long cold_shift, long hot_shift);
     byte      id(void)                          { return ID; }
@@ -20,7 +21,13 @@ class WM {
     void      setID(byte id)                    { ID = id; }
     void      setValue(bool hot, long d, time_t ts = 0);
     void      setAbsValue(bool hot, long d);
-    void      setBattery(uint16_t mv)           { batt_mv = mv; updated = now(); }
+    void      setBattery(uint16_t mv)           { batt_mv = mv; updated = hal.clock(); }
+    void      setWear(uint32_t ppm);
+    uint32_t  wear(void)                        { return ee_wear; }
+    uint16_t  lifetime(void);                   // Expected EEPROM lifetime in days by the wear rate, 0 if unknown
+    byte      channels(void)                    { return num_channels; }
+    uint32_t  counter(byte ch)                  { return (ch >= 2 && ch < num_channels)?extra[ch-2]:0; }
+    void      setCounters(const struct data &wmd);  // The meters other than cold and hot water
   private:
     uint16_t  batt_mv;                          // The battery moltage, mV
     byte      ID;                               // WM controller ID, must be > 0
@@ -28,32 +35,41 @@ class WM {
     long      wm_shift[2];                      // Cold and Hot water shift to ubtain the absolute value
     time_t    ts_data_changed[2];               // Time the data for cold and hot water was changed
     time_t    updated;                          // Time the last data received from the WM controller
+    uint32_t  ee_wear;                          // The EEPROM wear of the WM controller, ppm
+    uint32_t  wear_start;                       // The EEPROM wear when the first report received
+    time_t    wear_ts;                          // Time the first EEPROM wear report received
+    byte      num_channels;                     // The number of the meters of the controller
+    uint32_t  extra[WM_MAX_CHANNELS-2];         // The raw data of the other meters: gas, heat, ...
 };
 
 //------------------------------------------ water meter pool --------------------------------------------------
 class WMpool {
   public:
-    WMpool()                                      { }   
-    void     init(void)                           { for (byte i = 0; i < MAX_WM; ++i) wm[i].init(); frac_size = 2; }
+    WMpool() : wm(MAX_WM)                         { frac_size = 2; }
+    void     init(void)                           { wm.clear(); frac_size = 2; }
     void     update(struct data &wmd, time_t ts = 0);
     void     WMinit(byte ID, long cold_shift, long hot_shift);
-    byte     numWM(void);
+    byte     numWM(void)                          { return wm.size(); }
     byte     idList(byte list[MAX_WM]);           // Number of water meters registered in the pool. Modifies lsit with its IDs
-    byte     id(byte index)                       { if (index < MAX_WM) return wm[index].id(); return 0; }
+    byte     id(byte index)                       { return wm.id(index); }
     long     value(byte ID, bool hot);
     String   valueS(byte ID, bool hot);
+    String   amountS(long v);                     // The counter value or the consumption with the decimal fraction
     long     shift(byte ID, bool hot);
     time_t   ts(byte ID);
     time_t   tsDataChanged(byte ID, bool hot);
     uint16_t battery(byte ID);
     String   batteryS(byte ID);
+    uint32_t eepromWear(byte ID);                 // The EEPROM wear of the controller, ppm of the endurance
+    uint16_t eepromLifetime(byte ID);             // The expected EEPROM lifetime of the controller, days
+    byte     channels(byte ID);                   // The number of the meters of the controller
+    uint32_t counter(byte ID, byte ch);           // The raw data of the meter ch >= 2
     void     setAbsValue(byte ID, bool hot, long value);
     void     setAbsValueS(byte ID, bool hot, String value);
     void     setFractionDigits(byte f)            { frac_size = f; }
   private:
-    byte     index(byte ID);
-    WM       wm[MAX_WM];
+    wmRegistry<WM> wm;
     byte     frac_size;                           // The float fraction size (decimal digits)
 };
 
-#endif
+#endif
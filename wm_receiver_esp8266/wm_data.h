@@ -1,14 +1,146 @@
 #ifndef _ESP_WM_DATA_H
 #define _ESP_WM_DATA_H
 
+#include <Arduino.h>
+
 /* 
  *  The remote sensor uses this packet structure to send the water meter information to the central controller
  */
+#define WM_MAX_CHANNELS 8                       // The maximum number of the meters of one controller
+
 struct data {                                   // The data to be transmitted to the WaterMeter Node
+  uint32_t wm_data[WM_MAX_CHANNELS];            // Cold water, hot water, then the other meters
+  uint16_t batt_mv;
+  byte     ID;
+  uint32_t ee_wear;                             // The EEPROM wear of the transmitter, ppm of the endurance. Not sent by the old transmitters
+  byte     channels;                            // The number of the meters
+};
+const byte pl_size    = sizeof(struct data);    // The size of the structure
+const byte legacy_size = 11;                    // The size of the old packet: the raw struct data sent by the atmega328p
+const byte tx_period_base = 40;                 // The transmitter sends the data every (tx_period_base + ID) seconds
+const byte tx_period_spread = 8;                // The transmitter of version 4 without the slot adds 0 to 7 seconds at random
+const byte heartbeat_periods = 10;              // The adaptive transmitter sends the data every 10-th period at least
+
+/*
+ *  The versioned packet. The header is followed by the payload of the packet type and CRC16 of the header and the payload.
+ *  The sequence number is incremented by the transmitter for every packet, the first packet after power on has
+ *  PKT_F_BOOT flag set. The wire structures are packed because the transmitter and the receiver align data differently.
+ */
+const byte pkt_magic   = 0x57;                  // 'W'
+const byte pkt_version = 4;
+const byte pkt_v1_size = 19;                    // The size of PKT_DATA packet of version 1, without ee_wear field
+
+#define PKT_DATA    1                           // The packet types: the water meter counters
+#define PKT_HISTORY 2                           //                   the old counter snapshots, version 3
+#define PKT_BEACON  3                           //                   the receiver time and the transmit slots, version 4
+#define PKT_ACK     4                           //                   the acknowledgement of the data packet, version 3
+#define PKT_F_BOOT  0x01                        // The packet flags: the first packet after the transmitter reset
+#define PKT_F_LISTEN 0x02                       //                   the transmitter waits for the beacon after the packet
+#define PKT_F_SLOT  0x04                        //                   the packet is sent in the assigned slot
+#define PKT_F_ADAPTIVE 0x08                     //                   the periods without changes are skipped, see heartbeat_periods
+#define PKT_F_ACK   0x10                        //                   the transmitter retries the packet till it is acknowledged
+
+struct __attribute__((packed)) pkt_header {
+  byte     magic;
+  byte     version;
+  byte     type;
+  byte     flags;
+  byte     ID;                                  // The transmitter ID
+  uint16_t seq;                                 // The packet sequence number
+};
+
+struct __attribute__((packed)) pkt_data_v2 {    // PKT_DATA packet of version 1 and 2, cold and hot water meters only
+  struct   pkt_header hdr;
   uint32_t wm_data[2];
   uint16_t batt_mv;
+  uint32_t ee_wear;                             // The EEPROM wear, ppm of the endurance of the most worn cell. Version 2
+  uint16_t crc;
+};
+
+struct __attribute__((packed)) pkt_data {       // PKT_DATA packet, only <channels> elements of wm_data are sent
+  struct   pkt_header hdr;
+  uint16_t batt_mv;
+  uint32_t ee_wear;                             // The EEPROM wear, ppm of the endurance of the most worn cell
+  byte     channels;                            // The number of the meters
+  uint32_t wm_data[WM_MAX_CHANNELS];
+  uint16_t crc;
+};
+const byte pkt_data_size = sizeof(struct pkt_data) - WM_MAX_CHANNELS * sizeof(uint32_t);  // The size without the counters
+
+/*
+ *  The history packet: the snapshots of the counters kept by the transmitter, so the receiver can fill the gaps
+ *  in the log after it was down. The header is followed by the number of the meters, the number of the snapshots,
+ *  the snapshots and CRC16. Each snapshot is uint16_t age, minutes before the packet was sent,
+ *  and uint32_t wm_data[channels].
+ */
+struct __attribute__((packed)) pkt_history_hdr {
+  struct   pkt_header hdr;
+  byte     channels;                            // The number of the meters
+  byte     records;                             // The number of the snapshots
+};
+
+const byte hist_max_records = 8;                // The maximum number of the snapshots in the packet
+struct history {                                // The decoded history packet, cold and hot water only
   byte     ID;
+  byte     records;
+  uint16_t age[hist_max_records];               // The snapshot age, minutes before the packet was sent
+  uint32_t wm_data[hist_max_records][2];
+};
+
+/*
+ *  The transmit slots. The time is divided into the frames of frame_slots slots, every transmitter gets its own slot
+ *  and sends one packet per frame at the beginning of the slot. The frame time is kept by the receiver.
+ *  The receiver answers the packet with PKT_F_LISTEN flag by the beacon: the current position in the frame and
+ *  the slot assignments. The header is followed by the slot records and CRC16. The beacon ID is 0.
+ *  The transmitter the receiver has no slot for is left out of the beacon and keeps the random period.
+ *  The slot fits the data packet, the answer and the history packet after the guard time. The frame of 256 slots
+ *  is 192 seconds long, so the position in the frame is 32 bits since version 4, the transmitters of version 3 reject
+ *  the beacon by its size.
+ */
+const uint16_t frame_slots = 256;               // The number of the slots in the frame
+const uint16_t slot_ms     = 750;               // The slot length, ms
+const uint16_t slot_guard  = 200;               // The transmitter starts sending this time after the slot begins, ms
+const uint16_t beacon_listen_ms = 300;          // The time the transmitter waits for the beacon
+
+struct __attribute__((packed)) pkt_beacon_hdr {
+  struct   pkt_header hdr;
+  uint32_t frame_ms;                            // The position in the frame at the end of the beacon, ms
+  byte     records;                             // The number of the slot records
+};
+
+struct __attribute__((packed)) beacon_slot {
+  byte     ID;                                  // The transmitter ID
+  byte     slot;                                // The slot number in the frame
+};
+
+/*
+ *  The acknowledged delivery. The data packet with PKT_F_ACK flag is answered by PKT_ACK right after it is received,
+ *  the retry of the packet already accepted (the same sequence number) is acknowledged again.
+ *  The packet with PKT_F_LISTEN flag is answered by the beacon, that acknowledges the packet as well.
+ *  The transmitter waits for the answer ack_listen_ms, then retries the packet after the random backoff
+ *  in [ack_backoff_ms; 2 * ack_backoff_ms) ms, the backoff is doubled with every retry, up to ack_retries retries.
+ *  The header ID of the answer is 0.
+ */
+const byte     ack_retries    = 3;              // The maximum number of the retries
+const uint16_t ack_listen_ms  = 250;            // The time the transmitter waits for the answer
+const uint16_t ack_backoff_ms = 50;             // The backoff before the first retry
+
+struct __attribute__((packed)) pkt_ack {        // PKT_ACK packet
+  struct   pkt_header hdr;
+  byte     ID;                                  // The transmitter ID
+  uint16_t seq;                                 // The sequence number of the packet acknowledged
+  uint16_t crc;
+};
+
+/*
+ *  The packet received by the radio with the reception time and the signal strength
+ */
+const byte rx_max_len = 50;                     // The maximum packet length, equals to RH_RF22_MAX_MESSAGE_LEN
+struct rx_packet {
+  uint32_t ms;                                  // The time the packet was received, millis()
+  int8_t   rssi;                                // The received signal strength, dBm
+  byte     len;                                 // The packet length
+  byte     buff[rx_max_len];
 };
-const byte pl_size    = sizeof(struct data);    // The packet size
 
-#endif
+#endif
@@ -28,26 +28,35 @@
 #include "log.h"
 #include "mail.h"
 #include "wm_data.h"
+#include "radio.h"
+#include "link.h"
+#include "esp_hal.h"
+#include "profile.h"
+#include "packet.h"
 
 const byte ss_pin  = 15;                        // select pin number
 const byte irq_pin = 5;                         // irq    pin number
 const byte hb_pin  = 4;                         // heart beat LED pin
 
 const uint16_t  web_port          =        80;
-const byte      radio_wait        =       300;
 const char*     clr_RED           = "#FF0000";
 const char*     clr_YELLOW        = "#00FFFF";
 const char*     clr_GREEN         = "#00FF00";
 
-RH_RF22           rf22(ss_pin, irq_pin);        // Singleton instance of the radio driver
+rfQueue           rf22(ss_pin, irq_pin);        // Singleton instance of the radio driver, used in web.cpp
+ntpClock          ntp;                          // Global variable, used in web.cpp
+espHAL            esp_hal(rf22, ntp);           // The esp8266 implementation of the hardware abstraction layer
+HAL&              hal = esp_hal;                // Global variable, used by the pool, config, log and notifier
 WMconfig          cfg;                          // Global variable, used in web.cpp and mail.cpp
 WMpool            pool;                         // Global variable, used in web.cpp and mail.cpp
-ntpClock          ntp;                          // Global variable, used in web.cpp
 web               server(web_port);             // Global variable, used in web.cpp
-wmlog             data_log;
+wmlog             data_log;                     // Global variable, used in web.cpp and mail.cpp
 notifier          e_notify;                     // The scheduled e-mail notifier
-bool              log_data_loaded = false;      // This flag indicates that log data have been loaded
+wmLink            wm_link;                      // The packet decoder, used in web.cpp
+loopProfile       loop_profile;                 // The time budget of the main loop, used in web.cpp
+bool              log_data_loaded = false;      // The log data have been loaded, after the clock is synchronized
 byte              blynk_wm_index = 0;
+uint32_t          boot_ms = 0;                  // The time from power on till the packets are processed, used in web.cpp
 String b_auth;                                  // Blynk authentication key value
 
 // Forward function declaration
@@ -182,7 +191,7 @@ netMode* blynkTrying::run(void) {
   server.handleClient();
 
   ntp.syncTime();                               // Sync local clock with ntp (not every call)
-  if (!log_data_loaded) {                       // Trying to load data from the current log
+  if (!log_data_loaded && ntp.synchronized()) { // Load the current log when the date is known
     loadLogData();
     log_data_loaded = true;
   }
@@ -215,7 +224,7 @@ netMode* blynkOK::run(void) {
   Blynk.run();
   server.handleClient();
   ntp.syncTime();                               // Sync local clock with ntp (not every call)
-  if (!log_data_loaded) {                       // Trying to load data from the current log
+  if (!log_data_loaded && ntp.synchronized()) { // Load the current log when the date is known
     loadLogData();
     log_data_loaded = true;
   }
@@ -265,16 +274,19 @@ void setup(void) {
     while(1) yield();                           // Stay here twiddling thumbs waiting
   }
 
+  data_log.convertLogs();                       // Convert the old json logs into binary format
   pool.init();                                  // Initialize the water meters pool
   if (cfg.init()) {                             // the configuration has been succesfully loaded
     byte wm_num = cfg.wmCount();
     if (wm_num > 0) {
-      WMuData *wud = cfg.getWMuData();
-      for (byte i = 0; i < wm_num; ++i) {
-        pool.WMinit(wud[i].ID, wud[i].wm_shift[WM_COLD], wud[i].wm_shift[WM_HOT]);
+      for (byte i = 0; i < cfg.wmSlots(); ++i) {
+        WMuData *wud = cfg.getWMuData(i);
+        if (wud->configured)
+          pool.WMinit(wud->ID, wud->wm_shift[WM_COLD], wud->wm_shift[WM_HOT]);
       }
       byte frac_size = cfg.frac();
       pool.setFractionDigits(frac_size);
+      data_log.setDurability(cfg.logFlush());
       b_auth = cfg.auth();                      // b_auth is the global variable
       e_notify.init();                          // Setup the e-mail notoficator
     }
@@ -289,6 +301,7 @@ void setup(void) {
   nBlynkTry.setupNextMode(1, &nTry);            // Reconnect to the WiFi network
   nOK.setupNextMode(0, &nBlynkTry);             // Reconnect to connect to blynk server
   currentMode->init();
+  boot_ms = millis();
 }
 
 void loadLogData(void) {
@@ -299,6 +312,7 @@ void loadLogData(void) {
     uint32_t cold, hot;
     time_t   ts;
     byte ID = wm_id[i];
+    if (pool.battery(ID) > 0) continue;         // The controller has reported since boot, the log data are older
     if (data_log.data(ID, cold, hot, ts) ) {
       struct data wmd;
       long sc = pool.shift(ID, false);
@@ -307,6 +321,8 @@ void loadLogData(void) {
       wmd.wm_data[WM_HOT]  = hot  - sh;
       wmd.batt_mv = 3000;
       wmd.ID = ID;
+      wmd.ee_wear = 0;
+      wmd.channels = 0;                         // Keep the other meters
       pool.update(wmd, ts);
     }
   }
@@ -433,21 +449,15 @@ BLYNK_READ(V7) {                                // Battery voltage
 void loop() {
   static time_t log_remove = 0;
   
-  if (rf22.waitAvailableTimeout(radio_wait)) {
-    struct data wm;                             // Defined in wm_data.h file
-    byte len = sizeof(struct data);
-    if (rf22.recv((byte*)&wm, &len)) {
-      pool.update(wm);
-      String loc = cfg.location(wm.ID);
-      if (loc.length() == 0) {
-        cfg.setLocation(wm.ID, String(wm.ID));
-      }
-      long cold = pool.shift(wm.ID, false) + wm.wm_data[WM_COLD];
-      long hot  = pool.shift(wm.ID, true)  + wm.wm_data[WM_HOT];
-      data_log.log(wm.ID, cold, hot);
-    }
+  loop_profile.start();
+  struct rx_packet pkt;                         // Defined in wm_data.h file
+  for (byte i = 0; i < RX_QUEUE_SIZE; ++i) {    // Do not wait for the radio, process the received packets only
+    if (!hal.radioRecv(pkt)) break;
+    processPacket(pkt);
   }
+  loop_profile.section(LP_RADIO);
   yield();
+  loop_profile.section(LP_SYSTEM);
 
   netMode* nxtMode = currentMode->run();
   if (nxtMode != currentMode) {
@@ -458,16 +468,23 @@ void loop() {
     }
   }
   heartBeatBlink(currentMode);
+  loop_profile.section(LP_NET);
+  cfg.run();                                    // Save the configuration changes made in the web pages
+  data_log.run();                               // Write the buffered log records when they are too old
+  loop_profile.section(LP_STORE);
   yield();
+  loop_profile.section(LP_SYSTEM);
 
   if (currentMode == &nOK) {
     e_notify.send();                            // Send e-mail notofications
-    time_t ts = now();
-    if (ts >= log_remove) {
+    time_t ts = hal.clock();
+    if (ntp.synchronized() && ts >= log_remove) {
       log_remove = ts + 60 * 60 * 24;           // Run next log remove procedure in 24 hours
       ts -= 60 * 60 * 24 * 90;                  // remove log files created 90 days ago
       data_log.removeOldLog(ts);
     }
   }
+  loop_profile.section(LP_MAIL);
+  loop_profile.endLoop();
 }
-
+